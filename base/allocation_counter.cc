@@ -0,0 +1,30 @@
+// Copyright 2013, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "base/allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic_ullong num_allocations(0);
+
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* res = malloc(size);
+  if (res == nullptr)
+    throw std::bad_alloc();
+  return res;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace base {
+
+uint64_t NumAllocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
+}  // namespace base
@@ -0,0 +1,19 @@
+// Copyright 2013, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+// Test and benchmark helper: linking with allocation_counter replaces the global
+// operator new/delete with versions that count heap allocations of the whole process.
+// Do not link it into production binaries.
+#ifndef _BASE_ALLOCATION_COUNTER_H
+#define _BASE_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+namespace base {
+
+// Number of calls to the global operator new since the process started.
+uint64_t NumAllocations();
+
+}  // namespace base
+
+#endif  // _BASE_ALLOCATION_COUNTER_H
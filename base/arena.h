@@ -10,6 +10,7 @@
 #include <vector>
 #include <cassert>
 #include <cstdint>
+#include <new>
 
 namespace base {
 
@@ -66,6 +67,41 @@ inline char* Arena::Allocate(size_t bytes) {
   return AllocateFallback(bytes);
 }
 
+// STL allocator that takes memory from an arena. deallocate() does nothing, the memory is
+// released together with the arena. With null arena it allocates from the heap.
+template<typename T> class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena* arena = nullptr) : arena_(arena) {}
+
+  template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    if (arena_)
+      return reinterpret_cast<T*>(arena_->AllocateAligned(n * sizeof(T)));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t) {
+    if (!arena_)
+      ::operator delete(ptr);
+  }
+
+  Arena* arena() const { return arena_; }
+
+  template<typename U> bool operator==(const ArenaAllocator<U>& other) const {
+    return arena_ == other.arena();
+  }
+
+  template<typename U> bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena* arena_;
+};
+
 }  // namespace base
 
 #endif  // _BASE_UTIL_ARENA_H_
@@ -2,9 +2,11 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include "base/cuckoo_map.h"
+#include "base/fixed_cuckoo_map.h"
 #include "base/random.h"
 #include "base/gtest.h"
 
+#include <algorithm>
 #include <unordered_set>
 #include <sparsehash/dense_hash_set>
 #include "base/hash.h"
@@ -111,6 +113,78 @@ TEST_F(CuckooMapTest, Compact) {
   }
 }
 
+// Hashes all keys into a few buckets so that the table must grow and evict a lot.
+struct BadHash {
+  uint64 operator()(uint64 k) const {
+    return CuckooHash64()(k % 64);
+  }
+};
+
+template<typename Map> void TestFixedMap(Map* m) {
+  m->SetEmptyKey(0);
+  MTRandom rand(10);
+  const uint32 kLength = 100000;
+  std::vector<uint64> keys;
+  for (uint32 k = 0; k < kLength; ++k) {
+    uint64 v = rand.Rand64();
+    while (v == 0 || m->find(v) != Map::npos) {
+      v = rand.Rand64();
+    }
+    auto res = m->Insert(v, v * 2);
+    ASSERT_TRUE(res.second);
+    ASSERT_EQ(v, m->FromDenseId(res.first).first);
+    ASSERT_EQ(v * 2, *m->FromDenseId(res.first).second);
+    keys.push_back(v);
+  }
+  EXPECT_EQ(kLength, m->size());
+  EXPECT_FALSE(m->Insert(keys[0], 1).second);
+  LOG(INFO) << "Utilization " << m->Utilization();
+
+  for (uint32 k = 0; k < kLength; ++k) {
+    keys.push_back(k + 1);  // Mostly misses.
+  }
+  std::vector<typename Map::dense_id> ids(keys.size());
+  m->FindMany(keys.data(), keys.size(), ids.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto id = m->find(keys[i]);
+    ASSERT_EQ(id, ids[i]);
+    if (i < kLength) {
+      ASSERT_NE(Map::npos, id);
+      ASSERT_EQ(keys[i] * 2, *m->FromDenseId(id).second);
+    }
+  }
+  m->Clear();
+  EXPECT_TRUE(m->empty());
+  EXPECT_EQ(Map::npos, m->find(keys[0]));
+}
+
+TEST_F(CuckooMapTest, FixedMap) {
+  FixedCuckooMap<uint64> m4;
+  TestFixedMap(&m4);
+
+  FixedCuckooMap<uint64, 2> m2;
+  TestFixedMap(&m2);
+
+  FixedCuckooMap<uint64, 8> m8;
+  TestFixedMap(&m8);
+}
+
+TEST_F(CuckooMapTest, FixedMapCollisions) {
+  FixedCuckooMap<uint32, 4, BadHash> m;
+  m.SetEmptyKey(0);
+  // Keys with the same k % 64 share their two buckets, which hold at most 8 of them.
+  for (uint32 k = 1; k <= 6 * 64; ++k) {
+    auto res = m.Insert(k, k);
+    ASSERT_TRUE(res.second);
+    ASSERT_EQ(k, m.FromDenseId(res.first).first);
+  }
+  for (uint32 k = 1; k <= 6 * 64; ++k) {
+    auto id = m.find(k);
+    ASSERT_NE(m.npos, id);
+    ASSERT_EQ(k, *m.FromDenseId(id).second);
+  }
+}
+
 DECLARE_BENCHMARK_FUNC(BM_InsertDenseSet, iters) {
   ::google::dense_hash_set<uint64, cityhash32> set;
   set.set_empty_key(0);
@@ -242,6 +316,72 @@ DECLARE_BENCHMARK_FUNC(BM_FindCuckooRandomAfterCompact, iters) {
   }
 }
 
+// The following benchmarks compare CuckooMap and FixedCuckooMap with the same workload:
+// one random hit and two misses per iteration.
+// Per lookup, best of 3, on one AVX2 core:
+//
+//   keys        CuckooMap::find  FixedCuckooMap::find  FixedCuckooMap::FindMany
+//   1K          16.6ns           9.5ns                 7.5ns
+//   64K         33.0ns           24.6ns                19.1ns
+//   1M          103.9ns          63.7ns                41.1ns
+//   4M          116.6ns          74.9ns                47.9ns
+template<typename Map> static void FillRandom(uint32 iters, Map* m, std::vector<uint64>* vals) {
+  m->SetEmptyKey(0);
+  MTRandom rand(20);
+  vals->resize(iters * 3);
+  for (uint32 i = 0; i < iters; ++i) {
+    uint64 v = rand.Rand64();
+    if (v == 0) v = 1;
+    m->Insert(v, v);
+    (*vals)[i * 3] = v;
+    (*vals)[i * 3 + 1] = i + 1;
+    (*vals)[i * 3 + 2] = iters + i + 1;
+  }
+  std::random_shuffle(vals->begin(), vals->end());
+}
+
+DECLARE_BENCHMARK_FUNC(BM_FindCuckooMapRandom, iters) {
+  StopBenchmarkTiming();
+  CuckooMap<uint64> m(unsigned(iters * 1.3));
+  std::vector<uint64> vals;
+  FillRandom(iters, &m, &vals);
+  StartBenchmarkTiming();
+  for (uint64 v : vals) {
+    sink_result(m.find(v));
+  }
+}
+
+DECLARE_BENCHMARK_FUNC(BM_FindFixedCuckooRandom, iters) {
+  StopBenchmarkTiming();
+  FixedCuckooMap<uint64> m(unsigned(iters * 1.3));
+  std::vector<uint64> vals;
+  FillRandom(iters, &m, &vals);
+  StartBenchmarkTiming();
+  for (uint64 v : vals) {
+    sink_result(m.find(v));
+  }
+}
+
+DECLARE_BENCHMARK_FUNC(BM_FindManyFixedCuckooRandom, iters) {
+  StopBenchmarkTiming();
+  FixedCuckooMap<uint64> m(unsigned(iters * 1.3));
+  std::vector<uint64> vals;
+  FillRandom(iters, &m, &vals);
+  std::vector<uint32> ids(vals.size());
+  StartBenchmarkTiming();
+  m.FindMany(vals.data(), vals.size(), ids.data());
+  sink_result(ids.back());
+}
+
+DECLARE_BENCHMARK_FUNC(BM_InsertFixedCuckoo, iters) {
+  FixedCuckooMap<uint64> m(int(iters * 1.3));
+  m.SetEmptyKey(0);
+  m.SetGrowth(1.5);
+  for (uint64 i = 0; i < iters; ++i) {
+    m.Insert(1 + (i + 1) * i, i);
+  }
+}
+
 DECLARE_BENCHMARK_FUNC(BM_CuckooCompact, iters) {
   StopBenchmarkTiming();
   CuckooMapTable m(0, unsigned(iters*1.3));
@@ -0,0 +1,417 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#ifndef _FIXED_CUCKOO_MAP_H
+#define _FIXED_CUCKOO_MAP_H
+
+#include <immintrin.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+
+#include "base/bits.h"
+#include "base/integral_types.h"
+#include "base/logging.h"
+
+namespace base {
+
+// Default hash for FixedCuckooMap: the finalizer of MurmurHash3.
+// The map uses the low and the high 32 bits of the hash as two independent bucket hashes,
+// therefore a custom hash must mix all 64 bits well.
+struct CuckooHash64 {
+  uint64 operator()(uint64 k) const {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+};
+
+namespace cuckoo_internal {
+
+// Compares all the keys of a bucket with k and returns the bitmask of matching slots.
+// Sse2Probe compares 2 keys per instruction and Avx2Probe compares 4.
+struct Sse2Probe {
+  template<unsigned N> static uint32 Match(const uint64* keys, uint64 k) {
+    const __m128i val = _mm_set1_epi64x(k);
+    uint32 mask = 0;
+    for (unsigned i = 0; i < N; i += 2) {
+      __m128i cmp = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)),
+                                    val);
+      // A 64-bit key matches if both of its 32-bit halves match.
+      cmp = _mm_and_si128(cmp, _mm_shuffle_epi32(cmp, _MM_SHUFFLE(2, 3, 0, 1)));
+      mask |= uint32(_mm_movemask_pd(_mm_castsi128_pd(cmp))) << i;
+    }
+    return mask;
+  }
+};
+
+struct Avx2Probe {
+  template<unsigned N> __attribute__((target("avx2")))
+  static uint32 Match(const uint64* keys, uint64 k) {
+    if (N < 4)
+      return Sse2Probe::Match<N>(keys, k);
+    const __m256i val = _mm256_set1_epi64x(k);
+    uint32 mask = 0;
+    for (unsigned i = 0; i < N; i += 4) {
+      __m256i cmp = _mm256_cmpeq_epi64(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), val);
+      mask |= uint32(_mm256_movemask_pd(_mm256_castsi256_pd(cmp))) << i;
+    }
+    return mask;
+  }
+};
+
+// Chosen at compile time, i.e. SSE2 unless the build targets AVX2. Only FindMany() switches
+// to AVX2 at runtime, since a per-call dispatch costs more than it saves for a single key.
+#ifdef __AVX2__
+typedef Avx2Probe DefaultProbe;
+#else
+typedef Sse2Probe DefaultProbe;
+#endif
+
+inline bool HasAvx2() {
+  static const bool res = __builtin_cpu_supports("avx2");
+  return res;
+}
+
+}  // namespace cuckoo_internal
+
+/*
+  Cuckoo map from uint64 keys to values of type T with the bucket length and the hash function
+  fixed at compile time. Unlike CuckooMap, which is backed by CuckooMapTable with
+  runtime value size, it compares all keys of a bucket with SIMD instructions and
+  maps hashes to buckets with a multiplication instead of a modulo. Hence table sizes
+  need not be prime.
+  T must be trivially copyable. kBucketLength must be a power of 2 between 2 and 16.
+  Compact() is not supported.
+*/
+template<typename T, unsigned kBucketLength = 4, typename Hash = CuckooHash64>
+class FixedCuckooMap {
+  static_assert(kBucketLength >= 2 && kBucketLength <= 16 &&
+                ((kBucketLength - 1) & kBucketLength) == 0,
+                "kBucketLength must be a power of 2 between 2 and 16");
+  typedef uint32 BucketId;
+  typedef std::pair<BucketId, BucketId> BucketIdPair;
+
+  struct Bucket {
+    uint64 key[kBucketLength];
+    T value[kBucketLength];
+  };
+
+  struct FreeDeleter {
+    void operator()(Bucket* b) const { free(b); }
+  };
+
+ public:
+  typedef uint32 dense_id;
+  typedef uint64 key_type;
+
+  static constexpr dense_id npos = kuint32max;
+
+  // Allocates space for at least the given number of key-values.
+  explicit FixedCuckooMap(uint32 capacity = 0) {
+    Allocate(16 + capacity / kBucketLength);
+  }
+
+  // Must be called before insertions take place.
+  void SetEmptyKey(key_type k) {
+    CHECK(!empty_key_set_);
+    empty_key_ = k;
+    empty_key_set_ = true;
+    SetEmptyKeys();
+  }
+
+  // Inserts (k, v) into the map. If k already exists, the map is not changed.
+  // Returns the dense id of k and whether it was inserted. Invalidates all dense ids.
+  std::pair<dense_id, bool> Insert(key_type k, const T& v);
+
+  // Returns the dense id of k or npos if k was not found.
+  // Uses DefaultProbe, hence SSE2 compares unless compiled with -mavx2.
+  dense_id find(key_type k) const {
+    BucketIdPair ids = HashToIdPair(k);
+    __builtin_prefetch(GetBucket(ids.second));
+    return FindInBuckets<cuckoo_internal::DefaultProbe>(ids, k);
+  }
+
+  // Looks up n keys and stores their dense ids (or npos) into out.
+  // Uses AVX2 compares when the cpu supports it.
+  // Computes and prefetches bucket addresses of a batch of keys before probing them,
+  // so that cache misses of different keys overlap.
+  void FindMany(const key_type* keys, size_t n, dense_id* out) const;
+
+  std::pair<key_type, T*> FromDenseId(dense_id d) {
+    DCHECK_LT(d, Capacity());
+    Bucket* b = GetBucket(d / kBucketLength);
+    unsigned index = d % kBucketLength;
+    return std::pair<key_type, T*>(b->key[index], b->value + index);
+  }
+
+  std::pair<key_type, const T*> FromDenseId(dense_id d) const {
+    DCHECK_LT(d, Capacity());
+    const Bucket* b = GetBucket(d / kBucketLength);
+    unsigned index = d % kBucketLength;
+    return std::pair<key_type, const T*>(b->key[index], b->value + index);
+  }
+
+  // Erases all elements.
+  void Clear() {
+    size_ = 0;
+    SetEmptyKeys();
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // All valid dense ids are in the range [0, Capacity()).
+  dense_id Capacity() const { return bucket_count_ * kBucketLength; }
+
+  // Sets the new growth factor. Must be greater than 1.01.
+  void SetGrowth(float growth) {
+    CHECK_GT(growth, 1.01f);
+    growth_ = growth;
+  }
+
+  double Utilization() const { return size() * 1.0 / Capacity(); }
+
+  uint64 BytesAllocated() const { return uint64(bucket_count_) * sizeof(Bucket); }
+
+ private:
+  static dense_id ToDenseId(BucketId id, unsigned index) { return id * kBucketLength + index; }
+
+  Bucket* GetBucket(BucketId id) { return buckets_.get() + id; }
+  const Bucket* GetBucket(BucketId id) const { return buckets_.get() + id; }
+
+  // Maps a 32-bit hash uniformly onto [0, bucket_count_) without division.
+  BucketId Reduce(uint32 h) const { return (uint64(h) * bucket_count_) >> 32; }
+
+  BucketIdPair HashToIdPair(key_type k) const {
+    uint64 h = Hash()(k);
+    BucketId a = Reduce(h), b = Reduce(h >> 32);
+    if (__builtin_expect(a == b, 0)) {
+      b = (b + 1 == bucket_count_) ? 0 : b + 1;
+    }
+    return BucketIdPair(a, b);
+  }
+
+  BucketId OtherBucket(BucketId current, key_type k) const {
+    BucketIdPair ids = HashToIdPair(k);
+    DCHECK(ids.first == current || ids.second == current);
+    return current == ids.first ? ids.second : ids.first;
+  }
+
+  template<typename Probe> dense_id FindInBuckets(const BucketIdPair& ids, key_type k) const {
+    uint32 mask = Probe::template Match<kBucketLength>(GetBucket(ids.first)->key, k);
+    if (mask)
+      return ToDenseId(ids.first, Bits::FindLSBSetNonZero(mask));
+    mask = Probe::template Match<kBucketLength>(GetBucket(ids.second)->key, k);
+    if (mask)
+      return ToDenseId(ids.second, Bits::FindLSBSetNonZero(mask));
+    return npos;
+  }
+
+  template<typename Probe> inline __attribute__((always_inline))
+  void FindManyImpl(const key_type* keys, size_t n, dense_id* out) const;
+
+  __attribute__((target("avx2")))
+  void FindManyAvx2(const key_type* keys, size_t n, dense_id* out) const {
+    FindManyImpl<cuckoo_internal::Avx2Probe>(keys, n, out);
+  }
+
+  uint32 EmptyMask(BucketId id) const {
+    return cuckoo_internal::DefaultProbe::Match<kBucketLength>(GetBucket(id)->key, empty_key_);
+  }
+
+  // Puts (*key, *value) into the table, possibly displacing other entries along a random walk.
+  // On success, returns the dense id where the original *key was stored.
+  // On failure returns npos and *key, *value hold the entry that was left without a slot.
+  dense_id Place(key_type* key, T* value);
+
+  // Allocates a bigger table and reinserts all entries together with (*key, *value).
+  void Grow(key_type* key, T* value);
+
+  void Allocate(BucketId bucket_count);
+  void SetEmptyKeys();
+
+  unsigned RandomIndex() {
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 17;
+    random_state_ ^= random_state_ << 5;
+    return random_state_ % kBucketLength;
+  }
+
+  std::unique_ptr<Bucket, FreeDeleter> buckets_;
+  BucketId bucket_count_ = 0;
+  size_t size_ = 0;
+
+  key_type empty_key_ = 0;
+  bool empty_key_set_ = false;
+
+  float growth_ = 1.2f;
+
+  // The number of evictions that can happen during insertion of a value before
+  // we grow the container.
+  uint32 shifts_limit_ = 0;
+  uint32 random_state_ = 2463534242U;
+
+  FixedCuckooMap(const FixedCuckooMap&) = delete;
+  void operator=(const FixedCuckooMap&) = delete;
+};
+
+// Implementation
+/******************************************************************/
+template<typename T, unsigned L, typename H>
+constexpr typename FixedCuckooMap<T, L, H>::dense_id FixedCuckooMap<T, L, H>::npos;
+
+template<typename T, unsigned L, typename H>
+auto FixedCuckooMap<T, L, H>::Insert(key_type k, const T& v) -> std::pair<dense_id, bool> {
+  DCHECK(empty_key_set_);
+  DCHECK_NE(empty_key_, k);
+
+  std::pair<dense_id, bool> result(find(k), false);
+  if (result.first != npos)
+    return result;
+  result.second = true;
+
+  key_type key = k;
+  T value = v;
+  result.first = Place(&key, &value);
+  if (result.first == npos) {
+    Grow(&key, &value);
+    result.first = find(k);
+  }
+  ++size_;
+  return result;
+}
+
+template<typename T, unsigned L, typename H>
+template<typename Probe>
+inline void FixedCuckooMap<T, L, H>::FindManyImpl(const key_type* keys, size_t n, dense_id* out) const {
+  constexpr unsigned kBatch = 16;
+  BucketIdPair ids[kBatch];
+  for (size_t i = 0; i < n; i += kBatch) {
+    const unsigned count = std::min<size_t>(kBatch, n - i);
+    for (unsigned j = 0; j < count; ++j) {
+      ids[j] = HashToIdPair(keys[i + j]);
+      __builtin_prefetch(GetBucket(ids[j].first));
+      __builtin_prefetch(GetBucket(ids[j].second));
+    }
+    for (unsigned j = 0; j < count; ++j) {
+      out[i + j] = FindInBuckets<Probe>(ids[j], keys[i + j]);
+    }
+  }
+}
+
+template<typename T, unsigned L, typename H>
+void FixedCuckooMap<T, L, H>::FindMany(const key_type* keys, size_t n, dense_id* out) const {
+#ifdef __AVX2__
+  FindManyImpl<cuckoo_internal::Avx2Probe>(keys, n, out);
+#else
+  if (cuckoo_internal::HasAvx2()) {
+    FindManyAvx2(keys, n, out);
+  } else {
+    FindManyImpl<cuckoo_internal::Sse2Probe>(keys, n, out);
+  }
+#endif
+}
+
+template<typename T, unsigned L, typename H>
+auto FixedCuckooMap<T, L, H>::Place(key_type* key, T* value) -> dense_id {
+  BucketIdPair ids = HashToIdPair(*key);
+  BucketId bid = ids.first;
+  uint32 empty = EmptyMask(bid);
+  if (!empty) {
+    bid = ids.second;
+    empty = EmptyMask(bid);
+  }
+  if (!empty) {
+    // Both buckets are full: evict a random entry and move it to its alternative bucket.
+    bid = (random_state_ & 1) ? ids.first : ids.second;
+    const BucketId start_bid = bid;
+    const unsigned start_index = RandomIndex();
+    unsigned index = start_index;
+    for (uint32 j = 0; j < shifts_limit_; ++j) {
+      Bucket* b = GetBucket(bid);
+      std::swap(*key, b->key[index]);
+      std::swap(*value, b->value[index]);
+      bid = OtherBucket(bid, *key);
+      empty = EmptyMask(bid);
+      if (empty) {
+        unsigned i = Bits::FindLSBSetNonZero(empty);
+        GetBucket(bid)->key[i] = *key;
+        GetBucket(bid)->value[i] = *value;
+        return ToDenseId(start_bid, start_index);
+      }
+      index = RandomIndex();
+      if (bid == start_bid && index == start_index) {
+        // We made an exact cycle, try another slot.
+        index = (index + 1) % L;
+      }
+    }
+    return npos;
+  }
+  unsigned i = Bits::FindLSBSetNonZero(empty);
+  Bucket* b = GetBucket(bid);
+  b->key[i] = *key;
+  b->value[i] = *value;
+  return ToDenseId(bid, i);
+}
+
+template<typename T, unsigned L, typename H>
+void FixedCuckooMap<T, L, H>::Grow(key_type* key, T* value) {
+  std::unique_ptr<Bucket, FreeDeleter> old(buckets_.release());
+  const BucketId old_count = bucket_count_;
+  BucketId new_count = old_count;
+  while (true) {
+    new_count = std::max<BucketId>(new_count * growth_, new_count + 1);
+    VLOG(1) << "Growing from " << old_count << " to " << new_count << " buckets";
+    Allocate(new_count);
+
+    // The table is empty, so the pending entry is placed without evictions.
+    key_type k = *key;
+    T v = *value;
+    CHECK_NE(npos, Place(&k, &v));
+
+    bool success = true;
+    for (BucketId i = 0; i < old_count && success; ++i) {
+      const Bucket& b = old.get()[i];
+      for (unsigned j = 0; j < L; ++j) {
+        if (b.key[j] == empty_key_)
+          continue;
+        k = b.key[j];
+        v = b.value[j];
+        if (Place(&k, &v) == npos) {
+          success = false;
+          break;
+        }
+      }
+    }
+    if (success)
+      break;
+  }
+}
+
+template<typename T, unsigned L, typename H>
+void FixedCuckooMap<T, L, H>::Allocate(BucketId bucket_count) {
+  CHECK_GE(bucket_count, 2);
+  void* ptr = nullptr;
+  CHECK_EQ(0, posix_memalign(&ptr, 64, sizeof(Bucket) * bucket_count));
+  buckets_.reset(reinterpret_cast<Bucket*>(ptr));
+  bucket_count_ = bucket_count;
+  shifts_limit_ = Bits::Log2FloorNonZero(bucket_count) * 2;
+  SetEmptyKeys();
+}
+
+template<typename T, unsigned L, typename H>
+void FixedCuckooMap<T, L, H>::SetEmptyKeys() {
+  Bucket* b = buckets_.get();
+  for (BucketId i = 0; i < bucket_count_; ++i) {
+    std::fill(b[i].key, b[i].key + L, empty_key_);
+  }
+}
+
+}  // namespace base
+
+#endif  // _FIXED_CUCKOO_MAP_H
@@ -310,6 +310,10 @@ public:
   size_t Size() const override {
     return sz_;
   }
+
+  void Advise(AccessPattern pattern) override;
+
+  bool IsMapped() const override { return true; }
 };
 
 Status PosixMmapReadonlyFile::Read(
@@ -324,6 +328,18 @@ Status PosixMmapReadonlyFile::Read(
   return s;
 }
 
+void PosixMmapReadonlyFile::Advise(AccessPattern pattern) {
+  int advice = MADV_NORMAL;
+  switch (pattern) {
+    case ACCESS_NORMAL: break;
+    case ACCESS_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case ACCESS_RANDOM: advice = MADV_RANDOM; break;
+  }
+  if (sz_ && madvise(base_, sz_, advice) < 0) {
+    LOG(WARNING) << "madvise failed: " << strerror(errno);
+  }
+}
+
 Status PosixMmapReadonlyFile::Close() {
   if (munmap(base_, sz_) < 0) {
     return LocalFileError();
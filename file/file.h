@@ -48,6 +48,16 @@ public:
 
   virtual size_t Size() const = 0;
 
+  enum AccessPattern { ACCESS_NORMAL, ACCESS_SEQUENTIAL, ACCESS_RANDOM };
+
+  // Hints the OS about the expected access pattern of the whole file.
+  // The default implementation ignores the hint.
+  virtual void Advise(AccessPattern pattern) {}
+
+  // Returns true if Read() never uses its buffer argument and returns slices that stay valid
+  // until the file is closed. Callers may then keep these slices instead of copying them.
+  virtual bool IsMapped() const { return false; }
+
   // Factory function that creates the ReadonlyFile object.
   // The ownership is passed to the caller.
   static base::StatusObject<ReadonlyFile*> Open(StringPiece name);
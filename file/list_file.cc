@@ -4,7 +4,11 @@
 
 #include "file/list_file.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <snappy-c.h>
+#include <thread>
 
 #include "file/filesource.h"
 #include "file/file_util.h"
@@ -48,6 +52,25 @@ public:
 
 }  // namespace
 
+// A batch holds varint32 prefixed records.
+struct ListWriter::AsyncState {
+  struct Batch {
+    std::string data;
+    bool flush = false;
+  };
+
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::unique_ptr<Batch>> queue;  // Guarded by mu.
+  std::vector<std::unique_ptr<Batch>> free_batches;  // Guarded by mu.
+  uint64 submitted = 0, processed = 0;  // Guarded by mu.
+  bool stop = false;  // Guarded by mu.
+  Status status;  // First error of the background thread. Guarded by mu.
+
+  std::unique_ptr<Batch> current;  // Filled by AddRecord.
+  std::thread thread;
+};
+
 ListWriter::ListWriter(StringPiece filename, const Options& options)
     : options_(options) {
   File* file = file_util::OpenOrDie(filename, "w");
@@ -71,6 +94,12 @@ void ListWriter::Construct() {
 }
 
 ListWriter::~ListWriter() {
+  Status st = StopAsync();
+  if (!st.ok()) {
+    // The records after the failure were dropped. Flush() returns the same error.
+    LOG(ERROR) << "Error writing list file: " << st;
+    return;
+  }
   DCHECK_EQ(array_records_, 0) << "ListWriter::Flush() was not called!";
   CHECK(Flush().ok());
 }
@@ -121,9 +150,92 @@ util::Status ListWriter::Init() {
     RETURN_IF_ERROR(dest_->Append(Slice(buf.data(), buf.size())));
   }
   init_called_ = true;
+  if (options_.async) {
+    CHECK_GT(options_.async_queue_size, 0);
+    async_.reset(new AsyncState);
+    async_->current.reset(new AsyncState::Batch);
+    async_->thread = std::thread(&ListWriter::AsyncLoop, this);
+  }
   return Status::OK;
 }
 
+void ListWriter::SubmitBatch(bool flush) {
+  AsyncState& as = *async_;
+  as.current->flush = flush;
+  std::unique_lock<std::mutex> lock(as.mu);
+  const size_t max_size = options_.async_queue_size;
+  as.cv.wait(lock, [&as, max_size] { return as.queue.size() < max_size; });
+  as.queue.push_back(std::move(as.current));
+  ++as.submitted;
+  if (as.free_batches.empty()) {
+    as.current.reset(new AsyncState::Batch);
+  } else {
+    as.current = std::move(as.free_batches.back());
+    as.free_batches.pop_back();
+  }
+  as.cv.notify_all();
+}
+
+void ListWriter::AsyncLoop() {
+  AsyncState& as = *async_;
+  while (true) {
+    std::unique_ptr<AsyncState::Batch> batch;
+    Status st;
+    {
+      std::unique_lock<std::mutex> lock(as.mu);
+      as.cv.wait(lock, [&as] { return as.stop || !as.queue.empty(); });
+      if (as.queue.empty())
+        break;
+      batch = std::move(as.queue.front());
+      as.queue.pop_front();
+      as.cv.notify_all();
+
+      // Once a write failed, the following batches are dropped rather than written after a gap.
+      st = as.status;
+    }
+
+    const uint8* ptr = reinterpret_cast<const uint8*>(batch->data.data());
+    const uint8* end = ptr + batch->data.size();
+    while (ptr < end && st.ok()) {
+      uint32 size = 0;
+      ptr = Varint::Parse32WithLimit(ptr, end, &size);
+      CHECK(ptr != nullptr && ptr + size <= end);
+      st = WriteRecord(Slice(ptr, size));
+      ptr += size;
+    }
+    if (st.ok() && batch->flush) {
+      st = FlushArray();
+    }
+    batch->data.clear();
+
+    std::lock_guard<std::mutex> lock(as.mu);
+    if (!st.ok() && as.status.ok()) {
+      as.status = st;
+    }
+    ++as.processed;
+    as.free_batches.push_back(std::move(batch));
+    as.cv.notify_all();
+  }
+}
+
+// Writes out all pending batches and stops the background thread.
+Status ListWriter::StopAsync() {
+  if (!async_)
+    return Status::OK;
+  if (!async_->current->data.empty()) {
+    SubmitBatch(false);
+  }
+  {
+    std::lock_guard<std::mutex> lock(async_->mu);
+    async_->stop = true;
+    async_->cv.notify_all();
+  }
+  async_->thread.join();
+  Status st = async_->status;
+  async_.reset();
+  return st;
+}
+
 inline void ListWriter::AddRecordToArray(Slice size_enc, Slice record) {
   memcpy(array_next_, size_enc.data(), size_enc.size());
   memcpy(array_next_ + size_enc.size(), record.data(), record.size());
@@ -146,13 +258,30 @@ inline Status ListWriter::FlushArray() {
 
 Status ListWriter::AddRecord(strings::Slice record) {
   CHECK_GT(block_size_, 0) << "ListWriter::Init was not called.";
+  ++records_added_;
+  if (!async_) {
+    return WriteRecord(record);
+  }
+
+  std::string& data = async_->current->data;
+  Varint32Encoder record_size_encoded(record.size());
+  data.append(reinterpret_cast<const char*>(record_size_encoded.data()),
+              record_size_encoded.size());
+  data.append(reinterpret_cast<const char*>(record.data()), record.size());
+  if (data.size() >= block_size_) {
+    SubmitBatch(false);
+    std::lock_guard<std::mutex> lock(async_->mu);
+    return async_->status;
+  }
+  return Status::OK;
+}
 
+Status ListWriter::WriteRecord(strings::Slice record) {
   Varint32Encoder record_size_encoded(record.size());
   const uint32 record_size_total = record_size_encoded.size() + record.size();
   // Try to accomodate either in the array or a single block.  Multiple iterations might be
   // needed since we might fragment the record.
   bool fragmenting = false;
-  ++records_added_;
   while (true) {
     if (array_records_ > 0) {
       if (array_next_ + record_size_total <= array_end_) {
@@ -205,7 +334,14 @@ Status ListWriter::AddRecord(strings::Slice record) {
 }
 
 Status ListWriter::Flush() {
-  return FlushArray();
+  if (!async_) {
+    return FlushArray();
+  }
+  SubmitBatch(true);
+  AsyncState& as = *async_;
+  std::unique_lock<std::mutex> lock(as.mu);
+  as.cv.wait(lock, [&as] { return as.processed == as.submitted; });
+  return as.status;
 }
 
 using strings::charptr;
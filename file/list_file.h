@@ -5,12 +5,17 @@
 #ifndef _LIST_FILE_H_
 #define _LIST_FILE_H_
 
+#include <limits>
 #include <map>
 #include "file/file.h"
 #include "file/list_file_format.h"
 #include "strings/slice.h"
 #include "util/sinksource.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace file {
 
 class ListWriter {
@@ -19,6 +24,15 @@ class ListWriter {
     uint8 block_size_multiplier = 1;  // the block size is 64KB * multiplier
     bool use_compression = true;
 
+    // In async mode AddRecord only copies records into a batch buffer. Full batches are
+    // compressed and written to the sink by a background thread. The output is identical to
+    // the synchronous mode. Errors are reported by the subsequent calls to AddRecord or Flush.
+    bool async = false;
+
+    // Maximal number of batches (about a block each) queued for the background thread.
+    // AddRecord blocks when the queue is full.
+    uint8 async_queue_size = 4;
+
     Options() {}
   };
 
@@ -34,11 +48,19 @@ class ListWriter {
 
   util::Status Init();
   util::Status AddRecord(strings::Slice slice);
+
+  // In async mode also waits until all the records added so far are written to the sink.
+  // Returns the first error of the background thread, if any. Records added after that
+  // error are dropped.
   util::Status Flush();
 
   uint32 records_added() const { return records_added_;}
+
+  // In async mode it is up to date only after Flush().
   uint64 bytes_added() const { return bytes_added_;}
  private:
+  struct AsyncState;
+
   std::unique_ptr<util::Sink> dest_;
   std::unique_ptr<uint8[]> array_store_;
   std::unique_ptr<uint8[]> compress_buf_;
@@ -58,8 +80,20 @@ class ListWriter {
   uint32 records_added_ = 0;
   uint64 bytes_added_ = 0;
 
+  std::unique_ptr<AsyncState> async_;
+
   void Construct();
 
+  // Lays out the record in blocks and writes it to the sink.
+  util::Status WriteRecord(strings::Slice record);
+
+  // Hands the current batch to the background thread.
+  void SubmitBatch(bool flush);
+  void AsyncLoop();
+
+  // Returns the first error of the background thread.
+  util::Status StopAsync();
+
   util::Status EmitPhysicalRecord(list_file::RecordType type, const uint8* ptr,
                                   size_t length);
 
@@ -101,6 +135,21 @@ class ListReader {
 
   ~ListReader();
 
+  // Enables parallel read-ahead: up to max_blocks blocks are read, verified and decompressed
+  // on the executor's pool threads while the caller consumes records, which are still
+  // returned in file order. Memory usage is bounded by roughly 2 * max_blocks blocks.
+  // The file must support concurrent Read calls and the executor must outlive the reader.
+  // Must be called before the first read.
+  void EnablePrefetch(util::Executor* executor, unsigned max_blocks = 8);
+
+  // Restricts the reader to records that start in blocks whose file offset lies
+  // in [start, end). A record that begins inside the range but continues past its end is
+  // still returned in full. Fragments at the beginning of the range that belong to a record
+  // started in the previous range are skipped silently.
+  // Ranges that partition the file yield every record exactly once.
+  // Must be called before the first read and can not be combined with prefetching.
+  void SetRange(size_t start, size_t end);
+
   bool GetMetaData(std::map<std::string, std::string>* meta);
 
   // Read the next record into *record.  Returns true if read
@@ -118,6 +167,8 @@ class ListReader {
   //size_t LastRecordOffset() const { return last_record_offset_; }
 
 private:
+  class Prefetcher;
+
   bool ReadHeader();
 
   file::ReadonlyFile* file_;
@@ -145,6 +196,18 @@ private:
   uint32 array_records_ = 0;
   strings::Slice array_store_;
 
+  std::unique_ptr<Prefetcher> prefetcher_;
+  bool prefetch_started_ = false;
+
+  // Range set by SetRange and the offset of the block in block_buffer_.
+  size_t range_start_ = 0, range_end_ = std::numeric_limits<size_t>::max();
+  size_t block_start_ = 0;
+
+  // True until the first record that starts in the range.
+  bool resync_ = false;
+
+  bool PastRangeEnd() const;
+
   // Extend record types with the following special values
   enum {
     kEof = list_file::kMaxRecordType + 1,
@@ -172,6 +235,19 @@ private:
   void operator=(const ListReader&) = delete;
 };
 
+// Reads the list file with num_shards threads. The file is split into num_shards byte
+// ranges (see ListReader::SetRange) and each range is scanned by its own reader.
+// cb(shard, record) is called concurrently from different threads; records of the same shard
+// are passed in file order and the record data is valid only during the call.
+// file must support concurrent Read calls. As with ListReader, corrupted records are skipped
+// and the remaining records are still passed to cb. The returned status combines the first
+// corruption or read error of every shard that hit one.
+typedef std::function<void(unsigned shard, strings::Slice record)> ShardRecordCb;
+util::Status ParallelReadRecords(file::ReadonlyFile* file, unsigned num_shards,
+                                 ShardRecordCb cb, bool checksum = false);
+util::Status ParallelReadRecords(StringPiece filename, unsigned num_shards,
+                                 ShardRecordCb cb, bool checksum = false);
+
 template<typename T> void ReadProtoRecords(file::File* file,
                                            std::function<void(T&&)> cb) {
   file::ListReader reader(file, TAKE_OWNERSHIP);
@@ -196,6 +272,18 @@ template<typename T> void ReadProtoRecords(StringPiece name,
   }
 }
 
+// Parallel version of ReadProtoRecords. cb is called concurrently from num_shards threads.
+template<typename T> void ParallelReadProtoRecords(StringPiece name, unsigned num_shards,
+                                                   std::function<void(T&&)> cb) {
+  util::Status st = ParallelReadRecords(name, num_shards,
+    [&cb](unsigned, strings::Slice record) {
+      T item;
+      CHECK(item.ParseFromArray(record.data(), record.size()));
+      cb(std::move(item));
+    });
+  CHECK(st.ok()) << st << ", file name: " << name;
+}
+
 }  // namespace file
 
 #endif  // _LIST_FILE_H_
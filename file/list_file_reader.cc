@@ -4,11 +4,17 @@
 
 #include "file/list_file.h"
 
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <mutex>
 #include <snappy-c.h>
+#include <thread>
+#include <vector>
 #include "util/coding/fixed.h"
 #include "util/coding/varint.h"
 #include "util/crc32c.h"
+#include "util/executor.h"
 
 namespace file {
 
@@ -18,6 +24,295 @@ using strings::Slice;
 using namespace ::util;
 using namespace list_file;
 
+using strings::charptr;
+
+namespace {
+
+// Result of parsing a single physical record.
+struct ParsedRecord {
+  uint8 type = 0;  // Record type including kCompressedMask.
+  Slice payload;
+
+  // Set for invalid or skipped records. In that case drop_size bytes were dropped and
+  // reason describes the corruption. reason is null for records that are skipped silently.
+  bool bad = false;
+  size_t drop_size = 0;
+  const char* reason = nullptr;
+};
+
+// Parses the physical record at the beginning of *block and advances *block past it.
+// *block must hold at least kBlockHeaderSize bytes.
+ParsedRecord ParsePhysicalRecord(bool checksum, Slice* block) {
+  ParsedRecord res;
+  const uint8* header = block->data();
+  const uint8 type = header[8];
+  uint32 length = coding::DecodeFixed32(header + 4);
+  if (length + kBlockHeaderSize > block->size()) {
+    VLOG(1) << "Invalid length " << length;
+    res.bad = true;
+    res.drop_size = block->size();
+    res.reason = "bad record length or truncated record at eof.";
+    block->clear();
+    return res;
+  }
+
+  if (type == kZeroType && length == 0) {
+    // Skip zero length record without reporting any drops since
+    // such records are produced by the mmap based writing code in
+    // env_posix.cc that preallocates file regions.
+    block->clear();
+    res.bad = true;
+    return res;
+  }
+  const uint8* data_ptr = header + kBlockHeaderSize;
+  // Check crc
+  if (checksum) {
+    uint32_t expected_crc = crc32c::Unmask(coding::DecodeFixed32(header));
+    // compute crc of the record and the type.
+    uint32_t actual_crc = crc32c::Value(data_ptr - 1, 1 + length);
+    if (actual_crc != expected_crc) {
+      // Drop the rest of the buffer since "length" itself may have
+      // been corrupted and if we trust it, we could find some
+      // fragment of a real log record that just happens to look
+      // like a valid log record.
+      res.bad = true;
+      res.drop_size = block->size();
+      res.reason = "checksum mismatch";
+      block->clear();
+      return res;
+    }
+  }
+  block->remove_prefix(length + kBlockHeaderSize);
+  res.type = type;
+  res.payload.set(data_ptr, length);
+  return res;
+}
+
+// Returns the uncompressed size of a compressed payload or 0 on error.
+size_t UncompressedLength(Slice payload) {
+  size_t res = 0;
+  if (payload.empty() || payload[0] != kCompressionSnappy ||
+      snappy_uncompressed_length(charptr(payload.data() + 1), payload.size() - 1, &res) !=
+          SNAPPY_OK) {
+    return 0;
+  }
+  return res;
+}
+
+// Uncompresses the payload of a compressed record into dest of capacity *size.
+// Returns the error description or null on success.
+const char* UncompressPayload(Slice payload, uint8* dest, size_t* size) {
+  if (payload.empty() || payload[0] != kCompressionSnappy) {
+    return "Unknown compression method.";
+  }
+  snappy_status st = snappy_uncompress(charptr(payload.data() + 1), payload.size() - 1,
+                                       charptr(dest), size);
+  return st == SNAPPY_OK ? nullptr : "Uncompress failed.";
+}
+
+}  // namespace
+
+// Reads blocks ahead of the consumer and decodes them on the executor threads.
+// A record fragment never crosses a block boundary, hence every block can be verified
+// and decompressed independently. The consumer picks up the decoded fragments in file order.
+class ListReader::Prefetcher {
+ public:
+  Prefetcher(util::Executor* executor, unsigned max_blocks)
+      : executor_(executor), max_blocks_(max_blocks) {
+    CHECK_GT(max_blocks, 0);
+  }
+
+  ~Prefetcher();
+
+  // Must be called once before Next().
+  void Start(ListReader* reader, size_t offset);
+
+  // Returns the next fragment with the same semantics as ListReader::ReadPhysicalRecord.
+  unsigned int Next(Slice* result);
+
+ private:
+  struct Fragment {
+    unsigned type;
+    Slice data;
+    size_t drop_size;
+    const char* reason;
+  };
+
+  struct Block {
+    size_t offset = 0;
+    size_t length = 0;
+    bool last = false;
+
+    std::unique_ptr<uint8[]> read_buf;
+
+    // Holds the payloads of all compressed records of the block. Grows as needed and is
+    // reused together with the block.
+    std::unique_ptr<uint8[]> uncompress_buf;
+    size_t uncompress_capacity = 0;
+    std::vector<Fragment> fragments;
+    Status status;
+    bool ready = false;
+  };
+
+  void Decode(Block* block);
+
+  // Schedules read-ahead of the following blocks.
+  void Fill();
+
+  util::Executor* executor_;
+  const unsigned max_blocks_;
+  ListReader* reader_ = nullptr;
+  size_t next_offset_ = 0;
+  size_t file_size_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<Block>> queue_;  // Blocks in file order. Guarded by mu_.
+
+  // Consumed blocks whose buffers can be reused. Accessed by consumer only.
+  std::vector<std::unique_ptr<Block>> free_blocks_;
+  size_t fragment_index_ = 0;  // Next fragment to return from queue_.front().
+  bool failed_ = false;
+};
+
+ListReader::Prefetcher::~Prefetcher() {
+  // Pool threads reference the blocks, wait for them to finish.
+  std::unique_lock<std::mutex> lock(mu_);
+  for (const auto& b : queue_) {
+    cv_.wait(lock, [&b] { return b->ready; });
+  }
+}
+
+void ListReader::Prefetcher::Start(ListReader* reader, size_t offset) {
+  reader_ = reader;
+  next_offset_ = offset;
+  file_size_ = reader->file_->Size();
+  Fill();
+}
+
+void ListReader::Prefetcher::Fill() {
+  const size_t block_size = reader_->block_size_;
+  while (queue_.size() < max_blocks_ && next_offset_ < file_size_) {
+    Block* block;
+    if (free_blocks_.empty()) {
+      block = new Block;
+      block->read_buf.reset(new uint8[block_size]);
+    } else {
+      block = free_blocks_.back().release();
+      free_blocks_.pop_back();
+      block->fragments.clear();
+      block->status = Status::OK;
+      block->ready = false;
+    }
+    block->offset = next_offset_;
+    block->length = std::min<size_t>(block_size, file_size_ - next_offset_);
+    next_offset_ += block->length;
+    block->last = next_offset_ >= file_size_;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      queue_.emplace_back(block);
+    }
+    executor_->Add([this, block] { Decode(block); });
+  }
+}
+
+void ListReader::Prefetcher::Decode(Block* block) {
+  Slice buf;
+  size_t uncompressed_size = 0;
+  block->status = reader_->file_->Read(block->offset, block->length, &buf,
+                                       block->read_buf.get());
+  while (block->status.ok()) {
+    if (buf.size() < kBlockHeaderSize) {
+      // Block trailer. It may appear only in the middle of the file.
+      if (block->last && !buf.empty()) {
+        block->fragments.push_back(Fragment{kEof, Slice(), buf.size(),
+                                            "truncated record at end of file"});
+      }
+      break;
+    }
+    ParsedRecord rec = ParsePhysicalRecord(reader_->checksum_, &buf);
+    if (rec.bad) {
+      block->fragments.push_back(Fragment{kBadRecord, Slice(), rec.drop_size, rec.reason});
+      continue;
+    }
+    // Compressed payloads are uncompressed below, once the total size is known.
+    unsigned type = rec.type & (0xFu | kCompressedMask);
+    if (type & kCompressedMask) {
+      size_t size = UncompressedLength(rec.payload);
+      if (size == 0 || size > reader_->block_size_) {
+        block->fragments.push_back(Fragment{kBadRecord, Slice(),
+                                            rec.payload.size() + kBlockHeaderSize,
+                                            "Uncompress failed."});
+        continue;
+      }
+      uncompressed_size += size;
+    }
+    block->fragments.push_back(Fragment{type, rec.payload, 0, nullptr});
+  }
+
+  if (uncompressed_size > block->uncompress_capacity) {
+    block->uncompress_buf.reset(new uint8[uncompressed_size]);
+    block->uncompress_capacity = uncompressed_size;
+  }
+  uint8* dest = block->uncompress_buf.get();
+  for (Fragment& fr : block->fragments) {
+    if ((fr.type & kCompressedMask) == 0 || fr.reason)
+      continue;
+    size_t size = UncompressedLength(fr.data);
+    const char* err = UncompressPayload(fr.data, dest, &size);
+    if (err) {
+      fr = Fragment{kBadRecord, Slice(), fr.data.size() + kBlockHeaderSize, err};
+      continue;
+    }
+    fr.type &= 0xFu;
+    fr.data.set(dest, size);
+    dest += size;
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  block->ready = true;
+  cv_.notify_all();
+}
+
+unsigned int ListReader::Prefetcher::Next(Slice* result) {
+  while (!failed_) {
+    Block* block;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      if (queue_.empty())
+        return kEof;
+      block = queue_.front().get();
+      cv_.wait(lock, [block] { return block->ready; });
+    }
+    if (!block->status.ok()) {
+      reader_->ReportDrop(block->length, block->status);
+      failed_ = true;
+      break;
+    }
+    if (fragment_index_ < block->fragments.size()) {
+      const Fragment& fr = block->fragments[fragment_index_++];
+      if (fr.reason) {
+        reader_->ReportCorruption(fr.drop_size, fr.reason);
+      }
+      *result = fr.data;
+      return fr.type;
+    }
+
+    // The current block is consumed. Its data must stay valid until the next call,
+    // which is the case since we return to the caller only after this point.
+    fragment_index_ = 0;
+    std::unique_ptr<Block> done;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      done = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    free_blocks_.push_back(std::move(done));
+    Fill();
+  }
+  return kEof;
+}
+
 ListReader::ListReader(file::ReadonlyFile* file, Ownership ownership, bool checksum,
                        CorruptionReporter reporter)
   : file_(file), ownership_(ownership), reporter_(reporter),
@@ -33,6 +328,7 @@ ListReader::ListReader(StringPiece filename, bool checksum, CorruptionReporter r
 }
 
 ListReader::~ListReader() {
+  prefetcher_.reset();
   if (ownership_ == TAKE_OWNERSHIP) {
     auto st = file_->Close();
     if (!st.ok()) {
@@ -42,6 +338,26 @@ ListReader::~ListReader() {
   }
 }
 
+void ListReader::EnablePrefetch(util::Executor* executor, unsigned max_blocks) {
+  CHECK(!prefetcher_ && block_buffer_.empty() && !eof_) << "Must be called before reading";
+  CHECK_EQ(0, range_start_);
+  CHECK_EQ(std::numeric_limits<size_t>::max(), range_end_);
+  prefetcher_.reset(new Prefetcher(executor, max_blocks));
+}
+
+void ListReader::SetRange(size_t start, size_t end) {
+  CHECK(!prefetcher_ && block_size_ == 0 && !eof_) << "Must be called before reading";
+  CHECK_LE(start, end);
+  range_start_ = start;
+  range_end_ = end;
+}
+
+bool ListReader::PastRangeEnd() const {
+  // If the current block is consumed, the next read starts a new block at file_offset_.
+  size_t next_block = block_buffer_.size() < kBlockHeaderSize ? file_offset_ : block_start_;
+  return next_block >= range_end_;
+}
+
 bool ListReader::GetMetaData(std::map<std::string, std::string>* meta) {
   if (!ReadHeader()) return false;
   *meta = meta_;
@@ -75,8 +391,17 @@ bool ListReader::ReadRecord(Slice* record, std::string* scratch) {
         return true;
       }
     }
+    if (!in_fragmented_record && PastRangeEnd()) {
+      return false;
+    }
     // uint64_t physical_record_offset = end_of_buffer_offset_ - buffer_.size();
     const unsigned int record_type = ReadPhysicalRecord(&fragment);
+    if (resync_) {
+      // Skip the tail of the record that started before our range.
+      if (record_type == kMiddleType || record_type == kLastType)
+        continue;
+      resync_ = false;
+    }
     switch (record_type) {
       case kFullType:
         if (in_fragmented_record) {
@@ -235,6 +560,16 @@ bool ListReader::ReadHeader() {
       meta_[key] = val;
     }
   }
+  if (range_start_ > file_offset_) {
+    // Blocks are aligned relative to the end of the header. Start at the first block
+    // that begins inside the range.
+    size_t block_index = (range_start_ - file_offset_ + block_size_ - 1) / block_size_;
+    file_offset_ += block_index * block_size_;
+    resync_ = true;
+    if (file_offset_ >= file_size_) {
+      eof_ = true;
+    }
+  }
   return true;
 }
 
@@ -252,14 +587,21 @@ void ListReader::ReportDrop(size_t bytes, const Status& reason) {
   }
 }
 
-using strings::charptr;
-
 unsigned int ListReader::ReadPhysicalRecord(Slice* result) {
+  if (prefetcher_) {
+    if (!prefetch_started_) {
+      prefetch_started_ = true;
+      prefetcher_->Start(this, file_offset_);
+    }
+    return prefetcher_->Next(result);
+  }
+
   size_t fsize = file_->Size();
   while (true) {
     if (block_buffer_.size() < kBlockHeaderSize) {
       if (!eof_) {
         size_t length = file_offset_ + block_size_ <= fsize ? block_size_ : fsize - file_offset_;
+        block_start_ = file_offset_;
         Status status = file_->Read(file_offset_, length, &block_buffer_, backing_store_.get());
         // end_of_buffer_offset_ += read_size;
         VLOG(2) << "read_size: " << block_buffer_.size() << ", status: " << status;
@@ -284,61 +626,22 @@ unsigned int ListReader::ReadPhysicalRecord(Slice* result) {
       }
     }
 
-    // Parse the header
-    const uint8* header = block_buffer_.data();
-    const uint8 type = header[8];
-    uint32 length = coding::DecodeFixed32(header + 4);
-    if (length + kBlockHeaderSize > block_buffer_.size()) {
-      VLOG(1) << "Invalid length " << length;
-      size_t drop_size = block_buffer_.size();
-      block_buffer_.clear();
-      ReportCorruption(drop_size, "bad record length or truncated record at eof.");
-      return kBadRecord;
-    }
-
-    if (type == kZeroType && length == 0) {
-      // Skip zero length record without reporting any drops since
-      // such records are produced by the mmap based writing code in
-      // env_posix.cc that preallocates file regions.
-      block_buffer_.clear();
-      return kBadRecord;
-    }
-    const uint8* data_ptr = header + kBlockHeaderSize;
-    // Check crc
-    if (checksum_) {
-      uint32_t expected_crc = crc32c::Unmask(coding::DecodeFixed32(header));
-      // compute crc of the record and the type.
-      uint32_t actual_crc = crc32c::Value(data_ptr - 1, 1 + length);
-      if (actual_crc != expected_crc) {
-        // Drop the rest of the buffer since "length" itself may have
-        // been corrupted and if we trust it, we could find some
-        // fragment of a real log record that just happens to look
-        // like a valid log record.
-        size_t drop_size = block_buffer_.size();
-        block_buffer_.clear();
-        ReportCorruption(drop_size, "checksum mismatch");
-        return kBadRecord;
+    ParsedRecord rec = ParsePhysicalRecord(checksum_, &block_buffer_);
+    if (rec.bad) {
+      if (rec.reason) {
+        ReportCorruption(rec.drop_size, rec.reason);
       }
+      return kBadRecord;
     }
-    uint32 record_size = length + kBlockHeaderSize;
-    block_buffer_.remove_prefix(record_size);
-    if (type & kCompressedMask) {
-      if (*data_ptr != kCompressionSnappy) {
-        ReportCorruption(record_size, "Unknown compression method.");
-        return kBadRecord;
-      }
-      ++data_ptr;
-      --length;
+    Slice payload = rec.payload;
+    if (rec.type & kCompressedMask) {
       size_t uncompress_size = block_size_;
-      snappy_status st = snappy_uncompress(charptr(data_ptr),
-                                           length, charptr(uncompress_buf_.get()),
-                                           &uncompress_size);
-      if (st != SNAPPY_OK) {
-        ReportCorruption(record_size, "Uncompress failed.");
+      const char* err = UncompressPayload(payload, uncompress_buf_.get(), &uncompress_size);
+      if (err) {
+        ReportCorruption(payload.size() + kBlockHeaderSize, err);
         return kBadRecord;
       }
-      data_ptr = uncompress_buf_.get();
-      length = uncompress_size;
+      payload.set(uncompress_buf_.get(), uncompress_size);
     }
     // Skip physical record that started before initial_offset_
     /*if (end_of_buffer_offset_ < initial_offset_ + block_buffer_.size() + record_size) {
@@ -346,9 +649,52 @@ unsigned int ListReader::ReadPhysicalRecord(Slice* result) {
       return kBadRecord;
     }*/
 
-    *result = Slice(data_ptr, length);
-    return type & 0xF;
+    *result = payload;
+    return rec.type & 0xF;
   }
 }
 
+Status ParallelReadRecords(ReadonlyFile* file, unsigned num_shards, ShardRecordCb cb,
+                           bool checksum) {
+  CHECK_GT(num_shards, 0);
+  const size_t file_size = file->Size();
+  std::vector<Status> shard_status(num_shards);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < num_shards; ++i) {
+    size_t start = file_size * i / num_shards;
+    size_t end = file_size * (i + 1) / num_shards;
+    threads.emplace_back([&, i, start, end] {
+      Status& st = shard_status[i];
+      ListReader reader(file, DO_NOT_TAKE_OWNERSHIP, checksum,
+                        [&st](size_t bytes, const Status& reason) {
+                          if (st.ok()) st = reason;
+                        });
+      reader.SetRange(start, end);
+      std::string scratch;
+      Slice record;
+      while (reader.ReadRecord(&record, &scratch)) {
+        cb(i, record);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  Status res;
+  for (const Status& st : shard_status) {
+    res.AddError(st);
+  }
+  return res;
+}
+
+Status ParallelReadRecords(StringPiece filename, unsigned num_shards, ShardRecordCb cb,
+                           bool checksum) {
+  auto res = ReadonlyFile::Open(filename);
+  if (!res.ok())
+    return res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  Status st = ParallelReadRecords(file.get(), num_shards, cb, checksum);
+  st.AddError(file->Close());
+  return st;
+}
+
 }  // namespace file
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <atomic>
 #include <gtest/gtest.h>
 
 #include "base/random.h"
@@ -9,6 +10,7 @@
 #include "file/test_util.h"
 #include "util/coding/fixed.h"
 #include "util/crc32c.h"
+#include "util/executor.h"
 
 namespace file {
 
@@ -91,11 +93,13 @@ protected:
   util::StringSink* dest_ = nullptr;
   StringFile source_;
   ReportCollector report_;
+  std::unique_ptr<util::Executor> executor_;  // Must outlive reader_.
   std::unique_ptr<ListWriter> writer_;
   std::unique_ptr<ListReader> reader_;
   uint32 list_offset_;
   uint32 block_size_ = 0;
   bool writer_flushed_ = false;
+  unsigned prefetch_blocks_ = 0;
 
   // Record metadata for testing initial offset functionality
   std::vector<size_t> initial_offset_record_sizes_;
@@ -138,6 +142,9 @@ protected:
       source_.contents_ = Slice(dest_->contents());
       reader_.reset(new ListReader(&source_, DO_NOT_TAKE_OWNERSHIP,
                                    true/*checksum*/, reporter_func()));
+      if (prefetch_blocks_) {
+        reader_->EnablePrefetch(executor_.get(), prefetch_blocks_);
+      }
     }
 
     std::string scratch;
@@ -164,6 +171,12 @@ protected:
      1};
   }
 
+  // Subsequent reads decode the blocks on a thread pool.
+  void EnablePrefetch(unsigned max_blocks) {
+    executor_.reset(new util::Executor(4));
+    prefetch_blocks_ = max_blocks;
+  }
+
   void IncrementByte(int offset, int delta) {
     dest_->contents()[offset + list_offset_] += delta;
   }
@@ -485,6 +498,192 @@ TEST_F(LogTest, Compression) {
   ASSERT_EQ("EOF", Read());
 }
 
+TEST_F(LogTest, PrefetchManyBlocks) {
+  EnablePrefetch(3);
+  for (int i = 0; i < 100000; i++) {
+    Write(NumberString(i));
+  }
+  for (int i = 0; i < 100000; i++) {
+    ASSERT_EQ(NumberString(i), Read());
+  }
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST_F(LogTest, PrefetchCompression) {
+  ListWriter::Options options;
+  options.use_compression = true;
+  SetupWriter(options);
+  EnablePrefetch(8);
+
+  const int N = 3000;
+  MTRandom write_rnd(301);
+  for (int i = 0; i < N; i++) {
+    Write(RandomSkewedString(i, &write_rnd));
+  }
+  Write(BigString("large", 3 * block_size_));
+  MTRandom read_rnd(301);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(RandomSkewedString(i, &read_rnd), Read());
+  }
+  ASSERT_EQ(BigString("large", 3 * block_size_), Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(0, DroppedBytes());
+}
+
+TEST_F(LogTest, PrefetchCorruption) {
+  EnablePrefetch(2);
+  Write(BigString("foo", block_size_));
+  Write(BigString("bar", block_size_));
+  Write("correct");
+  FlushWriter();
+  for (int offset = block_size_; offset < 2*block_size_; offset++) {
+    SetByte(offset, 'x');
+  }
+
+  ASSERT_EQ("correct", Read());
+  ASSERT_EQ("EOF", Read());
+  const int dropped = DroppedBytes();
+  ASSERT_LE(dropped, 2*block_size_ + 100);
+  ASSERT_GE(dropped, 2*block_size_);
+}
+
+TEST_F(LogTest, PrefetchTruncatedTrailingRecord) {
+  EnablePrefetch(2);
+  Write("foo");
+  FlushWriter();
+  ShrinkSize(4);
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(kBlockHeaderSize + 1, DroppedBytes());
+  ASSERT_EQ("OK", MatchError("truncated record at"));
+}
+
+TEST_F(LogTest, ParallelRead) {
+  ListWriter::Options options;
+  options.use_compression = true;
+  SetupWriter(options);
+
+  std::vector<std::string> expected;
+  MTRandom rnd(301);
+  for (int i = 0; i < 5000; i++) {
+    expected.push_back(RandomSkewedString(i, &rnd));
+    if (i % 1000 == 0) {
+      // Records that span several blocks and may cross shard boundaries.
+      expected.push_back(BigString(NumberString(i), 2 * block_size_ + i));
+    }
+  }
+  for (const auto& s : expected) {
+    Write(s);
+  }
+  FlushWriter();
+  source_.contents_ = Slice(dest_->contents());
+  ASSERT_GT(source_.Size(), 10 * block_size_);
+
+  for (unsigned num_shards : {1, 2, 3, 7, 32}) {
+    std::vector<std::vector<std::string>> shards(num_shards);
+    util::Status st = ParallelReadRecords(&source_, num_shards,
+      [&shards](unsigned shard, Slice record) {
+        shards[shard].push_back(record.as_string());
+      }, true);
+    ASSERT_TRUE(st.ok()) << st.ToString();
+    std::vector<std::string> actual;
+    for (const auto& v : shards) {
+      actual.insert(actual.end(), v.begin(), v.end());
+    }
+    ASSERT_EQ(expected.size(), actual.size()) << num_shards;
+    EXPECT_TRUE(expected == actual) << num_shards;
+  }
+
+  // A corrupted block in the middle of the file is reported, whichever shard reads it.
+  std::string corrupted = dest_->contents();
+  corrupted[corrupted.size() / 2] ^= 0x55;
+  source_.contents_ = Slice(corrupted);
+  for (unsigned num_shards : {1, 3, 7}) {
+    std::atomic<size_t> num_records{0};
+    util::Status st = ParallelReadRecords(&source_, num_shards,
+      [&num_records](unsigned, Slice) { ++num_records; }, true);
+    EXPECT_FALSE(st.ok()) << num_shards;
+    EXPECT_LT(num_records, expected.size()) << num_shards;
+  }
+}
+
+TEST_F(LogTest, AsyncWrite) {
+  ListWriter::Options options;
+  options.use_compression = true;
+  util::StringSink* sync_dest = new util::StringSink;
+  ListWriter sync_writer(sync_dest, options);
+  ASSERT_TRUE(sync_writer.Init().ok());
+
+  options.async = true;
+  options.async_queue_size = 2;
+  SetupWriter(options);
+
+  const int N = 20000;
+  MTRandom rnd(301);
+  for (int i = 0; i < N; i++) {
+    std::string str = RandomSkewedString(i, &rnd);
+    if (i % 5000 == 0) {
+      str = BigString(NumberString(i), 3 * block_size_);
+    }
+    Write(str);
+    ASSERT_TRUE(sync_writer.AddRecord(str).ok());
+    if (i == N / 2) {
+      FlushWriter();
+      ASSERT_TRUE(sync_writer.Flush().ok());
+      EXPECT_EQ(sync_dest->contents(), dest_->contents());
+    }
+  }
+  FlushWriter();
+  ASSERT_TRUE(sync_writer.Flush().ok());
+  EXPECT_EQ(N, writer_->records_added());
+  EXPECT_EQ(sync_writer.bytes_added(), writer_->bytes_added());
+  EXPECT_TRUE(sync_dest->contents() == dest_->contents());
+
+  MTRandom read_rnd(301);
+  for (int i = 0; i < N; i++) {
+    std::string str = RandomSkewedString(i, &read_rnd);
+    if (i % 5000 == 0) {
+      str = BigString(NumberString(i), 3 * block_size_);
+    }
+    ASSERT_EQ(str, Read());
+  }
+  ASSERT_EQ("EOF", Read());
+}
+
+// Fails all appends once limit bytes were written.
+class FailingSink : public util::Sink {
+ public:
+  explicit FailingSink(size_t limit) : limit_(limit) {}
+
+  util::Status Append(Slice slice) override {
+    if (written_ + slice.size() > limit_)
+      return util::Status(base::StatusCode::IO_ERROR, "disk full");
+    written_ += slice.size();
+    return util::Status::OK;
+  }
+
+ private:
+  size_t limit_, written_ = 0;
+};
+
+TEST_F(LogTest, AsyncWriteError) {
+  ListWriter::Options options;
+  options.async = true;
+  std::unique_ptr<ListWriter> writer(new ListWriter(new FailingSink(1000), options));
+  ASSERT_TRUE(writer->Init().ok());
+  MTRandom rnd(301);
+  for (int i = 0; i < 5000; i++) {
+    writer->AddRecord(RandomSkewedString(i, &rnd));
+  }
+  util::Status st = writer->Flush();
+  EXPECT_EQ(base::StatusCode::IO_ERROR, st.code());
+  EXPECT_NE(std::string::npos, st.ToString().find("disk full")) << st.ToString();
+
+  // The error was reported already, the destructor must not abort.
+  writer->AddRecord(Slice::FromCstr("foo"));
+  writer.reset();
+}
+
 TEST_F(LogTest, MetaData) {
   SetupWriter(ListWriter::Options(), false);
   string kMetaVal1 = "data1";
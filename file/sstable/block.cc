@@ -267,5 +267,26 @@ Iterator* Block::NewIterator() {
   }
 }
 
+base::StatusObject<bool> Block::Seek(const Slice& target, std::string* key,
+                                     Slice* value) const {
+  if (size_ < sizeof(uint32)) {
+    return Corruption("bad block contents");
+  }
+  const uint32 num_restarts = NumRestarts();
+  if (num_restarts == 0) {
+    return false;
+  }
+  Iter iter(data_, restart_offset_, num_restarts);
+  iter.Seek(target);
+  if (!iter.Valid()) {
+    if (!iter.status().ok())
+      return iter.status();
+    return false;
+  }
+  key->assign(iter.key().charptr(), iter.key().size());
+  *value = iter.value();
+  return true;
+}
+
 }  // namespace sstable
 }  // namespace file
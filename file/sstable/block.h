@@ -6,7 +6,10 @@
 #define STORAGE_LEVELDB_TABLE_BLOCK_H_
 
 #include <cstddef>
+#include <string>
 #include "base/integral_types.h"
+#include "base/status.h"
+#include "strings/slice.h"
 
 namespace file {
 namespace sstable {
@@ -23,6 +26,12 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator();
 
+  // Finds the first entry with key >= target without allocating an iterator.
+  // Returns true and fills *key and *value if there is such an entry. *value points into
+  // the block data.
+  base::StatusObject<bool> Seek(const strings::Slice& target, std::string* key,
+                                strings::Slice* value) const;
+
  private:
   uint32 NumRestarts() const;
 
@@ -0,0 +1,186 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "file/sstable/block_cache.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "base/hash.h"
+#include "base/logging.h"
+#include "base/refcount.h"
+#include "file/sstable/block.h"
+#include "util/http/varz_stats.h"
+
+namespace file {
+namespace sstable {
+
+namespace {
+
+http::VarzCount block_cache_hits("sstable_block_cache_hits");
+http::VarzCount block_cache_misses("sstable_block_cache_misses");
+http::VarzCount block_cache_evictions("sstable_block_cache_evictions");
+
+typedef std::pair<uint64, uint64> CacheKey;
+
+inline uint32 HashKey(uint64 id, uint64 offset) {
+  return base::CityHash32(offset * 0x9E3779B97F4A7C15ULL + id);
+}
+
+struct CacheKeyHash {
+  size_t operator()(const CacheKey& key) const {
+    return HashKey(key.first, key.second);
+  }
+};
+
+}  // namespace
+
+class BlockCache::Handle : public base::RefCount<Handle> {
+ public:
+  Handle(const CacheKey& k, Block* b) : key(k), block(b), charge(sizeof(Block) + b->size()) {}
+  ~Handle() { delete block; }
+
+  const CacheKey key;
+  Block* const block;
+  const size_t charge;
+
+  // Position in the LRU list of the owning shard. Valid only while the handle is in cache.
+  std::list<Handle*>::iterator lru_pos;
+};
+
+// Each shard holds a reference to every handle it contains.
+class BlockCache::Shard {
+ public:
+  Shard() {}
+  ~Shard();
+
+  void set_capacity(size_t capacity) { capacity_ = capacity; }
+
+  Handle* Lookup(const CacheKey& key);
+
+  // Returns number of evicted entries.
+  unsigned Insert(Handle* handle);
+
+  size_t usage() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return usage_;
+  }
+
+ private:
+  // Removes the handle from the shard and releases the shard's reference.
+  void Remove(Handle* handle);
+
+  mutable std::mutex mu_;
+  size_t capacity_ = 0;
+  size_t usage_ = 0;
+
+  // Front of the list is the most recently used entry.
+  std::list<Handle*> lru_;
+  std::unordered_map<CacheKey, Handle*, CacheKeyHash> table_;
+};
+
+BlockCache::Shard::~Shard() {
+  for (Handle* h : lru_) {
+    h->DecRef();
+  }
+}
+
+auto BlockCache::Shard::Lookup(const CacheKey& key) -> Handle* {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = table_.find(key);
+  if (it == table_.end())
+    return nullptr;
+  Handle* h = it->second;
+  lru_.splice(lru_.begin(), lru_, h->lru_pos);
+  h->AddRef();
+  return h;
+}
+
+unsigned BlockCache::Shard::Insert(Handle* handle) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto res = table_.emplace(handle->key, handle);
+  if (!res.second) {
+    Remove(res.first->second);
+    res = table_.emplace(handle->key, handle);
+  }
+  handle->AddRef();
+  lru_.push_front(handle);
+  handle->lru_pos = lru_.begin();
+  usage_ += handle->charge;
+
+  unsigned evicted = 0;
+  while (usage_ > capacity_ && lru_.back() != handle) {
+    Remove(lru_.back());
+    ++evicted;
+  }
+  return evicted;
+}
+
+void BlockCache::Shard::Remove(Handle* handle) {
+  table_.erase(handle->key);
+  lru_.erase(handle->lru_pos);
+  usage_ -= handle->charge;
+  handle->DecRef();
+}
+
+BlockCache::BlockCache(size_t capacity, unsigned num_shard_bits)
+    : capacity_(capacity), num_shard_bits_(num_shard_bits),
+      shards_(new Shard[1 << num_shard_bits]), next_id_(1), hits_(0), misses_(0),
+      evictions_(0) {
+  CHECK_LT(num_shard_bits, 20);
+  const unsigned num_shards = 1 << num_shard_bits;
+  const size_t per_shard = (capacity + num_shards - 1) / num_shards;
+  for (unsigned i = 0; i < num_shards; ++i) {
+    shards_[i].set_capacity(per_shard);
+  }
+}
+
+BlockCache::~BlockCache() {
+}
+
+auto BlockCache::GetShard(uint64 id, uint64 offset) -> Shard& {
+  // Use the highest bits for sharding; unordered_map uses the lowest ones.
+  uint32 index = num_shard_bits_ ? HashKey(id, offset) >> (32 - num_shard_bits_) : 0;
+  return shards_[index];
+}
+
+auto BlockCache::Lookup(uint64 id, uint64 offset) -> Handle* {
+  Handle* h = GetShard(id, offset).Lookup(CacheKey(id, offset));
+  if (h == nullptr) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    block_cache_misses.Inc();
+  } else {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    block_cache_hits.Inc();
+  }
+  return h;
+}
+
+auto BlockCache::Insert(uint64 id, uint64 offset, Block* block) -> Handle* {
+  Handle* h = new Handle(CacheKey(id, offset), block);
+  unsigned evicted = GetShard(id, offset).Insert(h);
+  if (evicted) {
+    evictions_.fetch_add(evicted, std::memory_order_relaxed);
+    block_cache_evictions.IncBy(evicted);
+  }
+  return h;
+}
+
+Block* BlockCache::block(Handle* handle) {
+  return handle->block;
+}
+
+void BlockCache::Release(Handle* handle) {
+  handle->DecRef();
+}
+
+size_t BlockCache::TotalCharge() const {
+  size_t res = 0;
+  for (unsigned i = 0; i < (1u << num_shard_bits_); ++i) {
+    res += shards_[i].usage();
+  }
+  return res;
+}
+
+}  // namespace sstable
+}  // namespace file
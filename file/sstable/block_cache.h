@@ -0,0 +1,73 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#ifndef _FILE_SSTABLE_BLOCK_CACHE_H_
+#define _FILE_SSTABLE_BLOCK_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include "base/integral_types.h"
+
+namespace file {
+namespace sstable {
+
+class Block;
+
+// Sharded LRU cache of uncompressed sstable blocks. A single cache can be shared by many
+// tables via ReadOptions::block_cache. Each table receives its own id from NewId() and
+// its blocks are keyed by (table id, block offset).
+// Cached blocks are refcounted: a block evicted from the cache stays alive until the last
+// handle to it is released. The class is thread-safe.
+class BlockCache {
+ public:
+  class Handle;
+
+  // capacity is the maximal total size in bytes of blocks held by the cache.
+  // The cache is split into 2^num_shard_bits shards, each with its own lock and LRU list.
+  explicit BlockCache(size_t capacity, unsigned num_shard_bits = 4);
+  ~BlockCache();
+
+  // Returns a new id to be used by a table as its key prefix.
+  uint64 NewId() { return next_id_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Returns a pinned handle to the cached block or nullptr if the block is not cached.
+  // Non-null handles must be released with Release().
+  Handle* Lookup(uint64 id, uint64 offset);
+
+  // Takes ownership over block, inserts it into the cache and returns a pinned handle to it.
+  // Replaces the existing entry with the same key if there is one.
+  // The returned handle must be released with Release().
+  Handle* Insert(uint64 id, uint64 offset, Block* block);
+
+  static Block* block(Handle* handle);
+  static void Release(Handle* handle);
+
+  size_t capacity() const { return capacity_; }
+
+  // Total size of blocks currently held by the cache.
+  size_t TotalCharge() const;
+
+  uint64 hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64 misses() const { return misses_.load(std::memory_order_relaxed); }
+  uint64 evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+ private:
+  class Shard;
+
+  Shard& GetShard(uint64 id, uint64 offset);
+
+  const size_t capacity_;
+  const unsigned num_shard_bits_;
+  std::unique_ptr<Shard[]> shards_;
+
+  std::atomic<uint64> next_id_;
+  std::atomic<uint64> hits_, misses_, evictions_;
+
+  BlockCache(const BlockCache&) = delete;
+  void operator=(const BlockCache&) = delete;
+};
+
+}  // namespace sstable
+}  // namespace file
+
+#endif  // _FILE_SSTABLE_BLOCK_CACHE_H_
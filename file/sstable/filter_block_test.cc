@@ -4,6 +4,8 @@
 
 #include "file/sstable/filter_block.h"
 
+#include <memory>
+
 #include "file/sstable/filter_policy.h"
 #include "base/gtest.h"
 #include "base/hash.h"
@@ -131,6 +133,30 @@ TEST_F(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(! KeyMayMatch(reader, 9000, "bar"));
 }
 
+TEST(BloomTest, FalsePositiveRate) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  for (uint32_t n : {1, 10, 100, 1000, 10000}) {
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < n; ++i) {
+      keys.push_back("key" + std::to_string(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::string filter;
+    policy->CreateFilter(slices.data(), n, &filter);
+    EXPECT_LE(filter.size(), n * 10 / 8 + 40) << n;
+
+    for (const auto& k : keys) {
+      ASSERT_TRUE(policy->KeyMayMatch(k, filter)) << k;
+    }
+    unsigned false_positives = 0;
+    for (uint32_t i = 0; i < 10000; ++i) {
+      if (policy->KeyMayMatch("other" + std::to_string(i), filter))
+        ++false_positives;
+    }
+    EXPECT_LE(false_positives, 200) << n;  // Expected rate is ~1%.
+  }
+}
+
 }  // namespace sstable
 }  // namespace file
 
@@ -96,8 +96,12 @@ Status ReadBlock(ReadonlyFile* file,
 
   // Read the block contents as well as the type/crc footer.
   // See table_builder.cc for the code that built this structure.
+  // Mapped files return pointers into the mapping, so there is no need for a read buffer.
   size_t n = static_cast<size_t>(handle.size());
-  std::unique_ptr<uint8[]> buf(new uint8[n + kBlockTrailerSize]);
+  std::unique_ptr<uint8[]> buf;
+  if (!file->IsMapped()) {
+    buf.reset(new uint8[n + kBlockTrailerSize]);
+  }
   Slice contents;
   Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf.get());
   if (!s.ok()) {
@@ -10,6 +10,7 @@
 namespace file {
 namespace sstable {
 
+class BlockCache;
 class FilterPolicy;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -23,12 +24,26 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// Expected access pattern of a table. It is passed to the underlying file as a hint
+// when the table is opened.
+enum AccessHint {
+  kAccessNormal = 0,
+  kAccessSequential,  // Mostly full scans: read ahead aggressively.
+  kAccessRandom       // Mostly point lookups: avoid read-ahead.
+};
+
 // Options that control read operations
 struct ReadOptions {
   const FilterPolicy* filter_policy = nullptr;
   // If true, all data read from underlying storage will be
   // verified against corresponding checksums.
   bool verify_checksums = false;
+
+  // If non-null, uncompressed blocks are looked up in and inserted into this cache.
+  // The cache can be shared between tables and must outlive them.
+  BlockCache* block_cache = nullptr;
+
+  AccessHint access_hint = kAccessNormal;
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -54,6 +69,8 @@ struct Options {
   // worth switching to kNoCompression.  Even if the input data is
   // incompressible, the kSnappyCompression implementation will
   // efficiently detect that and will switch to uncompressed mode.
+  // The exception are read-heavy tables opened from memory-mapped files:
+  // uncompressed blocks are parsed in place without being copied or cached.
   CompressionType compression = kSnappyCompression;
 
   // If non-NULL, use the specified filter policy to reduce disk reads.
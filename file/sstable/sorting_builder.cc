@@ -2,4 +2,274 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 
-#include "file/sstable/sorting_builder.h"
\ No newline at end of file
+#include "file/sstable/sorting_builder.h"
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <thread>
+
+#include "base/logging.h"
+#include "file/file.h"
+#include "file/filesource.h"
+#include "file/list_file.h"
+#include "file/sstable/sstable_builder.h"
+#include "strings/stringprintf.h"
+#include "util/coding/varint.h"
+
+namespace file {
+namespace sstable {
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+
+namespace {
+
+// Chunks smaller than that are not worth a separate thread.
+constexpr size_t kMinSortChunk = 1 << 14;
+
+// Reads sorted records of a single run file.
+class RunReader {
+ public:
+  // Takes ownership of file.
+  RunReader(ReadonlyFile* file, unsigned index)
+      : reader_(file, TAKE_OWNERSHIP, true,
+                [this](size_t bytes, const Status& st) {
+                  if (status_.ok()) status_ = st;
+                }),
+        index_(index) {}
+
+  // Returns false when the run is exhausted or an error occurred, see status().
+  bool Next() {
+    if (!reader_.ReadRecord(&record_, &scratch_) || !status_.ok())
+      return false;
+    uint32 key_size = 0;
+    const uint8* key = Varint::Parse32WithLimit(record_.begin(), record_.end(), &key_size);
+    if (key == nullptr || key + key_size > record_.end()) {
+      status_ = Status(StatusCode::IO_ERROR, "Corrupted run file");
+      return false;
+    }
+    key_.set(key, key_size);
+    value_.set(key + key_size, record_.end() - key - key_size);
+    return true;
+  }
+
+  Slice key() const { return key_; }
+  Slice value() const { return value_; }
+  unsigned index() const { return index_; }
+
+  // The first corruption or read error of the run. The reader skips corrupted records,
+  // hence any error means that the run lost data.
+  const Status& status() const { return status_; }
+
+ private:
+  Status status_;
+  ListReader reader_;
+  std::string scratch_;
+  Slice record_, key_, value_;
+  unsigned index_;
+};
+
+// For equal keys, the reader of the later run goes first.
+struct RunReaderGreater {
+  bool operator()(const RunReader* a, const RunReader* b) const {
+    int res = a->key().compare(b->key());
+    if (res != 0)
+      return res > 0;
+    return a->index() < b->index();
+  }
+};
+
+}  // namespace
+
+SortingBuilder::SortingBuilder(StringPiece basename, Options options)
+    : basename_(basename.as_string()), options_(options) {
+  CHECK_GT(options_.mem_sort_size_mb, 0);
+}
+
+SortingBuilder::~SortingBuilder() {
+  for (const auto& name : run_files_) {
+    file::Delete(name);
+  }
+}
+
+void SortingBuilder::Add(strings::Slice key, strings::Slice value) {
+  CHECK(!finished_);
+  if (!status_.ok())
+    return;
+
+  const uint32 header_size = Varint::Length32(key.size());
+  char* ptr = arena_.Allocate(std::max<size_t>(1, header_size + key.size() + value.size()));
+  uint8* dest = Varint::Encode32(reinterpret_cast<uint8*>(ptr), key.size());
+  memcpy(dest, key.data(), key.size());
+  memcpy(dest + key.size(), value.data(), value.size());
+  entries_.push_back(Entry{dest, uint32(key.size()), uint32(value.size())});
+
+  size_t mem_usage = arena_.MemoryUsage() + entries_.capacity() * sizeof(Entry);
+  if (mem_usage >= (size_t(options_.mem_sort_size_mb) << 20)) {
+    status_ = DumpRun();
+  }
+}
+
+Status SortingBuilder::status() const {
+  return status_;
+}
+
+void SortingBuilder::SortEntries() {
+  auto less = [](const Entry& a, const Entry& b) {
+    return Slice(a.key, a.key_size).compare(Slice(b.key, b.key_size)) < 0;
+  };
+
+  size_t num_chunks = std::min<size_t>(std::max(1u, options_.sort_threads),
+                                       entries_.size() / kMinSortChunk + 1);
+  std::vector<Entry>::iterator begin = entries_.begin();
+  std::vector<size_t> bounds(num_chunks + 1);
+  for (size_t i = 0; i <= num_chunks; ++i) {
+    bounds[i] = entries_.size() * i / num_chunks;
+  }
+
+  // Sort each chunk on its own thread and then merge neighbour chunks pairwise.
+  // Stable sort and merge keep entries with equal keys in their insertion order.
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_chunks; ++i) {
+    threads.emplace_back([&, i] {
+      std::stable_sort(begin + bounds[i], begin + bounds[i + 1], less);
+    });
+  }
+  std::stable_sort(begin + bounds[0], begin + bounds[1], less);
+  for (auto& t : threads) t.join();
+
+  for (size_t step = 1; step < num_chunks; step *= 2) {
+    threads.clear();
+    for (size_t i = 0; i + step < num_chunks; i += 2 * step) {
+      size_t last = std::min(i + 2 * step, num_chunks);
+      threads.emplace_back([&, i, step, last] {
+        std::inplace_merge(begin + bounds[i], begin + bounds[i + step], begin + bounds[last],
+                           less);
+      });
+    }
+    for (auto& t : threads) t.join();
+  }
+}
+
+// Calls cb for the last entry in each group of entries with equal keys.
+template<typename V, typename Cb> static Status ForEachUnique(const V& v, Cb cb) {
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (i + 1 < v.size() && Slice(v[i].key, v[i].key_size) ==
+                            Slice(v[i + 1].key, v[i + 1].key_size)) {
+      continue;
+    }
+    RETURN_IF_ERROR(cb(v[i]));
+  }
+  return Status::OK;
+}
+
+Status SortingBuilder::DumpRun() {
+  SortEntries();
+
+  string name = StringPrintf("%s%05d.lst", basename_.c_str(), int(run_files_.size()));
+  File* fl = file::Open(name, "w");
+  if (fl == nullptr) {
+    return Status(StatusCode::IO_ERROR, "Could not create " + name);
+  }
+  run_files_.push_back(name);
+  ListWriter writer(new Sink(fl, TAKE_OWNERSHIP));
+  RETURN_IF_ERROR(writer.Init());
+
+  RETURN_IF_ERROR(ForEachUnique(entries_, [&writer](const Entry& e) {
+    const uint8* record = e.key - Varint::Length32(e.key_size);
+    return writer.AddRecord(Slice(record, e.key + e.key_size + e.value_size - record));
+  }));
+  RETURN_IF_ERROR(writer.Flush());
+
+  VLOG(1) << "Dumped " << entries_.size() << " entries into " << name;
+
+  entries_.clear();
+  base::Arena tmp;
+  arena_.Swap(tmp);
+  return Status::OK;
+}
+
+Status SortingBuilder::MergeRuns(util::Sink* sink, const sstable::Options& options) {
+  std::vector<std::unique_ptr<RunReader>> readers;
+  std::priority_queue<RunReader*, std::vector<RunReader*>, RunReaderGreater> queue;
+  for (unsigned i = 0; i < run_files_.size(); ++i) {
+    auto res = ReadonlyFile::Open(run_files_[i]);
+    if (!res.ok())
+      return res.status;
+    readers.emplace_back(new RunReader(res.obj, i));
+    if (readers.back()->Next()) {
+      queue.push(readers.back().get());
+    }
+    RETURN_IF_ERROR(readers.back()->status());
+  }
+
+  TableBuilder builder(options, sink);
+  std::string last_key;
+  bool has_last = false;
+  while (!queue.empty()) {
+    RunReader* top = queue.top();
+    queue.pop();
+    // The first key in a group of equal keys comes from the latest run.
+    if (!has_last || top->key() != Slice(last_key)) {
+      builder.Add(top->key(), top->value());
+      last_key.assign(top->key().charptr(), top->key().size());
+      has_last = true;
+    }
+    if (top->Next()) {
+      queue.push(top);
+    } else if (!top->status().ok()) {
+      builder.Abandon();
+      return top->status();
+    }
+  }
+  return builder.Finish();
+}
+
+Status SortingBuilder::Finish(sstable::Options options) {
+  CHECK(!finished_);
+  finished_ = true;
+  RETURN_IF_ERROR(status_);
+
+  string name = basename_ + ".sst";
+  File* fl = file::Open(name, "w");
+  if (fl == nullptr) {
+    return Status(StatusCode::IO_ERROR, "Could not create " + name);
+  }
+  // The sink does not own the file so that the status of Close() is not lost.
+  Sink sink(fl, DO_NOT_TAKE_OWNERSHIP);
+
+  if (run_files_.empty()) {
+    // Everything fits in memory.
+    SortEntries();
+    TableBuilder builder(options, &sink);
+    ForEachUnique(entries_, [&builder](const Entry& e) {
+      builder.Add(Slice(e.key, e.key_size), Slice(e.key + e.key_size, e.value_size));
+      return Status::OK;
+    });
+    status_ = builder.Finish();
+  } else {
+    if (!entries_.empty()) {
+      status_ = DumpRun();
+    }
+    if (status_.ok()) {
+      status_ = MergeRuns(&sink, options);
+    }
+  }
+  if (!fl->Close() && status_.ok()) {
+    status_ = Status(StatusCode::IO_ERROR, "Could not close " + name);
+  }
+  if (!status_.ok()) {
+    file::Delete(name);
+  }
+  for (const auto& run_name : run_files_) {
+    file::Delete(run_name);
+  }
+  run_files_.clear();
+  entries_.clear();
+  return status_;
+}
+
+}  // namespace sstable
+}  // namespace file
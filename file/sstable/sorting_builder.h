@@ -4,12 +4,19 @@
 #ifndef _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
 #define _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
 
+#include <string>
+#include <vector>
+
 #include "base/arena.h"
 #include "base/status.h"
 
 #include "strings/stringpiece.h"
 #include "file/sstable/options.h"
 
+namespace util {
+class Sink;
+}  // namespace util
+
 namespace file {
 namespace sstable {
 
@@ -21,14 +28,19 @@ public:
     // How much memory is allocated for storing the temporary table before sorting it and dumping
     // it on disk.
     unsigned mem_sort_size_mb = 128;
+
+    // Number of threads that sort the in-memory buffer before it's dumped on disk.
+    unsigned sort_threads = 4;
   };
 
   // basename is path to the output sstable not including the extension .sst.
   // For example, "/somepath/mytable".
   // SortingBuilder might create temporary lst files in format
-  // basename + "%5d.lst"
+  // basename + "%05d.lst". They are deleted by Finish().
   SortingBuilder(StringPiece basename, Options options);
+  ~SortingBuilder();
 
+  // If the same key is added more than once, the value added last is kept.
   void Add(strings::Slice key, strings::Slice value);
 
   // Return non-ok iff some error has been detected.
@@ -38,9 +50,37 @@ public:
   // constructor ( + ".sst").
   // REQUIRES: Finish() have not been called.
   // sstable::Options are used for creating the sstable.
+  // Fails if a run file could not be read back in full or the table could not be written.
+  // In that case the table file is deleted.
   base::Status Finish(sstable::Options options);
+
+  // Number of sorted runs that were dumped on disk so far.
+  unsigned num_runs() const { return run_files_.size(); }
 private:
+  // Points to arena record of the form: varint key size, key, value.
+  struct Entry {
+    const uint8* key;
+    uint32 key_size;
+    uint32 value_size;
+  };
+
+  // Sorts entries_ in parallel. The sort is stable.
+  void SortEntries();
+
+  // Sorts entries_ and writes them into a new run file, then resets the memory buffer.
+  base::Status DumpRun();
+
+  // Merges run files into the sstable.
+  base::Status MergeRuns(util::Sink* sink, const sstable::Options& options);
+
+  std::string basename_;
+  Options options_;
+  base::Status status_;
 
+  base::Arena arena_;
+  std::vector<Entry> entries_;
+  std::vector<std::string> run_files_;
+  bool finished_ = false;
 };
 
 }  // namespace sstable
@@ -0,0 +1,167 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "file/sstable/sorting_builder.h"
+
+#include <memory>
+#include "base/gtest.h"
+#include "base/random.h"
+#include "file/file.h"
+#include "file/file_util.h"
+#include "file/sstable/iterator.h"
+#include "file/sstable/sstable.h"
+#include "file/test_util.h"
+#include "strings/stringprintf.h"
+
+namespace file {
+namespace sstable {
+
+using strings::Slice;
+
+class SortingBuilderTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    basename_ = TestTempDir() + "/sorted";
+  }
+
+  // Opens the generated table and returns its contents in order.
+  std::vector<std::pair<string, string>> ReadTable() {
+    auto res = ReadonlyFile::Open(basename_ + ".sst");
+    CHECK(res.ok()) << res.status;
+    std::unique_ptr<ReadonlyFile> fl(res.obj);
+    auto table_res = Table::Open(ReadOptions(), fl.get());
+    CHECK(table_res.ok()) << table_res.status;
+    std::unique_ptr<Table> table(table_res.obj);
+    std::unique_ptr<Iterator> it(table->NewIterator());
+    std::vector<std::pair<string, string>> result;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      result.emplace_back(it->key().as_string(), it->value().as_string());
+    }
+    return result;
+  }
+
+  string basename_;
+};
+
+TEST_F(SortingBuilderTest, InMemory) {
+  SortingBuilder builder(basename_, SortingBuilder::Options());
+  builder.Add(Slice::FromCstr("c"), Slice::FromCstr("3"));
+  builder.Add(Slice::FromCstr("a"), Slice::FromCstr("1"));
+  builder.Add(Slice::FromCstr("b"), Slice::FromCstr("2"));
+  builder.Add(Slice::FromCstr("a"), Slice::FromCstr("4"));
+  ASSERT_TRUE(builder.Finish(Options()).ok());
+  EXPECT_EQ(0, builder.num_runs());
+
+  auto contents = ReadTable();
+  std::vector<std::pair<string, string>> expected{{"a", "4"}, {"b", "2"}, {"c", "3"}};
+  EXPECT_EQ(expected, contents);
+}
+
+TEST_F(SortingBuilderTest, ExternalMerge) {
+  SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = 1;
+  opts.sort_threads = 3;
+  SortingBuilder builder(basename_, opts);
+
+  const unsigned kNumKeys = 20000;
+  MTRandom rnd(10);
+  std::vector<unsigned> perm(kNumKeys);
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    perm[i] = i;
+  }
+  for (unsigned i = kNumKeys - 1; i > 0; --i) {
+    std::swap(perm[i], perm[rnd.Rand32() % (i + 1)]);
+  }
+  const string padding(100, 'x');
+  for (unsigned i : perm) {
+    builder.Add(StringPrintf("key%06d", i), StringPrintf("old%d", i) + padding);
+  }
+  // Overwrite every 10th key. The later value should win even though it resides in a later run.
+  for (unsigned i = 0; i < kNumKeys; i += 10) {
+    builder.Add(StringPrintf("key%06d", i), StringPrintf("new%d", i));
+  }
+  ASSERT_TRUE(builder.status().ok());
+  EXPECT_GT(builder.num_runs(), 1);
+  ASSERT_TRUE(builder.Finish(Options()).ok());
+  EXPECT_FALSE(file::Exists(basename_ + "00000.lst"));
+
+  auto contents = ReadTable();
+  ASSERT_EQ(kNumKeys, contents.size());
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    ASSERT_EQ(StringPrintf("key%06d", i), contents[i].first);
+    if (i % 10 == 0) {
+      EXPECT_EQ(StringPrintf("new%d", i), contents[i].second);
+    } else {
+      EXPECT_EQ(StringPrintf("old%d", i) + padding, contents[i].second);
+    }
+  }
+}
+
+TEST_F(SortingBuilderTest, CorruptedRun) {
+  SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = 1;
+  SortingBuilder builder(basename_, opts);
+  const string padding(100, 'x');
+  for (unsigned i = 0; i < 20000; ++i) {
+    builder.Add(StringPrintf("key%06d", (i * 7919) % 20000), padding);
+  }
+  ASSERT_GT(builder.num_runs(), 1);
+
+  // Flip a byte in the middle of the first run. The merge must not skip the broken records.
+  string run_name = basename_ + "00000.lst";
+  string contents;
+  ASSERT_TRUE(file_util::ReadFileToString(run_name, &contents));
+  contents[contents.size() / 2] ^= 0x55;
+  file_util::WriteStringToFileOrDie(contents, run_name);
+
+  EXPECT_FALSE(builder.Finish(Options()).ok());
+  EXPECT_FALSE(file::Exists(basename_ + ".sst"));
+  EXPECT_FALSE(file::Exists(run_name));
+}
+
+// Builds a table of num_items random keys with 64 byte values.
+// Throughput in items/sec is num_items * 1e9 / (ns per iteration).
+static void BM_SortingBuild(uint32 iters, unsigned num_items, unsigned num_threads) {
+  StopBenchmarkTiming();
+  MTRandom rnd(10);
+  std::vector<string> keys(num_items);
+  for (auto& k : keys) {
+    k = StringPrintf("%016llx", static_cast<unsigned long long>(rnd.Rand64()));
+  }
+  const string value(64, 'v');
+  SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = 16;
+  opts.sort_threads = num_threads;
+  string basename = TestTempDir() + "/bm_sorted";
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    SortingBuilder builder(basename, opts);
+    for (const auto& k : keys) {
+      builder.Add(k, value);
+    }
+    CHECK(builder.Finish(Options()).ok());
+  }
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Sort100K_1Thread, iters) {
+  BM_SortingBuild(iters, 100000, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Sort100K_4Threads, iters) {
+  BM_SortingBuild(iters, 100000, 4);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Sort1M_1Thread, iters) {
+  BM_SortingBuild(iters, 1000000, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Sort1M_4Threads, iters) {
+  BM_SortingBuild(iters, 1000000, 4);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Sort1M_8Threads, iters) {
+  BM_SortingBuild(iters, 1000000, 8);
+}
+
+}  // namespace sstable
+}  // namespace file
@@ -10,6 +10,7 @@
 #include "file/sstable/filter_policy.h"
 #include "file/sstable/options.h"
 #include "file/sstable/block.h"
+#include "file/sstable/block_cache.h"
 #include "file/sstable/filter_block.h"
 #include "file/sstable/format.h"
 #include "file/sstable/two_level_iterator.h"
@@ -36,8 +37,37 @@ struct Table::Rep {
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
   MetaMapBlock meta_map_block;
+  uint64 cache_id = 0;  // Prefix of our block keys in options.block_cache.
+
+  // Returns the block either from the cache or from the file. If *cache_handle is set,
+  // the block is pinned in the cache and the handle must be released.
+  // Otherwise the caller owns the block.
+  Status LoadBlock(const BlockHandle& handle, Block** block,
+                   BlockCache::Handle** cache_handle) const;
 };
 
+Status Table::Rep::LoadBlock(const BlockHandle& handle, Block** block,
+                             BlockCache::Handle** cache_handle) const {
+  BlockCache* block_cache = options.block_cache;
+  *block = nullptr;
+  *cache_handle = nullptr;
+  if (block_cache != nullptr) {
+    *cache_handle = block_cache->Lookup(cache_id, handle.offset());
+    if (*cache_handle != nullptr) {
+      *block = BlockCache::block(*cache_handle);
+      return Status::OK;
+    }
+  }
+
+  BlockContents contents;
+  RETURN_IF_ERROR(ReadBlock(file, options, handle, &contents));
+  *block = new Block(contents);
+  if (block_cache != nullptr && contents.cachable) {
+    *cache_handle = block_cache->Insert(cache_id, handle.offset(), *block);
+  }
+  return Status::OK;
+}
+
  base::StatusObject<Table*> Table::Open(const ReadOptions& options,
                                         ReadonlyFile* file) {
   size_t size = file->Size();
@@ -55,9 +85,14 @@ struct Table::Rep {
   s = footer.DecodeFrom(footer_input);
   if (!s.ok()) return s;
 
+  switch (options.access_hint) {
+    case kAccessNormal: break;
+    case kAccessSequential: file->Advise(ReadonlyFile::ACCESS_SEQUENTIAL); break;
+    case kAccessRandom: file->Advise(ReadonlyFile::ACCESS_RANDOM); break;
+  }
+
   // Read the index block
   BlockContents contents;
-
   s = ReadBlock(file, ReadOptions(), footer.index_handle(), &contents);
   if (!s.ok()) return s;
 
@@ -70,6 +105,9 @@ struct Table::Rep {
   rep->index_block = new Block(contents);
   rep->filter_data = NULL;
   rep->filter = NULL;
+  if (options.block_cache != nullptr) {
+    rep->cache_id = options.block_cache->NewId();
+  }
   Table* table = new Table(rep);
   table->ReadMeta(footer);
 
@@ -136,30 +174,39 @@ static void DeleteBlock(void* arg) {
   delete reinterpret_cast<Block*>(arg);
 }
 
+static void ReleaseBlock(void* arg) {
+  BlockCache::Release(reinterpret_cast<BlockCache::Handle*>(arg));
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Block* block = NULL;
+  const Rep* rep = table->rep_;
   BlockHandle handle;
   Slice input = index_value;
   Status s = handle.DecodeFrom(&input);
   // We intentionally allow extra stuff in index_value so that we
   // can add more features in the future.
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
 
-  if (s.ok()) {
-    BlockContents contents;
-    s = ReadBlock(table->rep_->file, table->rep_->options, handle, &contents);
-    if (s.ok()) {
-      block = new Block(contents);
-      Iterator* iter = block->NewIterator();
-      iter->RegisterCleanup(&DeleteBlock, block);
-      return iter;
-    }
+  Block* block = NULL;
+  BlockCache::Handle* cache_handle = NULL;
+  s = rep->LoadBlock(handle, &block, &cache_handle);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
   }
 
-  return NewErrorIterator(s);
+  Iterator* iter = block->NewIterator();
+  if (cache_handle != NULL) {
+    iter->RegisterCleanup(&ReleaseBlock, cache_handle);
+  } else {
+    iter->RegisterCleanup(&DeleteBlock, block);
+  }
+  return iter;
 }
 
 Iterator* Table::NewIterator() const {
@@ -168,6 +215,37 @@ Iterator* Table::NewIterator() const {
       &Table::BlockReader, const_cast<Table*>(this));
 }
 
+Status Table::Get(const Slice& key, const GetCallback& cb) const {
+  // The last key of each data block is its index key, hence the first index entry
+  // with key >= target points to the only block that may contain it.
+  std::string found_key;
+  Slice handle_value;
+  auto res = rep_->index_block->Seek(key, &found_key, &handle_value);
+  if (!res.ok() || !res.obj)
+    return res.status;
+
+  BlockHandle handle;
+  RETURN_IF_ERROR(handle.DecodeFrom(&handle_value));
+  if (rep_->filter != NULL && !rep_->filter->KeyMayMatch(handle.offset(), key)) {
+    return Status::OK;
+  }
+
+  Block* block = NULL;
+  BlockCache::Handle* cache_handle = NULL;
+  RETURN_IF_ERROR(rep_->LoadBlock(handle, &block, &cache_handle));
+  Slice value;
+  res = block->Seek(key, &found_key, &value);
+  if (res.ok() && res.obj && key == Slice(found_key)) {
+    cb(key, value);
+  }
+  if (cache_handle != NULL) {
+    BlockCache::Release(cache_handle);
+  } else {
+    delete block;
+  }
+  return res.status;
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   Iterator* index_iter = rep_->index_block->NewIterator();
   index_iter->Seek(key);
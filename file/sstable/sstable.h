@@ -6,6 +6,7 @@
 #define _FILE_SSTABLE_TABLE_H_
 
 #include <cstdint>
+#include <functional>
 #include "file/sstable/iterator.h"
 #include "file/sstable/options.h"
 
@@ -74,6 +75,16 @@ class Table {
   // call one of the Seek methods on the iterator before using it).
   Iterator* NewIterator() const;
 
+  typedef std::function<void(const strings::Slice& key, const strings::Slice& value)>
+      GetCallback;
+
+  // Point lookup. Calls cb with the entry if the table contains key; the arguments are
+  // valid only during the call. A missing key is not an error.
+  // Unlike Seek on NewIterator(), it searches the index block once, consults the filter
+  // (if ReadOptions::filter_policy is set) before touching data blocks and decodes
+  // just the target block.
+  base::Status Get(const strings::Slice& key, const GetCallback& cb) const;
+
   // Given a key, return an approximate byte offset in the file where
   // the data for that key begins (or would begin if the key were
   // present in the file).  The returned value is in terms of file
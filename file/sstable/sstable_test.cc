@@ -14,8 +14,11 @@
 #include "file/sstable/iterator.h"
 #include "file/sstable/sstable_builder.h"
 #include "file/sstable/block.h"
+#include "file/sstable/block_cache.h"
 #include "file/sstable/block_builder.h"
+#include "file/sstable/filter_policy.h"
 #include "file/sstable/format.h"
+#include "file/file_util.h"
 #include "util/sinksource.h"
 #include "file/test_util.h"
 #include "strings/stringpiece.h"
@@ -635,5 +638,300 @@ TEST_F(TableTest, SeekToFirst) {
   ASSERT_TRUE(it->Valid());
 }
 
+TEST_F(TableTest, BlockCache) {
+  Options options;
+  options.block_size = 256;
+  TableBuilder builder(options, &sink_);
+  for (unsigned i = 0; i < 1000; ++i) {
+    builder.Add(StringPrintf("key%04d", i), std::string(100, 'a' + i % 26));
+  }
+  ASSERT_TRUE(builder.Finish().ok());
+
+  ReadonlyStringFile fl(sink_.contents());
+  BlockCache cache(1 << 20, 2);
+  ReadOptions read_options;
+  read_options.block_cache = &cache;
+  auto res = Table::Open(read_options, &fl);
+  ASSERT_TRUE(res.status.ok()) << res.status;
+  std::unique_ptr<Table> t(res.obj);
+
+  for (unsigned pass = 0; pass < 2; ++pass) {
+    std::unique_ptr<Iterator> it(t->NewIterator());
+    unsigned i = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next(), ++i) {
+      ASSERT_EQ(StringPrintf("key%04d", i), it->key().as_string());
+      ASSERT_EQ(std::string(100, 'a' + i % 26), it->value().as_string());
+    }
+    EXPECT_EQ(1000, i);
+  }
+  const uint64 num_blocks = cache.misses();
+  EXPECT_GT(num_blocks, 10);
+  EXPECT_EQ(num_blocks, cache.hits());
+  EXPECT_EQ(0, cache.evictions());
+  EXPECT_GT(cache.TotalCharge(), 0);
+
+  std::unique_ptr<Iterator> it(t->NewIterator());
+  it->Seek(Slice::FromCstr("key0500"));
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(num_blocks + 1, cache.hits());
+}
+
+TEST_F(TableTest, BlockCacheEviction) {
+  Options options;
+  options.block_size = 256;
+  TableBuilder builder(options, &sink_);
+  for (unsigned i = 0; i < 1000; ++i) {
+    builder.Add(StringPrintf("key%04d", i), std::string(100, 'a' + i % 26));
+  }
+  ASSERT_TRUE(builder.Finish().ok());
+
+  ReadonlyStringFile fl(sink_.contents());
+  BlockCache cache(2048, 0);
+  ReadOptions read_options;
+  read_options.block_cache = &cache;
+  auto res = Table::Open(read_options, &fl);
+  ASSERT_TRUE(res.status.ok()) << res.status;
+  std::unique_ptr<Table> t(res.obj);
+
+  std::unique_ptr<Iterator> it(t->NewIterator());
+  unsigned i = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next(), ++i) {
+    ASSERT_EQ(std::string(100, 'a' + i % 26), it->value().as_string());
+  }
+  EXPECT_EQ(1000, i);
+  EXPECT_GT(cache.evictions(), 0);
+  EXPECT_LE(cache.TotalCharge(), 2048);
+}
+
+TEST_F(TableTest, MmapZeroCopy) {
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  TableBuilder builder(options, &sink_);
+  for (unsigned i = 0; i < 1000; ++i) {
+    builder.Add(StringPrintf("key%04d", i), std::string(100, 'a' + i % 26));
+  }
+  ASSERT_TRUE(builder.Finish().ok());
+  string name = TestTempDir() + "/zero_copy.sst";
+  file_util::WriteStringToFileOrDie(sink_.contents(), name);
+
+  auto file_res = ReadonlyFile::Open(name);
+  ASSERT_TRUE(file_res.ok()) << file_res.status;
+  std::unique_ptr<ReadonlyFile> fl(file_res.obj);
+  ASSERT_TRUE(fl->IsMapped());
+  Slice mapping;
+  ASSERT_TRUE(fl->Read(0, fl->Size(), &mapping, nullptr).ok());
+
+  BlockCache cache(1 << 20, 2);
+  ReadOptions read_options;
+  read_options.block_cache = &cache;
+  read_options.access_hint = kAccessSequential;
+  auto res = Table::Open(read_options, fl.get());
+  ASSERT_TRUE(res.status.ok()) << res.status;
+  std::unique_ptr<Table> t(res.obj);
+
+  std::unique_ptr<Iterator> it(t->NewIterator());
+  unsigned i = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next(), ++i) {
+    ASSERT_EQ(std::string(100, 'a' + i % 26), it->value().as_string());
+    // Values point directly into the mapped file.
+    ASSERT_TRUE(it->value().begin() >= mapping.begin() && it->value().end() <= mapping.end());
+  }
+  EXPECT_EQ(1000, i);
+  it.reset();
+
+  bool found = false;
+  Status st = t->Get(Slice::FromCstr("key0500"), [&](const Slice& k, const Slice& v) {
+    found = v.begin() >= mapping.begin() && v.end() <= mapping.end();
+  });
+  ASSERT_TRUE(st.ok()) << st;
+  EXPECT_TRUE(found);
+
+  // Blocks that are not copied are not cached either.
+  EXPECT_GT(cache.misses(), 10);
+  EXPECT_EQ(0, cache.TotalCharge());
+  t.reset();
+  EXPECT_TRUE(fl->Close().ok());
+}
+
+// Returns the value or "NOT_FOUND".
+static string Get(const Table& table, StringPiece key) {
+  string res = "NOT_FOUND";
+  Status st = table.Get(key.as_slice(), [&res](const Slice& k, const Slice& v) {
+    res = v.as_string();
+  });
+  CHECK(st.ok()) << st;
+  return res;
+}
+
+TEST_F(TableTest, Get) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  for (const FilterPolicy* fp : {static_cast<const FilterPolicy*>(nullptr), policy.get()}) {
+    Options options;
+    options.block_size = 256;
+    options.filter_policy = fp;
+    util::StringSink sink;
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < 1000; ++i) {
+      builder.Add(StringPrintf("key%04d", i * 2), std::string(100, 'a' + i % 26));
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+
+    ReadonlyStringFile fl(sink.contents());
+    BlockCache cache(1 << 20, 2);
+    ReadOptions read_options;
+    read_options.block_cache = &cache;
+    read_options.filter_policy = fp;
+    auto res = Table::Open(read_options, &fl);
+    ASSERT_TRUE(res.status.ok()) << res.status;
+    std::unique_ptr<Table> t(res.obj);
+
+    for (unsigned i = 0; i < 1000; ++i) {
+      ASSERT_EQ(std::string(100, 'a' + i % 26), Get(*t, StringPrintf("key%04d", i * 2)));
+    }
+    uint64 lookups = cache.hits() + cache.misses();
+    for (unsigned i = 0; i < 1000; ++i) {
+      ASSERT_EQ("NOT_FOUND", Get(*t, StringPrintf("key%04d", i * 2 + 1)));
+    }
+    EXPECT_EQ("NOT_FOUND", Get(*t, ""));
+    EXPECT_EQ("NOT_FOUND", Get(*t, "key"));
+    EXPECT_EQ("NOT_FOUND", Get(*t, "zzz"));
+
+    uint64 miss_lookups = cache.hits() + cache.misses() - lookups;
+    if (fp) {
+      // Only false positives of the filter read data blocks.
+      EXPECT_LT(miss_lookups, 50);
+    } else {
+      EXPECT_GE(miss_lookups, 1000);
+    }
+  }
+}
+
+// Benchmark table with 100K keys; even keys are present and odd keys are missing.
+class BenchmarkTable {
+ public:
+  // If use_mmap is true, the table is written to disk and opened with ReadonlyFile::Open.
+  explicit BenchmarkTable(bool use_filter, bool use_mmap = false,
+                          CompressionType compression = kSnappyCompression) {
+    if (use_filter) {
+      policy_.reset(NewBloomFilterPolicy(10));
+    }
+    Options options;
+    options.filter_policy = policy_.get();
+    options.compression = compression;
+    util::StringSink sink;
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kNumKeys; ++i) {
+      builder.Add(Key(i * 2), std::string(64, 'v'));
+    }
+    CHECK(builder.Finish().ok());
+    if (use_mmap) {
+      string name = TestTempDir() + "/bm_table.sst";
+      file_util::WriteStringToFileOrDie(sink.contents(), name);
+      auto res = ReadonlyFile::Open(name);
+      CHECK(res.ok()) << res.status;
+      file_.reset(res.obj);
+    } else {
+      file_.reset(new ReadonlyStringFile(sink.contents()));
+    }
+    ReadOptions read_options;
+    read_options.access_hint = kAccessRandom;
+    read_options.filter_policy = policy_.get();
+    auto res = Table::Open(read_options, file_.get());
+    CHECK(res.ok());
+    table_.reset(res.obj);
+  }
+
+  ~BenchmarkTable() {
+    table_.reset();
+    CHECK(file_->Close().ok());
+  }
+
+  static string Key(unsigned i) { return StringPrintf("key%08u", i); }
+
+  const Table& table() const { return *table_; }
+
+  static constexpr unsigned kNumKeys = 100000;
+
+ private:
+  std::unique_ptr<const FilterPolicy> policy_;
+  std::unique_ptr<ReadonlyFile> file_;
+  std::unique_ptr<Table> table_;
+};
+
+static void BM_TableGet(uint32 iters, bool use_filter, unsigned odd, bool use_mmap = false,
+                        CompressionType compression = kSnappyCompression) {
+  StopBenchmarkTiming();
+  BenchmarkTable bt(use_filter, use_mmap, compression);
+  MTRandom rnd(10);
+  std::vector<string> keys(1024);
+  for (auto& k : keys) {
+    k = BenchmarkTable::Key((rnd.Rand32() % BenchmarkTable::kNumKeys) * 2 + odd);
+  }
+  unsigned found = 0;
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    CHECK(bt.table().Get(keys[i % keys.size()], [&found](const Slice&, const Slice&) {
+      ++found;
+    }).ok());
+  }
+  StopBenchmarkTiming();
+  CHECK_EQ(odd ? 0 : iters, found);
+}
+
+static void BM_TableIteratorGet(uint32 iters, unsigned odd) {
+  StopBenchmarkTiming();
+  BenchmarkTable bt(false);
+  MTRandom rnd(10);
+  std::vector<string> keys(1024);
+  for (auto& k : keys) {
+    k = BenchmarkTable::Key((rnd.Rand32() % BenchmarkTable::kNumKeys) * 2 + odd);
+  }
+  unsigned found = 0;
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    const string& key = keys[i % keys.size()];
+    std::unique_ptr<Iterator> it(bt.table().NewIterator());
+    it->Seek(key);
+    if (it->Valid() && it->key() == Slice(key)) {
+      ++found;
+    }
+  }
+  StopBenchmarkTiming();
+  CHECK_EQ(odd ? 0 : iters, found);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetHit, iters) {
+  BM_TableGet(iters, false, 0);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetMiss, iters) {
+  BM_TableGet(iters, false, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetHitFilter, iters) {
+  BM_TableGet(iters, true, 0);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetMissFilter, iters) {
+  BM_TableGet(iters, true, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetHitMmap, iters) {
+  BM_TableGet(iters, false, 0, true);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_GetHitMmapNoCompression, iters) {
+  BM_TableGet(iters, false, 0, true, kNoCompression);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_IteratorHit, iters) {
+  BM_TableIteratorGet(iters, 0);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_IteratorMiss, iters) {
+  BM_TableIteratorGet(iters, 1);
+}
+
 }  // namespace sstable
 }  // namespace file
\ No newline at end of file
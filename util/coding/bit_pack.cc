@@ -2,6 +2,11 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include "util/coding/bit_pack.h"
+
+#include <immintrin.h>
+#include <string.h>
+#include <algorithm>
+
 #include "base/logging.h"
 
 #ifdef IS_BIG_ENDIAN
@@ -113,7 +118,7 @@ uint8* BitPack(const uint64* src, uint32 count, uint8 bit_width, uint8* dest) {
     uint8 total_bits = offset + bit_width;
     dest += total_bits / 8;
     if (total_bits > 64) {
-      *dest |= uint8(val >> (128 - total_bits));
+      *dest |= uint8(val >> (64 - offset));
     }
     offset = total_bits % 8;
   }
@@ -166,5 +171,238 @@ const uint8* BitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint64*
   return BitUnpackTempl(src, count, bit_width, dest);
 }
 
+namespace {
+
+// The kernels below work on one row of four integers per vector. bit_width is a template
+// argument and the loops over 32 rows are fully unrolled, so all the shifts become immediate.
+// A packed block consists of BW 128-bit words. Row r starts at bit r * BW of its lane.
+#if defined(__GNUC__) && __GNUC__ >= 8
+#define UNROLL_ROWS _Pragma("GCC unroll 32")
+#else
+#define UNROLL_ROWS
+#endif
+
+template<unsigned BW> inline void UnpackBlockSse2(const __m128i* in, __m128i* out) {
+  const __m128i mask = _mm_set1_epi32(BW == 32 ? ~0U : (1U << BW) - 1);
+  __m128i word = _mm_loadu_si128(in);
+  UNROLL_ROWS
+  for (unsigned r = 0; r < 32; ++r) {
+    const unsigned shift = (r * BW) % 32;
+    __m128i v = _mm_srli_epi32(word, shift);
+    if (shift + BW >= 32) {
+      if ((r * BW) / 32 + 1 < BW)
+        word = _mm_loadu_si128(in + (r * BW) / 32 + 1);
+      if (shift + BW > 32)
+        v = _mm_or_si128(v, _mm_slli_epi32(word, 32 - shift));
+    }
+    _mm_storeu_si128(out + r, _mm_and_si128(v, mask));
+  }
+}
+
+// Values must fit in BW bits.
+template<unsigned BW> inline void PackBlockSse2(const __m128i* in, __m128i* out) {
+  __m128i acc = _mm_setzero_si128();
+  UNROLL_ROWS
+  for (unsigned r = 0; r < 32; ++r) {
+    const unsigned shift = (r * BW) % 32;
+    __m128i v = _mm_loadu_si128(in + r);
+    acc = _mm_or_si128(acc, _mm_slli_epi32(v, shift));
+    if (shift + BW >= 32) {
+      _mm_storeu_si128(out++, acc);
+      acc = shift + BW > 32 ? _mm_srli_epi32(v, 32 - shift) : _mm_setzero_si128();
+    }
+  }
+}
+
+// AVX2 kernels process two adjacent blocks: the low half of each vector belongs to
+// the first block and the high half to the second one.
+__attribute__((target("avx2")))
+inline __m256i LoadPair(const __m128i* a, const __m128i* b) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(a)),
+                                 _mm_loadu_si128(b), 1);
+}
+
+__attribute__((target("avx2")))
+inline void StorePair(__m256i v, __m128i* a, __m128i* b) {
+  _mm_storeu_si128(a, _mm256_castsi256_si128(v));
+  _mm_storeu_si128(b, _mm256_extracti128_si256(v, 1));
+}
+
+template<unsigned BW> __attribute__((target("avx2")))
+inline void UnpackBlockPairAvx2(const __m128i* in, __m128i* out) {
+  const __m128i* in2 = in + BW;
+  __m128i* out2 = out + 32;
+  const __m256i mask = _mm256_set1_epi32(BW == 32 ? ~0U : (1U << BW) - 1);
+  __m256i word = LoadPair(in, in2);
+  UNROLL_ROWS
+  for (unsigned r = 0; r < 32; ++r) {
+    const unsigned shift = (r * BW) % 32;
+    const unsigned next = (r * BW) / 32 + 1;
+    __m256i v = _mm256_srli_epi32(word, shift);
+    if (shift + BW >= 32) {
+      if (next < BW)
+        word = LoadPair(in + next, in2 + next);
+      if (shift + BW > 32)
+        v = _mm256_or_si256(v, _mm256_slli_epi32(word, 32 - shift));
+    }
+    StorePair(_mm256_and_si256(v, mask), out + r, out2 + r);
+  }
+}
+
+template<unsigned BW> __attribute__((target("avx2")))
+inline void PackBlockPairAvx2(const __m128i* in, __m128i* out) {
+  const __m128i* in2 = in + 32;
+  __m128i* out2 = out + BW;
+  __m256i acc = _mm256_setzero_si256();
+  UNROLL_ROWS
+  for (unsigned r = 0; r < 32; ++r) {
+    const unsigned shift = (r * BW) % 32;
+    __m256i v = LoadPair(in + r, in2 + r);
+    acc = _mm256_or_si256(acc, _mm256_slli_epi32(v, shift));
+    if (shift + BW >= 32) {
+      StorePair(acc, out++, out2++);
+      acc = shift + BW > 32 ? _mm256_srli_epi32(v, 32 - shift) : _mm256_setzero_si256();
+    }
+  }
+}
+
+template<unsigned BW> void UnpackBlocksSse2(const __m128i* in, uint32 num_blocks, __m128i* out) {
+  for (uint32 i = 0; i < num_blocks; ++i, in += BW, out += 32)
+    UnpackBlockSse2<BW>(in, out);
+}
+
+template<unsigned BW> void PackBlocksSse2(const __m128i* in, uint32 num_blocks, __m128i* out) {
+  for (uint32 i = 0; i < num_blocks; ++i, in += 32, out += BW)
+    PackBlockSse2<BW>(in, out);
+}
+
+template<unsigned BW> __attribute__((target("avx2")))
+void UnpackBlocksAvx2(const __m128i* in, uint32 num_blocks, __m128i* out) {
+  uint32 i = 0;
+  for (; i + 2 <= num_blocks; i += 2, in += 2 * BW, out += 64)
+    UnpackBlockPairAvx2<BW>(in, out);
+  if (i < num_blocks)
+    UnpackBlockSse2<BW>(in, out);
+}
+
+template<unsigned BW> __attribute__((target("avx2")))
+void PackBlocksAvx2(const __m128i* in, uint32 num_blocks, __m128i* out) {
+  uint32 i = 0;
+  for (; i + 2 <= num_blocks; i += 2, in += 64, out += 2 * BW)
+    PackBlockPairAvx2<BW>(in, out);
+  if (i < num_blocks)
+    PackBlockSse2<BW>(in, out);
+}
+
+#define FOR_EACH_BIT_WIDTH(F) \
+  F(1) F(2) F(3) F(4) F(5) F(6) F(7) F(8) F(9) F(10) F(11) F(12) F(13) F(14) F(15) F(16) \
+  F(17) F(18) F(19) F(20) F(21) F(22) F(23) F(24) F(25) F(26) F(27) F(28) F(29) F(30) F(31) \
+  F(32)
+
+}  // namespace
+
+namespace bit_pack_internal {
+
+bool HasAvx2() {
+  static const bool res = __builtin_cpu_supports("avx2");
+  return res;
+}
+
+uint8* SimdPackBlocks(const uint32* src, uint32 num_blocks, uint8 bit_width, bool avx2,
+                      uint8* dest) {
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  __m128i* out = reinterpret_cast<__m128i*>(dest);
+  switch (bit_width) {
+#define PACK_CASE(BW) \
+    case BW: \
+      if (avx2) PackBlocksAvx2<BW>(in, num_blocks, out); \
+      else PackBlocksSse2<BW>(in, num_blocks, out); \
+    break;
+    FOR_EACH_BIT_WIDTH(PACK_CASE)
+#undef PACK_CASE
+    default:
+      LOG(FATAL) << "Invalid bit width " << int(bit_width);
+  }
+  return dest + num_blocks * 16 * bit_width;
+}
+
+const uint8* SimdUnpackBlocks(const uint8* src, uint32 num_blocks, uint8 bit_width, bool avx2,
+                              uint32* dest) {
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  __m128i* out = reinterpret_cast<__m128i*>(dest);
+  switch (bit_width) {
+#define UNPACK_CASE(BW) \
+    case BW: \
+      if (avx2) UnpackBlocksAvx2<BW>(in, num_blocks, out); \
+      else UnpackBlocksSse2<BW>(in, num_blocks, out); \
+    break;
+    FOR_EACH_BIT_WIDTH(UNPACK_CASE)
+#undef UNPACK_CASE
+    default:
+      LOG(FATAL) << "Invalid bit width " << int(bit_width);
+  }
+  return src + num_blocks * 16 * bit_width;
+}
+
+}  // namespace bit_pack_internal
+
+#undef FOR_EACH_BIT_WIDTH
+#undef UNROLL_ROWS
+
+using bit_pack_internal::HasAvx2;
+using bit_pack_internal::SimdPackBlocks;
+using bit_pack_internal::SimdUnpackBlocks;
+
+uint8* SimdBitPack(const uint32* src, uint32 count, uint8 bit_width, uint8* dest) {
+  DCHECK(bit_width <= 32 && bit_width > 0);
+  uint32 num_blocks = count / kSimdBlockSize;
+  dest = SimdPackBlocks(src, num_blocks, bit_width, HasAvx2(), dest);
+  src += num_blocks * kSimdBlockSize;
+  return BitPack(src, count % kSimdBlockSize, bit_width, dest);
+}
+
+const uint8* SimdBitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint32* dest) {
+  DCHECK(bit_width <= 32 && bit_width > 0);
+  uint32 num_blocks = count / kSimdBlockSize;
+  src = SimdUnpackBlocks(src, num_blocks, bit_width, HasAvx2(), dest);
+  dest += num_blocks * kSimdBlockSize;
+  return BitUnpack(src, count % kSimdBlockSize, bit_width, dest);
+}
+
+uint8* SimdBitPack(const uint64* src, uint32 count, uint8 bit_width, uint8* dest) {
+  DCHECK(bit_width <= 64 && bit_width > 0);
+  const bool avx2 = HasAvx2();
+  const uint8 lo_width = std::min<uint8>(bit_width, 32);
+  uint32 lo[kSimdBlockSize], hi[kSimdBlockSize];
+  uint32 num_blocks = count / kSimdBlockSize;
+  for (uint32 i = 0; i < num_blocks; ++i, src += kSimdBlockSize) {
+    for (unsigned j = 0; j < kSimdBlockSize; ++j) {
+      lo[j] = src[j];
+      hi[j] = src[j] >> 32;
+    }
+    dest = SimdPackBlocks(lo, 1, lo_width, avx2, dest);
+    if (bit_width > 32)
+      dest = SimdPackBlocks(hi, 1, bit_width - 32, avx2, dest);
+  }
+  return BitPack(src, count % kSimdBlockSize, bit_width, dest);
+}
+
+const uint8* SimdBitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint64* dest) {
+  DCHECK(bit_width <= 64 && bit_width > 0);
+  const bool avx2 = HasAvx2();
+  const uint8 lo_width = std::min<uint8>(bit_width, 32);
+  uint32 lo[kSimdBlockSize], hi[kSimdBlockSize] = {0};
+  uint32 num_blocks = count / kSimdBlockSize;
+  for (uint32 i = 0; i < num_blocks; ++i, dest += kSimdBlockSize) {
+    src = SimdUnpackBlocks(src, 1, lo_width, avx2, lo);
+    if (bit_width > 32)
+      src = SimdUnpackBlocks(src, 1, bit_width - 32, avx2, hi);
+    for (unsigned j = 0; j < kSimdBlockSize; ++j) {
+      dest[j] = (uint64(hi[j]) << 32) | lo[j];
+    }
+  }
+  return BitUnpack(src, count % kSimdBlockSize, bit_width, dest);
+}
+
 }  // namespace coding
 }  // namespace util
\ No newline at end of file
@@ -28,6 +28,40 @@ inline uint32 PackedByteCount(uint32 count, uint8 bit_width) {
 const uint8* BitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint32* dest);
 const uint8* BitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint64* dest);
 
+// Vertical layout for SIMD packing. Integers are packed in blocks of kSimdBlockSize.
+// Integer i of a block goes to 32-bit lane i % 4 and row i / 4. Each lane packs its 32 rows
+// one after another, so a block takes exactly 16 * bit_width bytes and all four lanes are
+// unpacked with the same vector shifts. The remaining count % kSimdBlockSize integers are packed
+// with BitPack, hence dest needs BIT_PACK_MARGIN bytes as well.
+// The kernels are selected at runtime: AVX2 unpacks two blocks at a time, SSE2 one.
+constexpr unsigned kSimdBlockSize = 128;
+
+inline uint32 SimdPackedByteCount(uint32 count, uint8 bit_width) {
+  return count / kSimdBlockSize * 16 * bit_width +
+         PackedByteCount(count % kSimdBlockSize, bit_width);
+}
+
+uint8* SimdBitPack(const uint32* src, uint32 count, uint8 bit_width, uint8* dest);
+const uint8* SimdBitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint32* dest);
+
+// 64-bit integers are split into 32-bit halves. A block holds the low halves packed with
+// min(bit_width, 32) bits and then the high halves packed with the remaining bits, if any.
+// SimdPackedByteCount applies to them as well.
+uint8* SimdBitPack(const uint64* src, uint32 count, uint8 bit_width, uint8* dest);
+const uint8* SimdBitUnpack(const uint8* src, uint32 count, uint8 bit_width, uint64* dest);
+
+namespace bit_pack_internal {
+
+bool HasAvx2();
+
+// Pack and unpack num_blocks whole blocks. Exposed for testing.
+uint8* SimdPackBlocks(const uint32* src, uint32 num_blocks, uint8 bit_width, bool avx2,
+                      uint8* dest);
+const uint8* SimdUnpackBlocks(const uint8* src, uint32 num_blocks, uint8 bit_width, bool avx2,
+                              uint32* dest);
+
+}  // namespace bit_pack_internal
+
 }  // namespace coding
 }  // namespace util
 
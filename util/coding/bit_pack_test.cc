@@ -27,7 +27,28 @@ protected:
     EXPECT_THAT(decoded_vals, ElementsAreArray(vals)) << "Width " << uint32(width);
   }
 
+  template <typename T> void TestSimdEncoding(uint8 width, const std::vector<T>& vals) {
+    std::vector<uint8> buf(SimdPackedByteCount(vals.size(), width) + BIT_PACK_MARGIN);
+    uint8* next = SimdBitPack(vals.data(), vals.size(), width, buf.data());
+    ASSERT_EQ(SimdPackedByteCount(vals.size(), width), next - buf.data());
+
+    std::vector<T> decoded_vals(vals.size(), 0);
+    const uint8* src_next = SimdBitUnpack(buf.data(), vals.size(), width, decoded_vals.data());
+    EXPECT_EQ(src_next, next);
+    EXPECT_THAT(decoded_vals, ElementsAreArray(vals)) << "Width " << uint32(width);
+  }
+
+  template <typename T> std::vector<T> RandomValues(uint8 width, uint32 count) {
+    std::vector<T> vals(count);
+    for (T& v : vals) {
+      uint64 r = (uint64(rand_.Rand32()) << 32) | rand_.Rand32();
+      v = T(r & (~0ULL >> (64 - width)));
+    }
+    return vals;
+  }
+
   uint8 buf_[1000];
+  MTRandom rand_{10};
 };
 
 TEST_F(BitPackTest, Bits) {
@@ -74,6 +95,47 @@ TEST_F(BitPackTest, BitPack64) {
   TestEncoding(63, vals);
 }
 
+TEST_F(BitPackTest, SimdBitPack) {
+  for (uint8 w = 1; w <= 32; ++w) {
+    for (uint32 count : {0, 5, 128, 200, 256, 401, 1000}) {
+      TestSimdEncoding(w, RandomValues<uint32>(w, count));
+    }
+    TestSimdEncoding(w, std::vector<uint32>(384, uint32(~0ULL >> (64 - w))));
+  }
+}
+
+TEST_F(BitPackTest, SimdBitPack64) {
+  for (uint8 w = 1; w <= 64; ++w) {
+    for (uint32 count : {0, 5, 128, 401}) {
+      TestSimdEncoding(w, RandomValues<uint64>(w, count));
+    }
+  }
+}
+
+// Both kernels must produce the same layout.
+TEST_F(BitPackTest, SimdKernels) {
+  if (!bit_pack_internal::HasAvx2()) {
+    LOG(INFO) << "AVX2 is not supported, skipping";
+    return;
+  }
+  using namespace bit_pack_internal;
+  constexpr uint32 kBlocks = 5;
+  for (uint8 w = 1; w <= 32; ++w) {
+    std::vector<uint32> vals = RandomValues<uint32>(w, kBlocks * kSimdBlockSize);
+    std::vector<uint8> sse2(16 * w * kBlocks), avx2(sse2.size());
+    EXPECT_EQ(sse2.data() + sse2.size(), SimdPackBlocks(vals.data(), kBlocks, w, false,
+                                                        sse2.data()));
+    SimdPackBlocks(vals.data(), kBlocks, w, true, avx2.data());
+    ASSERT_TRUE(sse2 == avx2) << int(w);
+
+    std::vector<uint32> decoded(vals.size());
+    SimdUnpackBlocks(sse2.data(), kBlocks, w, true, decoded.data());
+    EXPECT_THAT(decoded, ElementsAreArray(vals));
+    std::fill(decoded.begin(), decoded.end(), 0);
+    SimdUnpackBlocks(sse2.data(), kBlocks, w, false, decoded.data());
+    EXPECT_THAT(decoded, ElementsAreArray(vals));
+  }
+}
 
 DECLARE_BENCHMARK_FUNC(BM_BitPack, iters) {
   StopBenchmarkTiming();
@@ -102,6 +164,33 @@ DECLARE_BENCHMARK_FUNC(BM_BitUnpack, iters) {
   BitUnpack(buf.data(), vals.size(), kWidth, &vals.front());
 }
 
+DECLARE_BENCHMARK_FUNC(BM_SimdBitPack, iters) {
+  StopBenchmarkTiming();
+  MTRandom rand(10);
+  std::vector<uint32> vals(iters, 0);
+  for (uint32_t i = 0; i < iters; ++i) {
+    vals[i] = rand.Rand32() % 29947;
+  }
+  constexpr uint8 kWidth = 15;
+  std::vector<uint8> buf(SimdPackedByteCount(iters, kWidth) + BIT_PACK_MARGIN);
+  StartBenchmarkTiming();
+  SimdBitPack(vals.data(), vals.size(), kWidth, &buf.front());
+}
+
+DECLARE_BENCHMARK_FUNC(BM_SimdBitUnpack, iters) {
+  StopBenchmarkTiming();
+  MTRandom rand(10);
+  std::vector<uint32> vals(iters, 0);
+  for (uint32_t i = 0; i < iters; ++i) {
+    vals[i] = rand.Rand32() % 29947;
+  }
+  constexpr uint8 kWidth = 15;
+  std::vector<uint8> buf(SimdPackedByteCount(iters, kWidth) + BIT_PACK_MARGIN);
+  SimdBitPack(vals.data(), vals.size(), kWidth, &buf.front());
+  StartBenchmarkTiming();
+  SimdBitUnpack(buf.data(), vals.size(), kWidth, &vals.front());
+}
+
 DECLARE_BENCHMARK_FUNC(BM_BitBsr, iters) {
   StopBenchmarkTiming();
   std::vector<uint32> vals(1000, 0);
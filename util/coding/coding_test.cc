@@ -46,8 +46,9 @@ protected:
 
   void Push32(uint32 v) { values_.push_back(v); }
 
-  uint32 Finalize() {
+  uint32 Finalize(bool simd_layout = true) {
     UInt32Encoder encoder;
+    encoder.set_simd_layout(simd_layout);
     encoder.Encode(values_, true);
     encoder.Swap(&buf_);
     repeated_overhead_ = encoder.repeated_overhead();
@@ -56,6 +57,25 @@ protected:
     return encoder.header_overhead();
   }
 
+  // Decodes buf_ with DecodeBatch in batches of batch_size, alternating with Next() calls
+  // if mix_next is true, and compares the result with values_.
+  void CheckDecodeBatch(size_t batch_size, bool mix_next) {
+    UInt32Decoder decoder = get_decoder();
+    vector<uint32> res(values_.size() + batch_size);
+    size_t pos = 0;
+    while (true) {
+      size_t decoded = decoder.DecodeBatch(res.data() + pos, batch_size);
+      pos += decoded;
+      if (decoded < batch_size)
+        break;
+      if (mix_next && decoder.Next(&res[pos]))
+        ++pos;
+    }
+    ASSERT_EQ(values_.size(), pos) << batch_size;
+    res.resize(pos);
+    EXPECT_THAT(res, ElementsAreArray(values_)) << batch_size;
+  }
+
   std::vector<uint8> buf_;
   BitArray bit_array_;
   vector<uint32> values_;
@@ -336,6 +356,105 @@ TEST_F(CodingTest, Medium2) {
   EXPECT_FALSE(decoder.Next(&val));
 }
 
+TEST_F(CodingTest, DecodeBatch) {
+  vector<vector<uint32>> datasets;
+  for (uint32 i = 0; i < 10; ++i) {
+    for (uint32 k = 0; k < 100; ++k)
+      Push32(i*100 + k);
+    for (uint32 k = 0; k < 1000; ++k)
+      Push32(16543);
+    for (uint32 k = 0; k < 200; ++k)
+      Push32(i * 1000 + k * 7);  // repeated delta.
+    for (uint32 k = 0; k < 300; ++k)
+      Push32(k*k);  // delta over pfor.
+    for (uint32 k = 0; k < 10; ++k)
+      Push32(i*100 + k);
+  }
+  datasets.push_back(std::move(values_));
+  datasets.push_back(LoadUInt32("testdata/small_numbers.txt"));
+  datasets.push_back(LoadUInt32("testdata/medium2.txt"));
+
+  for (auto& data : datasets) {
+    values_ = std::move(data);
+    Finalize();
+    for (size_t batch_size : {1, 3, 8, 63, 64, 65, 1000, 100000}) {
+      CheckDecodeBatch(batch_size, false);
+      CheckDecodeBatch(batch_size, true);
+    }
+  }
+}
+
+TEST_F(CodingTest, SimdLayout) {
+  MTRandom rand(10);
+  for (uint32 bit_width : {3, 7, 13, 24, 31, 32}) {
+    values_.clear();
+    uint32 mask = bit_width == 32 ? kuint32max : (1u << bit_width) - 1;
+    for (uint32 i = 0; i < 1000 + bit_width; ++i) {
+      Push32(rand.Rand32() & mask);
+    }
+    Finalize(false);
+    size_t pfor_size = buf_.size();
+    CheckDecodeBatch(100, true);
+
+    // Uniform random values do not have exceptions, so DIRECT_SIMD is chosen.
+    Finalize(true);
+    EXPECT_LE(buf_.size(), pfor_size) << bit_width;
+    EXPECT_EQ(3, direct_overhead_) << bit_width;  // header byte and varint count.
+    CheckDecodeBatch(100, true);
+    CheckDecodeBatch(1000, false);
+
+    UInt32Decoder decoder = get_decoder();
+    uint32 val;
+    for (uint32 v : values_) {
+      ASSERT_TRUE(decoder.Next(&val));
+      ASSERT_EQ(v, val);
+    }
+    EXPECT_FALSE(decoder.Next(&val));
+  }
+}
+
+TEST_F(CodingTest, StreamVByte) {
+  MTRandom rand(10);
+  for (uint32 i = 0; i < 5000; ++i) {
+    Push32(rand.Skewed(31));
+  }
+  Finalize(false);
+  size_t pfor_size = buf_.size();
+
+  // Varying magnitudes favor STREAM_VBYTE over both bit packed layouts.
+  Finalize(true);
+  EXPECT_LT(buf_.size() * 5, pfor_size * 4);
+  CheckDecodeBatch(1000, true);
+  CheckDecodeBatch(5000, false);
+
+  UInt32Decoder decoder = get_decoder();
+  uint32 val;
+  for (uint32 v : values_) {
+    ASSERT_TRUE(decoder.Next(&val));
+    ASSERT_EQ(v, val);
+  }
+  EXPECT_FALSE(decoder.Next(&val));
+}
+
+TEST_F(CodingTest, DecodeBatch64) {
+  UInt64Encoder encoder;
+  std::vector<uint64> values;
+  const uint64 kBase = uint64(kuint32max) << 24;
+  for (int i = 0; i < 2000; ++i)
+    values.push_back(kBase + i * (i % 7));
+  ASSERT_EQ(values.size(), encoder.Encode(values.data(), values.size(), true));
+  util::StringSink ssink;
+  ASSERT_TRUE(encoder.SerializeTo(&ssink).ok());
+  strings::Slice slice(ssink.contents());
+
+  UInt64Decoder decoder(slice);
+  std::vector<uint64> res(values.size() + 1);
+  EXPECT_EQ(100, decoder.DecodeBatch(res.data(), 100));
+  EXPECT_EQ(values.size() - 100, decoder.DecodeBatch(res.data() + 100, values.size()));
+  res.pop_back();
+  EXPECT_THAT(res, ElementsAreArray(values));
+}
+
 TEST_F(CodingTest, BitArray) {
   // 1 literal word
   for (uint32 i = 0; i < 31; ++i) {
@@ -435,6 +554,54 @@ DECLARE_BENCHMARK_FUNC(BM_MemMove, iters) {
   memmove(&copy.front(), vals.data(), vals.size()*sizeof(uint32));
 }
 
+static vector<uint8> EncodeBenchmarkData() {
+  MTRandom rand(10);
+  vector<uint32> vals;
+  for (uint32 i = 0; vals.size() < (1 << 16); ++i) {
+    for (uint32 k = 0; k < 100; ++k)
+      vals.push_back(rand.Rand32() % 29947);
+    vals.insert(vals.end(), 200, i);
+    for (uint32 k = 0; k < 300; ++k)
+      vals.push_back(i * 100000 + k * (k % 5));
+  }
+  UInt32Encoder encoder;
+  encoder.Encode(vals, true);
+  vector<uint8> res;
+  encoder.Swap(&res);
+  return res;
+}
+
+DECLARE_BENCHMARK_FUNC(BM_DecodeNext, iters) {
+  StopBenchmarkTiming();
+  vector<uint8> buf = EncodeBenchmarkData();
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    UInt32Decoder decoder(buf.data(), buf.size());
+    uint32 val, sum = 0;
+    while (decoder.Next(&val))
+      sum += val;
+    base::sink_result(sum);
+  }
+}
+
+DECLARE_BENCHMARK_FUNC(BM_DecodeBatch, iters) {
+  StopBenchmarkTiming();
+  vector<uint8> buf = EncodeBenchmarkData();
+  uint32 vals[1024];
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    UInt32Decoder decoder(buf.data(), buf.size());
+    uint32 sum = 0;
+    size_t decoded;
+    do {
+      decoded = decoder.DecodeBatch(vals, arraysize(vals));
+      for (size_t j = 0; j < decoded; ++j)
+        sum += vals[j];
+    } while (decoded == arraysize(vals));
+    base::sink_result(sum);
+  }
+}
+
 DECLARE_BENCHMARK_FUNC(BM_BitArrayPushDense, iters) {
   BitArray bit_array;
   for (uint32_t i = 0; i < iters; ++i) {
@@ -3,11 +3,16 @@
 //
 #include "util/coding/int_coder.h"
 
+#include <emmintrin.h>
+#include <algorithm>
+#include <cstring>
+
 #include "base/logging.h"
 #include "base/bits.h"
 #include "base/endian.h"
 #include "util/coding/bit_pack.h"
 #include "util/coding/fastpfor/fastpfor.h"
+#include "util/coding/stream_vbyte.h"
 #include "util/coding/varint.h"
 #include "util/sinksource.h"
 
@@ -38,7 +43,8 @@ inline uint32 LoadBigEndian(uint8 bc, const uint8* & next) {
 }
 
 namespace format {
-  enum EncodingType {REPEATED_ENC = 0, DELTA_ENC = 1, DIRECT_256 = 2, DIRECT_PFOR = 3};
+  enum EncodingType {REPEATED_ENC = 0, DELTA_ENC = 1, DIRECT_256 = 2, DIRECT_PFOR = 3,
+                     DIRECT_SIMD = 4, STREAM_VBYTE = 5};
 
   static constexpr uint32 kDeltaThreshold = 8;
   // REPEAT chunk related constants.
@@ -200,7 +206,30 @@ void UInt32Encoder::EncodeDirect(const uint32* start, const uint32* end, const u
     LittleEndian::Store32(dest, ints_written * sizeof(uint32));
     dest += ints_written*sizeof(uint32_t) + 4;
     CHECK_LE(dest - buffer_.data(), buffer_.size());
-    direct_overhead_ += 5;
+
+    // Prefer the SIMD layouts unless FastPFor managed to squeeze out exceptions.
+    // Stream VByte wins when the magnitudes vary a lot but not rarely enough for exceptions.
+    uint32 pfor_size = 5 + ints_written * sizeof(uint32);
+    uint32 simd_overhead = 1 + Varint::Length32(size);
+    uint32 simd_bytes = SimdPackedByteCount(size, bit_width);
+    uint32 svb_bytes = simd_layout_ ? StreamVByteEncodedSize(start, size) : 0;
+    if (simd_layout_ && svb_bytes < simd_bytes && simd_overhead + svb_bytes < pfor_size) {
+      buffer_.resize(prev_size + simd_overhead + StreamVByteMaxBytes(size));
+      dest = &buffer_.front() + prev_size;
+      *dest++ = format::STREAM_VBYTE;
+      dest = Varint::Encode32(dest, size);
+      dest = StreamVByteEncode(start, size, dest);
+      direct_overhead_ += simd_overhead;
+    } else if (simd_layout_ && simd_overhead + simd_bytes <= pfor_size) {
+      buffer_.resize(prev_size + simd_overhead + simd_bytes + BIT_PACK_MARGIN);
+      dest = &buffer_.front() + prev_size;
+      *dest++ = format::DIRECT_SIMD | ((bit_width - 1) << kHeaderTypeBits);
+      dest = Varint::Encode32(dest, size);
+      dest = SimdBitPack(start, size, bit_width, dest);
+      direct_overhead_ += simd_overhead;
+    } else {
+      direct_overhead_ += 5;
+    }
   }
   buffer_.resize(dest - buffer_.data());
   VLOG(1) << "FlushDirect: sz " << size << " bit_width: " << int(bit_width) << " bytesize: "
@@ -300,53 +329,152 @@ base::Status UInt64Encoder::SerializeTo(Sink* sink) const {
 }
 
 bool UInt32Decoder::Next(T* t) {
-  // Note - we could collapse those ifs into one single switch-case...
-  if (repeated_count_ > 0) {
-    --repeated_count_;
-    *t = UnrollDeltaIfNeeded(*tmp_buf_);
-    return true;
-  }
-  if (buf_size_ > consumed_in_buf_) {
-    *t = UnrollDeltaIfNeeded(tmp_buf_[consumed_in_buf_++]);
-    return true;
+  while (true) {
+    // Note - we could collapse those ifs into one single switch-case...
+    if (repeated_count_ > 0) {
+      --repeated_count_;
+      *t = UnrollDeltaIfNeeded(*tmp_buf_);
+      return true;
+    }
+    if (buf_size_ > consumed_in_buf_) {
+      *t = UnrollDeltaIfNeeded(tmp_buf_[consumed_in_buf_++]);
+      return true;
+    }
+    if (next_pfor_var_ < pfor_vec_.size()) {
+      *t = UnrollDeltaIfNeeded(pfor_vec_[next_pfor_var_++]);
+      if (next_pfor_var_ == pfor_vec_.size()) {
+        next_pfor_var_ = 0;
+        pfor_vec_.clear();
+      }
+      return true;
+    }
+    if (direct_count_ > 0) {
+      LoadDirectChunk();
+      continue;
+    }
+    if (!ReadHeader())
+      return false;
   }
-  if (next_pfor_var_ < pfor_vec_.size()) {
-    *t = UnrollDeltaIfNeeded(pfor_vec_[next_pfor_var_++]);
-    if (next_pfor_var_ == pfor_vec_.size()) {
-      next_pfor_var_ = 0;
-      pfor_vec_.clear();
+}
+
+size_t UInt32Decoder::DecodeBatch(T* dest, size_t count) {
+  T* const start = dest;
+  T* const end = dest + count;
+  while (dest != end) {
+    size_t left = end - dest;
+    if (repeated_count_ > 0) {
+      size_t cnt = std::min<size_t>(repeated_count_, left);
+      if (delta_cnt_ == 1) {
+        // Repeated delta is an arithmetic progression.
+        T val = delta_base_;
+        const T step = *tmp_buf_ * delta_sign_;
+        for (size_t i = 0; i < cnt; ++i) {
+          val += step;
+          dest[i] = val;
+        }
+        delta_base_ = val;
+      } else {
+        std::fill(dest, dest + cnt, *tmp_buf_);
+      }
+      repeated_count_ -= cnt;
+      dest += cnt;
+      continue;
+    }
+    if (buf_size_ > consumed_in_buf_) {
+      size_t cnt = std::min<size_t>(buf_size_ - consumed_in_buf_, left);
+      CopyUnrolled(tmp_buf_ + consumed_in_buf_, cnt, dest);
+      consumed_in_buf_ += cnt;
+      dest += cnt;
+      continue;
+    }
+    if (next_pfor_var_ < pfor_vec_.size()) {
+      size_t cnt = std::min<size_t>(pfor_vec_.size() - next_pfor_var_, left);
+      CopyUnrolled(pfor_vec_.data() + next_pfor_var_, cnt, dest);
+      next_pfor_var_ += cnt;
+      if (next_pfor_var_ == pfor_vec_.size()) {
+        next_pfor_var_ = 0;
+        pfor_vec_.clear();
+      }
+      dest += cnt;
+      continue;
+    }
+    if (direct_count_ > 0) {
+      // Any multiple of 8 integers ends on a byte boundary, so we can unpack them straight
+      // into dest. The remainder goes through tmp_buf_.
+      uint32 cnt = left >= direct_count_ ? direct_count_ : (left & ~size_t(7));
+      if (cnt == 0) {
+        LoadDirectChunk();
+        continue;
+      }
+      next_ = BitUnpack(next_, cnt, bit_width_, dest);
+      CopyUnrolled(dest, cnt, dest);
+      direct_count_ -= cnt;
+      dest += cnt;
+      continue;
     }
-    return true;
+    if (!ReadHeader())
+      break;
   }
-  if (direct_count_ > 0) {
-    buf_size_ = direct_count_ > 64 ? 64 : direct_count_;
-    consumed_in_buf_ = 1;
-    direct_count_ -= buf_size_;
-    next_ = BitUnpack(next_, buf_size_, bit_width_, tmp_buf_);
-    *t = UnrollDeltaIfNeeded(*tmp_buf_);
-    return true;
+  return dest - start;
+}
+
+// dest[i] = base + src[0] + ... + src[i]. Returns the last sum. src and dest may be the same.
+static uint32 PrefixSum(const uint32* src, size_t count, uint32 base, uint32* dest) {
+  size_t i = 0;
+  __m128i acc = _mm_set1_epi32(base);
+  for (; i + 4 <= count; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, acc);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), x);
+    acc = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  base = _mm_cvtsi128_si32(acc);
+  for (; i < count; ++i) {
+    base += src[i];
+    dest[i] = base;
+  }
+  return base;
+}
+
+void UInt32Decoder::CopyUnrolled(const T* src, size_t count, T* dest) {
+  if (delta_cnt_ != 1) {
+    if (src != dest)
+      memcpy(dest, src, count * sizeof(T));
+    return;
+  }
+  if (delta_sign_ > 0) {
+    delta_base_ = PrefixSum(src, count, delta_base_, dest);
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    dest[i] = UnrollDeltaIfNeeded(src[i]);
   }
+}
+
+bool UInt32Decoder::ReadHeader() {
   if (next_ == end_) return false;
   DCHECK(direct_count_ == 0 && repeated_count_ == 0);
-  // Reading the next header.
   uint8 header = *next_++;
   uint8 type = header & ((1 << kHeaderTypeBits) - 1);
   header >>= kHeaderTypeBits;
-  bit_width_ = 0;
+
+  // The delta state is kept only for the chunk that follows the delta header.
+  delta_cnt_ >>= 1;
   switch (type) {
     case format::REPEATED_ENC:
-      delta_cnt_ >>= 1;
       if (header < kExtRepCnt) {
-        repeated_count_ = header + format::kMinRepeatCnt - 1;
+        repeated_count_ = header + format::kMinRepeatCnt;
       } else {
         repeated_count_ = LoadBigEndian(header - kExtRepCnt, next_);
-        repeated_count_ += (format::kMinRepeatCnt + kExtRepCnt - 1);
+        repeated_count_ += (format::kMinRepeatCnt + kExtRepCnt);
       }
       VLOG(2) << "Reading repeated chunk with count " << repeated_count_;
       next_ = Varint::Parse(next_, tmp_buf_);
     break;
     case format::DELTA_ENC: {
-      DCHECK_LE(delta_cnt_, 1);
+      DCHECK_EQ(0, delta_cnt_);
       uint8 base_bc = header & 7;
       delta_sign_ = 1 - 2 * ((header >> 3) & 1); // 0 -> 1, 1 -> -1.
       delta_base_ = *next_++;
@@ -356,20 +484,20 @@ bool UInt32Decoder::Next(T* t) {
       }
       VLOG(2) << "Reading delta chunk with base " << delta_base_;
       delta_cnt_ = 2;
-      *t = delta_base_;
-      return true;
+
+      // The base itself is the next value.
+      *tmp_buf_ = delta_base_;
+      buf_size_ = 1;
+      consumed_in_buf_ = 0;
     }
+    break;
     case format::DIRECT_256:
-      delta_cnt_ >>= 1;
       bit_width_ = header + 1;
       direct_count_ = *next_++;
       ++direct_count_;
-      LoadFirstDirectChunk();
+      VLOG(1) << "Reading " << direct_count_ << " numbers with width " << int(bit_width_);
     break;
     case format::DIRECT_PFOR: {
-      // reset delta_cnt. This ensures that delta state is kept only
-      // once after going through delta header.
-      delta_cnt_ >>= 1;
       uint32 num_ints = LittleEndian::Load32(next_);
       next_ += 4;
       CHECK_EQ(0, num_ints % 4);
@@ -383,28 +511,42 @@ bool UInt32Decoder::Next(T* t) {
       FastPFor pfor;
       pfor.decodeArray(src, num_ints, &pfor_vec_.front(), uncompressed_size);
       CHECK_EQ(uncompressed_size, pfor_vec_.size());
-      next_pfor_var_ = 1;
-      *t = UnrollDeltaIfNeeded(pfor_vec_.front());
-      return true;
+      next_pfor_var_ = 0;
+    }
+    break;
+    case format::DIRECT_SIMD: {
+      // Like DIRECT_PFOR, the whole chunk is unpacked into pfor_vec_.
+      uint8 bit_width = header + 1;
+      uint32 count = 0;
+      next_ = Varint::Parse32(next_, &count);
+      VLOG(1) << "Reading " << count << " simd packed numbers with width " << int(bit_width);
+      pfor_vec_.resize(count);
+      next_ = SimdBitUnpack(next_, count, bit_width, &pfor_vec_.front());
+      next_pfor_var_ = 0;
+    }
+    break;
+    case format::STREAM_VBYTE: {
+      uint32 count = 0;
+      next_ = Varint::Parse32(next_, &count);
+      VLOG(1) << "Reading " << count << " stream vbyte numbers";
+      pfor_vec_.resize(count);
+      next_ = StreamVByteDecode(next_, count, &pfor_vec_.front());
+      next_pfor_var_ = 0;
     }
-  break;
-  default:
-    LOG(FATAL) << "Unknown header " << (header & 7);
+    break;
+    default:
+      LOG(FATAL) << "Unknown header " << int(type);
   }
-  *t = UnrollDeltaIfNeeded(*tmp_buf_);
   DCHECK_LE(next_, end_);
   return true;
 }
 
-void UInt32Decoder::LoadFirstDirectChunk() {
-  VLOG(1) << "Reading " << direct_count_ << " numbers with width " << int(bit_width_);
-
+void UInt32Decoder::LoadDirectChunk() {
   // We must read multiples of 8 numbers in order to decode full bytes.
-  // Since we store num numbers minus 1, we limit here til 63.
   buf_size_ = direct_count_ > BUF_SIZE ? BUF_SIZE : direct_count_;
   direct_count_ -= buf_size_;
   next_ = BitUnpack(next_, buf_size_, bit_width_, tmp_buf_);
-  consumed_in_buf_  = 1;
+  consumed_in_buf_ = 0;
 }
 
 UInt64Decoder::UInt64Decoder(const uint8* buffer, uint32 size) {
@@ -422,6 +564,23 @@ bool UInt64Decoder::Next(uint64* t) {
   return lo_.Next(ptr) && hi_.Next(ptr + 1);
 }
 
+size_t UInt64Decoder::DecodeBatch(uint64* dest, size_t count) {
+  constexpr size_t kBatchSize = 256;
+  uint32 lo[kBatchSize], hi[kBatchSize];
+  size_t res = 0;
+  while (res < count) {
+    size_t cnt = std::min(count - res, kBatchSize);
+    size_t decoded = hi_.DecodeBatch(hi, lo_.DecodeBatch(lo, cnt));
+    for (size_t i = 0; i < decoded; ++i) {
+      dest[res + i] = (uint64(hi[i]) << 32) | lo[i];
+    }
+    res += decoded;
+    if (decoded < cnt)
+      break;
+  }
+  return res;
+}
+
 inline constexpr bool is_power_2(uint32 u) { return ((u-1) & u) == 0; }
 inline bool fill_bit(uint32 v) { return ((v >> 30) & 1) == 1; }
 
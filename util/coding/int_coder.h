@@ -38,6 +38,17 @@ DIRECT_FPFOR - used for long integer sequences longer than 128 integers:
   1st byte- 3 bits for encoding type
   4 bytes - size of fpfor blob in bytes.
   Bpob - FPFOR blob
+DIRECT_SIMD - used for long integer sequences instead of DIRECT_FPFOR when it's not larger.
+  1st byte
+    3 bits for encoding type
+    5 bits for fixed bit width-1 of values in blob (32bits).
+  varint - number of integers.
+  Blob - integers packed with SimdBitPack (see bit_pack.h).
+STREAM_VBYTE - used for long integer sequences with varying magnitudes when it's smaller
+               than both DIRECT_SIMD and DIRECT_FPFOR.
+  1st byte- 3 bits for encoding type, 5 bits reserved.
+  varint - number of integers.
+  Blob - integers encoded with StreamVByteEncode (see stream_vbyte.h).
 DELTA (1byte+ preheader):
   3 bits for encoding type
   2 bits for base number length in bytes. (32bit)
@@ -73,6 +84,10 @@ public:
 
   void Swap(std::vector<uint8>* dest) { buffer_.swap(*dest); }
 
+  // Whether long direct sequences may use DIRECT_SIMD or STREAM_VBYTE. On by default.
+  // When off, the encoder produces the older format that does not know about them.
+  void set_simd_layout(bool b) { simd_layout_ = b; }
+
   size_t ByteSize() const { return buffer_.size(); }
   const std::vector<uint8>& buffer() const { return buffer_; }
   strings::Slice slice() const { return strings::Slice(buffer_.data(), buffer_.size()); }
@@ -112,6 +127,7 @@ private:
   uint32 repeated_overhead_ = 0;
   uint32 delta_overhead_ = 0;
   uint32 direct_overhead_ = 0;
+  bool simd_layout_ = true;
 };
 
 class UInt64Encoder {
@@ -123,6 +139,11 @@ public:
   base::Status SerializeTo(Sink* sink) const;
 
   uint32 ByteSize() const { return hi_.ByteSize() + lo_.ByteSize() + 4;}
+
+  void set_simd_layout(bool b) {
+    hi_.set_simd_layout(b);
+    lo_.set_simd_layout(b);
+  }
 private:
   UInt32Encoder hi_, lo_;
 };
@@ -134,6 +155,9 @@ public:
   void Restart() {
     next_ = start_;
     delta_sign_ = delta_cnt_ = direct_count_ = repeated_count_ = buf_size_ = 0;
+    consumed_in_buf_ = 0;
+    pfor_vec_.clear();
+    next_pfor_var_ = 0;
   }
 
   void Init(const uint8* buffer, uint32 size) {
@@ -149,6 +173,12 @@ public:
   UInt32Decoder()  {}
 
   bool Next(T* t);
+
+  // Decodes up to count integers into dest and returns the number of decoded integers.
+  // Returns less than count only at the end of the buffer. Can be interleaved with Next().
+  // Works chunk by chunk: repeated runs are filled, direct chunks are unpacked straight
+  // into dest and delta chunks are restored with a vectorized prefix sum.
+  size_t DecodeBatch(T* dest, size_t count);
 private:
   T UnrollDeltaIfNeeded(T b) {
     if (delta_cnt_ == 1) {
@@ -158,7 +188,13 @@ private:
     return b;
   }
 
-  void LoadFirstDirectChunk();
+  // Copies count integers from src to dest and unrolls the deltas if needed.
+  // src and dest may be the same.
+  void CopyUnrolled(const T* src, size_t count, T* dest);
+
+  // Reads the next chunk header. Returns false at the end of the buffer.
+  bool ReadHeader();
+  void LoadDirectChunk();
 
   static constexpr unsigned int BUF_SIZE = 64;
 
@@ -188,6 +224,9 @@ public:
   UInt64Decoder(strings::Slice slice) : UInt64Decoder(slice.data(), slice.size()) {}
 
   bool Next(uint64* t);
+
+  // Same as UInt32Decoder::DecodeBatch.
+  size_t DecodeBatch(uint64* dest, size_t count);
   typedef uint64 value_type;
 
 private:
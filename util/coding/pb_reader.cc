@@ -3,6 +3,7 @@
 //
 #include "util/coding/pb_reader.h"
 
+#include "strings/split.h"
 #include "strings/strcat.h"
 #include "util/coding/int_coder.h"
 #include "util/coding/varint.h"
@@ -22,6 +23,10 @@ inline Status RangeError(const char* str) {
   return Status(base::StatusCode::INTERNAL_ERROR, StrCat("Range error ", str));
 }
 
+inline Status InvalidArgument(const string& str) {
+  return Status(base::StatusCode::INVALID_ARGUMENT, str);
+}
+
 template<typename T> inline void ResetPtr(T* & ptr, T* new_ptr) {
   if (ptr) {
     delete ptr;
@@ -36,15 +41,69 @@ template<typename T> inline T DecodeZigZag(typename std::make_unsigned<T>::type
 template<typename Coder, typename T> inline Status FillRepeatedField(
     const gpb::Reflection* refl, const gpb::FieldDescriptor* fd,
     uint32 size, Coder* source, gpb::Message* msg) {
+  typedef typename Coder::value_type UT;
+  static_assert(sizeof(UT) == sizeof(T), "Coder does not match the field type");
+
   gpb::RepeatedField<T>* dest = refl->MutableRepeatedField<T>(msg, fd);
-  dest->Clear();
-  dest->Reserve(size);
-  typename Coder::value_type val = 0;
+  dest->Resize(size, 0);
+  UT* vals = reinterpret_cast<UT*>(dest->mutable_data());
+  if (source->DecodeBatch(vals, size) != size) {
+    dest->Clear();
+    return RangeError("Not enough repeated int");
+  }
   for (uint32 i = 0; i < size; ++i) {
-    if (!source->Next(&val)) {
-      return RangeError("Not enough repeated int");
-    }
-    dest->Add(DecodeZigZag<T>(val));
+    vals[i] = DecodeZigZag<T>(vals[i]);
+  }
+  return Status::OK;
+}
+
+// Returns the sign of v - c.
+template<typename T> inline int CompareInt(T v, int64 c) {
+  if (std::is_signed<T>::value) {
+    int64 sv = v;
+    return (sv > c) - (sv < c);
+  }
+  if (c < 0)
+    return 1;
+  uint64 uv = v, uc = c;
+  return (uv > uc) - (uv < uc);
+}
+
+inline bool Matches(PbBlockDeserializer::CompareOp op, int cmp) {
+  switch (op) {
+    case PbBlockDeserializer::EQ: return cmp == 0;
+    case PbBlockDeserializer::NE: return cmp != 0;
+    case PbBlockDeserializer::LT: return cmp < 0;
+    case PbBlockDeserializer::LE: return cmp <= 0;
+    case PbBlockDeserializer::GT: return cmp > 0;
+    case PbBlockDeserializer::GE: return cmp >= 0;
+  }
+  return false;
+}
+
+// rows are the indices of the messages that have the field, in column order.
+template<typename Decoder, typename T> Status FilterInts(
+    Slice data, const std::vector<uint32>& rows, PbBlockDeserializer::CompareOp op,
+    int64 value, std::vector<bool>* match) {
+  Decoder decoder(data.data(), data.size());
+  std::vector<typename Decoder::value_type> vals(rows.size());
+  if (decoder.DecodeBatch(vals.data(), vals.size()) != vals.size())
+    return RangeError("Not enough values to filter");
+  for (size_t i = 0; i < rows.size(); ++i) {
+    (*match)[rows[i]] = Matches(op, CompareInt(DecodeZigZag<T>(vals[i]), value));
+  }
+  return Status::OK;
+}
+
+Status AndSelection(const std::vector<bool>& match, std::vector<bool>* selection) {
+  if (selection->empty()) {
+    *selection = match;
+    return Status::OK;
+  }
+  if (selection->size() != match.size())
+    return InvalidArgument("Selection size does not match the number of messages");
+  for (size_t i = 0; i < match.size(); ++i) {
+    (*selection)[i] = (*selection)[i] && match[i];
   }
   return Status::OK;
 }
@@ -91,28 +150,36 @@ Status PbFieldReader::Init(const uint8* ptr, uint32 size) {
   VLOG(2) << "PbFieldReader::Init " << fd_->full_name() << ", size: " << size;
   const uint8* end = ptr + size;
   if (fd_->is_repeated() || fd_->is_optional()) {
-    auto res = InitMeta(ptr, end);
-    if (!res.ok()) return res.status;
-    ptr = res.obj;
+    RETURN_IF_ERROR(InitMeta(ptr, end));
+  } else {
+    data_ = Slice(ptr, size);
+  }
+  if (!selected_)
+    return Status::OK;
+
+  if (fd_->is_repeated()) {
+    ResetPtr(u1_.arr_sizes, new UInt32Decoder(meta_.data(), meta_.size()));
+  } else if (fd_->is_optional()) {
+    ResetPtr(u1_.has_bit, new BitArray(bit_count_, meta_));
+    has_iter_ = u1_.has_bit->begin();
   }
   if (fd_->cpp_type() == PBFD::CPPTYPE_MESSAGE) {
-    DCHECK_EQ(0, end - ptr);
+    DCHECK_EQ(0, data_.size());
     return Status::OK;
   }
-  uint32 data_sz2 = end-ptr;
   switch (fd_->cpp_type()) {
     case PBFD::CPPTYPE_STRING:
       ResetPtr(u2_.str_decoder, new StringDecoder());
-      RETURN_IF_ERROR(u2_.str_decoder->Init(Slice(ptr, data_sz2)));
+      RETURN_IF_ERROR(u2_.str_decoder->Init(data_));
     break;
     case PBFD::CPPTYPE_UINT32:
     case PBFD::CPPTYPE_INT32:
     case PBFD::CPPTYPE_ENUM:
-      ResetPtr(u2_.val_uint32, new UInt32Decoder(ptr, data_sz2));
+      ResetPtr(u2_.val_uint32, new UInt32Decoder(data_.data(), data_.size()));
     break;
     case PBFD::CPPTYPE_UINT64:
     case PBFD::CPPTYPE_INT64:
-      ResetPtr(u2_.val_uint64, new UInt64Decoder(ptr, data_sz2));
+      ResetPtr(u2_.val_uint64, new UInt64Decoder(data_.data(), data_.size()));
     break;
     default:
       LOG(FATAL) << "Not implemented " << fd_->cpp_type_name();
@@ -205,30 +272,75 @@ Status PbFieldReader::Read(gpb::Message* msg) {
   return Status::OK;
 }
 
-base::StatusObject<const uint8*> PbFieldReader::InitMeta(
-      const uint8* start, const uint8* end) {
+Status PbFieldReader::Skip() {
+  uint32 vals_count = 1;
+  if (fd_->is_repeated()) {
+    if (!u1_.arr_sizes->Next(&vals_count)) {
+      return RangeError("r5");
+    }
+  } else if (fd_->is_optional()) {
+    if (has_iter_.Done()) {
+      return RangeError("r6");
+    }
+    bool has = *has_iter_;
+    ++has_iter_;
+    if (!has)
+      return Status::OK;
+  }
+  for (uint32 i = 0; i < vals_count; ++i) {
+    switch (fd_->cpp_type()) {
+      case PBFD::CPPTYPE_STRING: {
+        Slice sl;
+        if (!u2_.str_decoder->Next(&sl))
+          return RangeError("Corrupt string");
+      }
+      break;
+      case PBFD::CPPTYPE_UINT32:
+      case PBFD::CPPTYPE_INT32:
+      case PBFD::CPPTYPE_ENUM: {
+        uint32 val;
+        if (!u2_.val_uint32->Next(&val))
+          return RangeError("uint32 finito");
+      }
+      break;
+      case PBFD::CPPTYPE_UINT64:
+      case PBFD::CPPTYPE_INT64: {
+        uint64 val;
+        if (!u2_.val_uint64->Next(&val))
+          return RangeError("uint64 finito");
+      }
+      break;
+      case PBFD::CPPTYPE_MESSAGE:
+        RETURN_IF_ERROR(submsg_reader_->Skip());
+      break;
+      default:
+        LOG(FATAL) << "Not implemented" << fd_->cpp_type_name();
+    }
+  }
+  return Status::OK;
+}
+
+Status PbFieldReader::InitMeta(const uint8* start, const uint8* end) {
   uint32 data_sz = 0;
   const uint8* next = Varint::Parse32WithLimit(start, end, &data_sz);
-  if (next == nullptr) {
+  if (next == nullptr || data_sz > end - next) {
     return RangeError("r1");
   }
   start = next + data_sz;
+  data_ = Slice(start, end - start);
   if (fd_->is_repeated()) {
-    ResetPtr(u1_.arr_sizes, new UInt32Decoder(next, data_sz));
-    return start;
+    meta_ = Slice(next, data_sz);
+    return Status::OK;
   }
-  uint32 bit_count = 0;
-  next = Varint::Parse32WithLimit(next, start, &bit_count);
+  next = Varint::Parse32WithLimit(next, start, &bit_count_);
   if (next == nullptr) {
     return RangeError("r2");
   }
-  strings::Slice bit_slice(next, start - next);
-  if (bit_slice.size() % sizeof(uint32) != 0) {
+  meta_ = Slice(next, start - next);
+  if (meta_.size() % sizeof(uint32) != 0) {
     return Status(base::StatusCode::INTERNAL_ERROR, "Invalid bit array size");
   }
-  ResetPtr(u1_.has_bit, new BitArray(bit_count, bit_slice));
-  has_iter_ = u1_.has_bit->begin();
-  return start;
+  return Status::OK;
 }
 
 PbFieldReaderArray::PbFieldReaderArray(const gpb::Descriptor* descr) {
@@ -246,15 +358,57 @@ PbFieldReaderArray::~PbFieldReaderArray() {
 
 Status PbFieldReaderArray::Read(gpb::Message* msg) {
   for (PbFieldReader* field : fields_) {
-    RETURN_IF_ERROR(field->Read(msg));
+    if (field->selected())
+      RETURN_IF_ERROR(field->Read(msg));
+  }
+  return Status::OK;
+}
+
+Status PbFieldReaderArray::Skip() {
+  for (PbFieldReader* field : fields_) {
+    if (field->selected())
+      RETURN_IF_ERROR(field->Skip());
   }
   return Status::OK;
 }
 
-PbBlockDeserializer::PbBlockDeserializer(const gpb::Descriptor* desc) : root_(desc) {
+PbBlockDeserializer::PbBlockDeserializer(const gpb::Descriptor* desc)
+    : desc_(desc), root_(desc) {
   root_.VisitPreOrder([this](PbFieldReader* r) { readers_.push_back(r); });
 }
 
+Status PbBlockDeserializer::ParsePath(StringPiece path, FieldPath* res) const {
+  res->clear();
+  const gpb::Descriptor* descr = desc_;
+  for (StringPiece name : strings::Split(path, ".")) {
+    const gpb::FieldDescriptor* fd =
+        descr ? descr->FindFieldByName(name.as_string()) : nullptr;
+    if (fd == nullptr)
+      return InvalidArgument(StrCat("Could not find field ", name, " in ", path));
+    res->push_back(fd);
+    descr = fd->message_type();
+  }
+  return Status::OK;
+}
+
+void PbBlockDeserializer::AddProjection(const FieldPath& path) {
+  CHECK(!path.empty());
+  if (!projected_) {
+    projected_ = true;
+    root_.VisitPreOrder([](PbFieldReader* r) { r->set_selected(false); });
+  }
+  PbFieldReaderArray* arr = &root_;
+  PbFieldReader* reader = nullptr;
+  for (const gpb::FieldDescriptor* fd : path) {
+    CHECK(arr != nullptr) << fd->full_name() << " is not a subfield";
+    reader = arr->field(fd->index());
+    CHECK_EQ(fd, reader->fd()) << "Invalid path at " << fd->full_name();
+    reader->set_selected(true);
+    arr = reader->submsg_reader();
+  }
+  reader->VisitPreOrder([](PbFieldReader* r) { r->set_selected(true); });
+}
+
 PbBlockDeserializer::~PbBlockDeserializer() {
 
 }
@@ -270,6 +424,7 @@ Status PbBlockDeserializer::Init(strings::Slice block, uint32* num_msgs) {
   if (!decoder.Next(num_msgs)) {
     return RangeError("num msgs");
   }
+  num_msgs_ = *num_msgs;
   next += field_sizes_arr_sz;
   uint32 size = 0;
   for (PbFieldReader* v : readers_) {
@@ -282,5 +437,103 @@ Status PbBlockDeserializer::Init(strings::Slice block, uint32* num_msgs) {
   return Status::OK;
 }
 
+Status PbBlockDeserializer::FilterLevels(const FieldPath& path,
+                                         std::vector<const PbFieldReader*>* levels) const {
+  if (path.empty())
+    return InvalidArgument("Empty path");
+  const PbFieldReaderArray* arr = &root_;
+  const gpb::Descriptor* descr = desc_;
+  for (const gpb::FieldDescriptor* fd : path) {
+    if (arr == nullptr || fd->containing_type() != descr)
+      return InvalidArgument(StrCat("Invalid path at ", fd->full_name()));
+    if (fd->is_repeated())
+      return InvalidArgument(StrCat("Can not filter on repeated field ", fd->full_name()));
+    const PbFieldReader* reader = arr->field(fd->index());
+    levels->push_back(reader);
+    arr = reader->submsg_reader();
+    descr = fd->message_type();
+  }
+  return Status::OK;
+}
+
+Status PbBlockDeserializer::PresentRows(const std::vector<const PbFieldReader*>& levels,
+                                        std::vector<uint32>* rows) const {
+  // A column of a subfield has entries only for the messages that have all its ancestors.
+  // Required fields are always there, so only the optional ones are checked, from the top.
+  std::vector<BitArray> has_bits;
+  has_bits.reserve(levels.size());  // the iterators point to the arrays.
+  std::vector<BitArray::Iterator> iters;
+  for (const PbFieldReader* reader : levels) {
+    if (reader->fd()->is_optional()) {
+      has_bits.push_back(reader->has_bits());
+      iters.push_back(has_bits.back().begin());
+    }
+  }
+  rows->reserve(num_msgs_);
+  for (uint32 row = 0; row < num_msgs_; ++row) {
+    bool present = true;
+    for (size_t j = 0; j < iters.size() && present; ++j) {
+      if (iters[j].Done())
+        return RangeError("has bits");
+      present = *iters[j];
+      ++iters[j];
+    }
+    if (present)
+      rows->push_back(row);
+  }
+  return Status::OK;
+}
+
+Status PbBlockDeserializer::Filter(const FieldPath& path, CompareOp op, int64 value,
+                                   std::vector<bool>* selection) const {
+  std::vector<const PbFieldReader*> levels;
+  RETURN_IF_ERROR(FilterLevels(path, &levels));
+  std::vector<uint32> rows;
+  RETURN_IF_ERROR(PresentRows(levels, &rows));
+
+  std::vector<bool> match(num_msgs_, false);
+  Slice data = levels.back()->data();
+  Status st;
+  switch (path.back()->cpp_type()) {
+    case PBFD::CPPTYPE_INT32:
+      st = FilterInts<UInt32Decoder, int32>(data, rows, op, value, &match);
+    break;
+    case PBFD::CPPTYPE_UINT32:
+      st = FilterInts<UInt32Decoder, uint32>(data, rows, op, value, &match);
+    break;
+    case PBFD::CPPTYPE_INT64:
+      st = FilterInts<UInt64Decoder, int64>(data, rows, op, value, &match);
+    break;
+    case PBFD::CPPTYPE_UINT64:
+      st = FilterInts<UInt64Decoder, uint64>(data, rows, op, value, &match);
+    break;
+    default:
+      return InvalidArgument(StrCat(path.back()->full_name(), " is not an integer field"));
+  }
+  RETURN_IF_ERROR(st);
+  return AndSelection(match, selection);
+}
+
+Status PbBlockDeserializer::Filter(const FieldPath& path, CompareOp op, StringPiece value,
+                                   std::vector<bool>* selection) const {
+  std::vector<const PbFieldReader*> levels;
+  RETURN_IF_ERROR(FilterLevels(path, &levels));
+  if (path.back()->cpp_type() != PBFD::CPPTYPE_STRING)
+    return InvalidArgument(StrCat(path.back()->full_name(), " is not a string field"));
+  std::vector<uint32> rows;
+  RETURN_IF_ERROR(PresentRows(levels, &rows));
+
+  std::vector<bool> match(num_msgs_, false);
+  StringDecoder decoder;
+  RETURN_IF_ERROR(decoder.Init(levels.back()->data()));
+  Slice sl;
+  for (uint32 row : rows) {
+    if (!decoder.Next(&sl))
+      return RangeError("Corrupt string");
+    match[row] = Matches(op, StringPiece(sl.charptr(), sl.size()).compare(value));
+  }
+  return AndSelection(match, selection);
+}
+
 }  // namespace coding
 }  // namespace util
\ No newline at end of file
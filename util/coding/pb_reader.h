@@ -5,7 +5,9 @@
 #define _UTIL_CODING_PB_READER_H
 
 #include <memory>
+#include <vector>
 #include "strings/slice.h"
+#include "strings/stringpiece.h"
 #include "util/coding/int_coder.h"
 #include "util/coding/string_coder.h"
 #include "base/status.h"
@@ -13,6 +15,7 @@
 namespace google {
 namespace protobuf {
 class Descriptor;
+class FieldDescriptor;
 class Message;
 }  // namespace protobuf
 }  // namespace google
@@ -29,14 +32,37 @@ public:
   ~PbFieldReader();
 
   void VisitPreOrder(std::function<void(PbFieldReader*)> cb);
+
+  // Decoders are created only for selected fields. The column boundaries are kept for
+  // all of them.
   base::Status Init(const uint8* ptr, uint32 size);
 
   base::Status Read(gpb::Message* msg);
 
+  // Advances past the values of a single message without materializing them.
+  base::Status Skip();
+
+  const gpb::FieldDescriptor* fd() const { return fd_; }
+  PbFieldReaderArray* submsg_reader() const { return submsg_reader_.get(); }
+
+  // Unselected fields are not decoded and are left unset by Read().
+  bool selected() const { return selected_; }
+  void set_selected(bool b) { selected_ = b; }
+
+  // The encoded column, valid after Init(). has_bits() is independent of Read() and
+  // is defined only for optional fields. data() is the column without the has bits or the
+  // array sizes.
+  BitArray has_bits() const { return BitArray(bit_count_, meta_); }
+  strings::Slice data() const { return data_; }
+
 private:
-  base::StatusObject<const uint8*> InitMeta(const uint8* start, const uint8* end);
+  // Splits the column into meta_ and data_.
+  base::Status InitMeta(const uint8* start, const uint8* end);
 
   const gpb::FieldDescriptor* fd_;
+  bool selected_ = true;
+  strings::Slice meta_, data_;
+  uint32 bit_count_ = 0;
   union {
     UInt32Decoder* arr_sizes;
     BitArray* has_bit;
@@ -58,6 +84,10 @@ public:
   ~PbFieldReaderArray();
 
   base::Status Read(gpb::Message* msg);
+  base::Status Skip();
+
+  // index is the field index in its message descriptor.
+  PbFieldReader* field(int index) const { return fields_[index]; }
 
   void VisitPreOrder(std::function<void(PbFieldReader*)> cb) {
     for (PbFieldReader* v : fields_)
@@ -65,18 +95,70 @@ public:
   }
 };
 
+/*
+ Reads the blocks written by PbBlockSerializer.
+ Usage:
+   PbBlockDeserializer reader(descriptor);
+   reader.AddProjection(path);  // optional, read only some of the fields.
+   reader.Init(block, &num_msgs);
+   std::vector<bool> selection;  // optional, filter on the encoded columns.
+   reader.Filter(path2, PbBlockDeserializer::GE, 100, &selection);
+   for (uint32 i = 0; i < num_msgs; ++i) {
+     if (selection[i]) reader.Read(&msg); else reader.Skip();
+   }
+*/
 class PbBlockDeserializer {
 public:
+  // A chain of fields from the root message, like pprint::FdPath::path().
+  typedef std::vector<const gpb::FieldDescriptor*> FieldPath;
+
+  enum CompareOp {EQ, NE, LT, LE, GT, GE};
+
   explicit PbBlockDeserializer(const gpb::Descriptor* desc);
   ~PbBlockDeserializer();
 
+  // Parses dot separated field names, for example "account.bank_name".
+  base::Status ParsePath(StringPiece path, FieldPath* res) const;
+
+  // Restricts Read() to the given field and its subfields. Can be called several times to
+  // read the union of the paths. Must be called before Init(). Columns outside of
+  // the projection are never decompressed or decoded and their fields are left unset.
+  void AddProjection(const FieldPath& path);
+
   base::Status Init(strings::Slice block, uint32* num_msgs);
   base::Status Read(gpb::Message* msg) {
     return root_.Read(msg);
   }
+
+  // Advances past the next message without materializing it.
+  base::Status Skip() {
+    return root_.Skip();
+  }
+
+  // Evaluates "field op value" on the encoded column of every message in the block and
+  // ANDs the result into selection. An empty selection is treated as all true, otherwise
+  // it must have num_msgs entries. The field does not have to be in the projection and
+  // evaluation does not affect Read(). Unset fields do not match any predicate.
+  // The path can not contain repeated fields. Integer fields are compared with the int64
+  // overload, string fields with the StringPiece one.
+  base::Status Filter(const FieldPath& path, CompareOp op, int64 value,
+                      std::vector<bool>* selection) const;
+  base::Status Filter(const FieldPath& path, CompareOp op, StringPiece value,
+                      std::vector<bool>* selection) const;
 private:
+  // Finds the readers along the path. Returns an error if the path has repeated fields.
+  base::Status FilterLevels(const FieldPath& path,
+                            std::vector<const PbFieldReader*>* levels) const;
+
+  // Computes indices of the messages that have the last field of the path.
+  base::Status PresentRows(const std::vector<const PbFieldReader*>& levels,
+                           std::vector<uint32>* rows) const;
+
+  const gpb::Descriptor* desc_;
   PbFieldReaderArray root_;
   std::vector<PbFieldReader*> readers_;
+  uint32 num_msgs_ = 0;
+  bool projected_ = false;
 };
 
 }  // namespace coding
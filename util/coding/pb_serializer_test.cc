@@ -7,6 +7,8 @@
 #include "base/gtest.h"
 #include "file/file.h"
 #include "strings/numbers.h"
+#include "strings/strcat.h"
+#include "util/executor.h"
 #include "util/plang/addressbook.pb.h"
 #include "util/sinksource.h"
 
@@ -85,5 +87,131 @@ TEST_F(PbSerializerTest, Basic) {
   }
 }
 
+TEST_F(PbSerializerTest, Parallel) {
+  AddressBook book;
+  for (int j = 0; j < 30; ++j) {
+    Person* p = book.add_person();
+    p->set_id(1234567891234ULL + j * 7);
+    p->set_name(StrCat("name", j));
+    if (j % 3)
+      p->set_email(StrCat("user", j * j, "@alba.com"));
+    for (int k = 0; k < j % 5; ++k) {
+      p->add_phone()->set_number(IntToString(j * 1000 + k));
+    }
+    p->mutable_account()->set_bank_name(StrCat("bank", j % 4));
+    p->mutable_account()->add_activity_id(j * 173);
+    book.add_ts(int64(j) << 35);
+    book.add_tmp(j * 1000003);
+  }
+  PbBlockSerializer serial(AddressBook::descriptor()), parallel(AddressBook::descriptor());
+  Executor executor(4);
+  parallel.set_executor(&executor);
+  for (int j = 0; j < 300; ++j) {
+    book.mutable_person(j % 30)->set_id(j);
+    serial.Add(book);
+    parallel.Add(book);
+  }
+  StringSink serial_sink, parallel_sink;
+  ASSERT_TRUE(serial.SerializeTo(&serial_sink).ok());
+  ASSERT_TRUE(parallel.SerializeTo(&parallel_sink).ok());
+  EXPECT_EQ(serial_sink.contents(), parallel_sink.contents());
+  executor.Shutdown();
+}
+
+static Person MakePerson(int j) {
+  Person p;
+  p.set_id(1000 - j * 3);
+  p.set_name(StrCat("name", j % 10));
+  if (j % 3)
+    p.set_email(StrCat("user", j % 7, "@alba.com"));
+  if (j % 4) {
+    BankAccount* account = p.mutable_account();
+    if (j % 5)
+      account->set_bank_name(StrCat("bank", j % 2));
+    account->add_activity_id(j);
+  }
+  for (int k = 0; k < j % 3; ++k) {
+    p.add_phone()->set_number(IntToString(k));
+  }
+  return p;
+}
+
+TEST_F(PbSerializerTest, Projection) {
+  PbBlockSerializer writer(Person::descriptor());
+  for (int j = 0; j < 100; ++j) {
+    writer.Add(MakePerson(j));
+  }
+  StringSink ssink;
+  ASSERT_TRUE(writer.SerializeTo(&ssink).ok());
+
+  PbBlockDeserializer reader(Person::descriptor());
+  PbBlockDeserializer::FieldPath path;
+  ASSERT_TRUE(reader.ParsePath("account.bank_name", &path).ok());
+  reader.AddProjection(path);
+  ASSERT_TRUE(reader.ParsePath("email", &path).ok());
+  reader.AddProjection(path);
+  EXPECT_FALSE(reader.ParsePath("account.foo", &path).ok());
+
+  uint32 num_msgs = 0;
+  ASSERT_TRUE(reader.Init(ssink.contents(), &num_msgs).ok());
+  ASSERT_EQ(100, num_msgs);
+  for (int j = 0; j < 100; ++j) {
+    Person expected = MakePerson(j), actual;
+    expected.clear_id();
+    expected.clear_name();
+    expected.clear_phone();
+    if (expected.has_account())
+      expected.mutable_account()->clear_activity_id();
+    ASSERT_TRUE(reader.Read(&actual).ok());
+
+    // The required fields are not projected, hence we can not serialize the messages.
+    EXPECT_EQ(expected.ShortDebugString(), actual.ShortDebugString());
+  }
+}
+
+TEST_F(PbSerializerTest, Filter) {
+  PbBlockSerializer writer(Person::descriptor());
+  constexpr int kNumMsgs = 300;
+  for (int j = 0; j < kNumMsgs; ++j) {
+    writer.Add(MakePerson(j));
+  }
+  StringSink ssink;
+  ASSERT_TRUE(writer.SerializeTo(&ssink).ok());
+
+  PbBlockDeserializer reader(Person::descriptor());
+  PbBlockDeserializer::FieldPath id, email, bank, phone;
+  ASSERT_TRUE(reader.ParsePath("id", &id).ok());
+  ASSERT_TRUE(reader.ParsePath("email", &email).ok());
+  ASSERT_TRUE(reader.ParsePath("account.bank_name", &bank).ok());
+  ASSERT_TRUE(reader.ParsePath("phone.number", &phone).ok());
+  uint32 num_msgs = 0;
+  ASSERT_TRUE(reader.Init(ssink.contents(), &num_msgs).ok());
+
+  std::vector<bool> selection;
+  ASSERT_TRUE(reader.Filter(id, PbBlockDeserializer::LT, 500, &selection).ok());
+  ASSERT_EQ(kNumMsgs, selection.size());
+  ASSERT_TRUE(reader.Filter(email, PbBlockDeserializer::NE, "user3@alba.com", &selection).ok());
+  ASSERT_TRUE(reader.Filter(bank, PbBlockDeserializer::EQ, "bank1", &selection).ok());
+  EXPECT_FALSE(reader.Filter(phone, PbBlockDeserializer::EQ, "1", &selection).ok());
+  EXPECT_FALSE(reader.Filter(email, PbBlockDeserializer::EQ, 1, &selection).ok());
+
+  unsigned num_selected = 0;
+  for (int j = 0; j < kNumMsgs; ++j) {
+    Person p = MakePerson(j);
+    bool expected = p.id() < 500 && p.has_email() && p.email() != "user3@alba.com" &&
+                    p.account().has_bank_name() && p.account().bank_name() == "bank1";
+    ASSERT_EQ(expected, selection[j]) << j;
+    if (selection[j]) {
+      Person actual;
+      ASSERT_TRUE(reader.Read(&actual).ok());
+      EXPECT_THAT(actual, EqualProto(p));
+      ++num_selected;
+    } else {
+      ASSERT_TRUE(reader.Skip().ok());
+    }
+  }
+  EXPECT_LT(0, num_selected);
+}
+
 }  // namespace coding
 }  // namespace util
@@ -3,9 +3,14 @@
 //
 #include "util/coding/pb_writer.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
 #include "strings/strcat.h"
 #include "strings/stringprintf.h"
 #include "util/coding/varint.h"
+#include "util/executor.h"
 #include "util/sinksource.h"
 
 namespace util {
@@ -284,11 +289,49 @@ void PbBlockSerializer::Add(const gpb::Message& msg) {
   root_fields_.Add(msg);
 }
 
+void PbBlockSerializer::FinalizeParallel() {
+  // Shared with the pool tasks. Some of them may start only after all the columns were
+  // finalized by the others, therefore they must not reference the serializer.
+  struct State {
+    std::vector<PbFieldWriter*> fields;
+    std::atomic<size_t> next{0};
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t finished = 0;  // Guarded by mu.
+
+    void Run() {
+      for (size_t i = next++; i < fields.size(); i = next++) {
+        fields[i]->Finalize();
+        std::lock_guard<std::mutex> lock(mu);
+        if (++finished == fields.size())
+          cv.notify_one();
+      }
+    }
+  };
+  auto state = std::make_shared<State>();
+  state->fields = all_fields_;
+
+  // The calling thread works as well, so we do not depend on the pool making progress.
+  // A task that finds no columns left exits immediately, hence we do not need to know
+  // the pool size.
+  for (size_t i = 1; i < all_fields_.size(); ++i) {
+    executor_->Add([state] { state->Run(); });
+  }
+  state->Run();
+
+  std::unique_lock<std::mutex> lock(state->mu);
+  state->cv.wait(lock, [&state] { return state->finished == state->fields.size(); });
+}
+
 Status PbBlockSerializer::SerializeTo(Sink* sink) {
   if (!was_finalized_) {
     was_finalized_ = true;
-    for (PbFieldWriter* fw : all_fields_) {
-      fw->Finalize();
+    if (executor_) {
+      FinalizeParallel();
+    } else {
+      for (PbFieldWriter* fw : all_fields_) {
+        fw->Finalize();
+      }
     }
   }
 
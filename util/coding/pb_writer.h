@@ -20,6 +20,7 @@ class Message;
 
 namespace util {
 
+class Executor;
 class Sink;
 
 namespace coding {
@@ -91,8 +92,11 @@ class PbBlockSerializer {
   const gpb::Descriptor* desc_;
   PbFieldWriterArray root_fields_;
   std::vector<PbFieldWriter*> all_fields_;
+  Executor* executor_ = nullptr;
   uint32 size_ = 0;
   bool was_finalized_ = false;
+
+  void FinalizeParallel();
 public:
   explicit PbBlockSerializer(const gpb::Descriptor* desc);
   ~PbBlockSerializer();
@@ -100,6 +104,12 @@ public:
   void Add(const gpb::Message& msg);
   Status SerializeTo(Sink* sink);
 
+  // If set, SerializeTo() finalizes the columns (encodes integers and compresses strings)
+  // on the executor's pool threads and the calling thread. The columns are still written
+  // in the same order, so the output is identical to the serial one.
+  // The executor must outlive SerializeTo() calls.
+  void set_executor(Executor* executor) { executor_ = executor; }
+
   // Number of messages addes so far.
   uint32 NumEntries() const { return size_; }
 
@@ -0,0 +1,177 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/coding/stream_vbyte.h"
+
+#include <tmmintrin.h>
+#include <string.h>
+
+#include "base/endian.h"
+#include "base/logging.h"
+
+namespace util {
+namespace coding {
+
+namespace {
+
+inline uint32 ZigZagEncode(uint32 v) {
+  return (v << 1) ^ uint32(int32(v) >> 31);
+}
+
+inline uint32 ZigZagDecode(uint32 v) {
+  return (v >> 1) ^ -(v & 1);
+}
+
+// Byte length - 1.
+inline uint8 LengthCode(uint32 v) {
+  return (v > 0xFF) + (v > 0xFFFF) + (v > 0xFFFFFF);
+}
+
+// Lookup tables indexed by a control byte.
+struct Tables {
+  // The data length of the group.
+  uint8 length[256];
+
+  // pshufb masks that spread the group bytes into four 32-bit lanes.
+  alignas(16) uint8 shuffle[256][16];
+
+  Tables() {
+    for (unsigned c = 0; c < 256; ++c) {
+      uint8 pos = 0;
+      for (unsigned lane = 0; lane < 4; ++lane) {
+        unsigned len = ((c >> (2 * lane)) & 3) + 1;
+        for (unsigned j = 0; j < 4; ++j) {
+          shuffle[c][lane * 4 + j] = j < len ? pos++ : 0x80;  // 0x80 zeroes the byte.
+        }
+      }
+      length[c] = pos;
+    }
+  }
+};
+
+const Tables& GetTables() {
+  static const Tables tables;
+  return tables;
+}
+
+template<bool kDelta> uint8* Encode(const uint32* src, uint32 count, uint32 prev, uint8* dest) {
+  uint8* ctrl = dest;
+  uint8* data = dest + StreamVByteControlBytes(count);
+  memset(ctrl, 0, StreamVByteControlBytes(count));
+  for (uint32 i = 0; i < count; ++i) {
+    uint32 v = src[i];
+    if (kDelta) {
+      uint32 delta = v - prev;
+      prev = v;
+      v = ZigZagEncode(delta);
+    }
+    uint8 code = LengthCode(v);
+    ctrl[i / 4] |= code << (2 * (i % 4));
+
+    // The first i integers took at most 4 * i bytes, so there is room for the full store.
+    LittleEndian::Store32(data, v);
+    data += code + 1;
+  }
+  return data;
+}
+
+template<bool kDelta> const uint8* DecodeScalar(const uint8* ctrl, uint32 count, uint32 prev,
+                                                const uint8* data, uint32* dest) {
+  for (uint32 i = 0; i < count; ++i) {
+    uint8 code = (ctrl[i / 4] >> (2 * (i % 4))) & 3;
+    uint32 v = 0;
+    for (int j = code; j >= 0; --j) {
+      v = (v << 8) | data[j];
+    }
+    data += code + 1;
+    if (kDelta) {
+      prev += ZigZagDecode(v);
+      v = prev;
+    }
+    dest[i] = v;
+  }
+  return data;
+}
+
+template<bool kDelta> __attribute__((target("ssse3")))
+const uint8* DecodeSsse3(const uint8* src, uint32 count, uint32 prev, uint32* dest) {
+  const Tables& tables = GetTables();
+  const uint8* data = src + StreamVByteControlBytes(count);
+  uint32 groups = count / 4;
+
+  // A group takes at least 4 bytes, therefore a 16 byte load is safe while at least 4 groups
+  // are left.
+  uint32 simd_groups = groups > 3 ? groups - 3 : 0;
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i prev_v = _mm_set1_epi32(prev);
+  for (uint32 g = 0; g < simd_groups; ++g) {
+    uint8 c = src[g];
+    __m128i shuf = _mm_load_si128(reinterpret_cast<const __m128i*>(tables.shuffle[c]));
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), shuf);
+    data += tables.length[c];
+    if (kDelta) {
+      v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+                        _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+      v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+      v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+      v = _mm_add_epi32(v, prev_v);
+      prev_v = _mm_shuffle_epi32(v, 0xFF);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + g * 4), v);
+  }
+  uint32 done = simd_groups * 4;
+  if (kDelta && done)
+    prev = dest[done - 1];
+  return DecodeScalar<kDelta>(src + simd_groups, count - done, prev, data, dest + done);
+}
+
+}  // namespace
+
+namespace stream_vbyte_internal {
+
+bool HasSsse3() {
+  static const bool res = __builtin_cpu_supports("ssse3");
+  return res;
+}
+
+const uint8* Decode(const uint8* src, uint32 count, bool delta, uint32 prev, bool ssse3,
+                    uint32* dest) {
+  if (ssse3) {
+    return delta ? DecodeSsse3<true>(src, count, prev, dest) :
+                   DecodeSsse3<false>(src, count, prev, dest);
+  }
+  const uint8* data = src + StreamVByteControlBytes(count);
+  return delta ? DecodeScalar<true>(src, count, prev, data, dest) :
+                 DecodeScalar<false>(src, count, prev, data, dest);
+}
+
+}  // namespace stream_vbyte_internal
+
+using stream_vbyte_internal::HasSsse3;
+
+uint32 StreamVByteEncodedSize(const uint32* src, uint32 count) {
+  uint32 res = StreamVByteControlBytes(count) + count;
+  for (uint32 i = 0; i < count; ++i) {
+    res += LengthCode(src[i]);
+  }
+  return res;
+}
+
+uint8* StreamVByteEncode(const uint32* src, uint32 count, uint8* dest) {
+  return Encode<false>(src, count, 0, dest);
+}
+
+const uint8* StreamVByteDecode(const uint8* src, uint32 count, uint32* dest) {
+  return stream_vbyte_internal::Decode(src, count, false, 0, HasSsse3(), dest);
+}
+
+uint8* StreamVByteEncodeDelta(const uint32* src, uint32 count, uint32 prev, uint8* dest) {
+  return Encode<true>(src, count, prev, dest);
+}
+
+const uint8* StreamVByteDecodeDelta(const uint8* src, uint32 count, uint32 prev, uint32* dest) {
+  return stream_vbyte_internal::Decode(src, count, true, prev, HasSsse3(), dest);
+}
+
+}  // namespace coding
+}  // namespace util
@@ -0,0 +1,56 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#ifndef _UTIL_CODING_STREAM_VBYTE_H
+#define _UTIL_CODING_STREAM_VBYTE_H
+
+#include "base/integral_types.h"
+
+namespace util {
+namespace coding {
+
+// Stream VByte: byte oriented integer codec with the control bits kept apart from the data.
+// See "Stream VByte: Faster Byte-Oriented Integer Compression" by Lemire, Kurz and Rupp.
+// The encoded blob starts with (count + 3) / 4 control bytes followed by the data bytes.
+// Each control byte holds four 2-bit codes, the lowest bits for the first integer of its group.
+// The code is the byte length - 1 of the integer, which is stored little endian in the data
+// stream. Unlike Varint, the lengths of 4 integers are known from a single control byte,
+// hence a whole group is decoded with one table lookup and a byte shuffle.
+// The decoder uses SSSE3 when the cpu supports it and falls back to scalar code otherwise.
+
+inline uint32 StreamVByteControlBytes(uint32 count) { return (count + 3) / 4; }
+
+// The buffer size required by the encoders.
+inline uint32 StreamVByteMaxBytes(uint32 count) {
+  return StreamVByteControlBytes(count) + count * 4;
+}
+
+// Returns the exact encoded size without encoding anything.
+uint32 StreamVByteEncodedSize(const uint32* src, uint32 count);
+
+// dest must have StreamVByteMaxBytes(count) bytes. Returns the end of the encoded blob.
+uint8* StreamVByteEncode(const uint32* src, uint32 count, uint8* dest);
+
+// Returns the end of the encoded blob. Does not read past it.
+const uint8* StreamVByteDecode(const uint8* src, uint32 count, uint32* dest);
+
+// Delta variants: src[i] - src[i - 1] is encoded as a zigzagged signed integer, with src[-1]
+// being prev. Suitable for sorted or slowly changing sequences in both directions.
+uint8* StreamVByteEncodeDelta(const uint32* src, uint32 count, uint32 prev, uint8* dest);
+const uint8* StreamVByteDecodeDelta(const uint8* src, uint32 count, uint32 prev, uint32* dest);
+
+namespace stream_vbyte_internal {
+
+bool HasSsse3();
+
+// Decodes with the SSSE3 kernel if ssse3 is true or with the scalar code otherwise.
+// Exposed for testing.
+const uint8* Decode(const uint8* src, uint32 count, bool delta, uint32 prev, bool ssse3,
+                    uint32* dest);
+
+}  // namespace stream_vbyte_internal
+
+}  // namespace coding
+}  // namespace util
+
+#endif  // _UTIL_CODING_STREAM_VBYTE_H
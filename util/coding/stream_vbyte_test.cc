@@ -0,0 +1,206 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/coding/stream_vbyte.h"
+
+#include <algorithm>
+#include <gmock/gmock.h>
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/random.h"
+#include "util/coding/bit_pack.h"
+#include "util/coding/fastpfor/fastpfor.h"
+#include "util/coding/varint.h"
+
+using testing::ElementsAreArray;
+using std::vector;
+
+namespace util {
+namespace coding {
+
+// Integers of all magnitudes, which is where stream vbyte beats fixed width packing.
+static vector<uint32> SkewedValues(uint32 count) {
+  MTRandom rand(10);
+  vector<uint32> vals(count);
+  for (uint32& v : vals)
+    v = rand.Skewed(31);
+  return vals;
+}
+
+class StreamVByteTest : public testing::Test {
+protected:
+  void TestEncoding(const vector<uint32>& vals) {
+    vector<uint8> buf(StreamVByteMaxBytes(vals.size()));
+    uint8* next = StreamVByteEncode(vals.data(), vals.size(), buf.data());
+    ASSERT_EQ(StreamVByteEncodedSize(vals.data(), vals.size()), next - buf.data());
+
+    // Decode from an exactly sized copy so that reading past the blob is caught by asan.
+    vector<uint8> blob(buf.data(), next);
+    for (bool ssse3 : {false, true}) {
+      if (ssse3 && !stream_vbyte_internal::HasSsse3())
+        continue;
+      vector<uint32> decoded(vals.size());
+      const uint8* end = stream_vbyte_internal::Decode(blob.data(), vals.size(), false, 0, ssse3,
+                                                       decoded.data());
+      EXPECT_EQ(blob.data() + blob.size(), end);
+      EXPECT_THAT(decoded, ElementsAreArray(vals)) << ssse3;
+    }
+  }
+
+  void TestDeltaEncoding(const vector<uint32>& vals, uint32 prev) {
+    vector<uint8> buf(StreamVByteMaxBytes(vals.size()));
+    uint8* next = StreamVByteEncodeDelta(vals.data(), vals.size(), prev, buf.data());
+    vector<uint8> blob(buf.data(), next);
+    for (bool ssse3 : {false, true}) {
+      if (ssse3 && !stream_vbyte_internal::HasSsse3())
+        continue;
+      vector<uint32> decoded(vals.size());
+      const uint8* end = stream_vbyte_internal::Decode(blob.data(), vals.size(), true, prev,
+                                                       ssse3, decoded.data());
+      EXPECT_EQ(blob.data() + blob.size(), end);
+      EXPECT_THAT(decoded, ElementsAreArray(vals)) << ssse3;
+    }
+  }
+};
+
+TEST_F(StreamVByteTest, Basic) {
+  vector<uint32> vals{1, 300, 70000, 1 << 25};
+  uint8 buf[32];
+  uint8* next = StreamVByteEncode(vals.data(), vals.size(), buf);
+  ASSERT_EQ(1 + 1 + 2 + 3 + 4, next - buf);
+  EXPECT_EQ(0 | (1 << 2) | (2 << 4) | (3 << 6), buf[0]);
+  EXPECT_EQ(1, buf[1]);
+  EXPECT_EQ(300 & 0xFF, buf[2]);
+  EXPECT_EQ(300 >> 8, buf[3]);
+
+  TestEncoding(vals);
+  TestEncoding({});
+  TestEncoding({0});
+  TestEncoding({kuint32max, 0, kuint32max, 255, 256});
+}
+
+TEST_F(StreamVByteTest, Long) {
+  for (uint32 count : {15, 16, 17, 100, 1001, 4096}) {
+    TestEncoding(SkewedValues(count));
+    TestEncoding(vector<uint32>(count, 5));
+    TestEncoding(vector<uint32>(count, kuint32max));
+  }
+}
+
+TEST_F(StreamVByteTest, Delta) {
+  vector<uint32> vals;
+  for (uint32 i = 0; i < 1000; ++i)
+    vals.push_back(i * i);
+  TestDeltaEncoding(vals, 0);
+  TestDeltaEncoding(vals, 17);
+
+  // Decreasing values produce negative deltas.
+  std::reverse(vals.begin(), vals.end());
+  TestDeltaEncoding(vals, 0);
+  TestDeltaEncoding(SkewedValues(333), 5);
+
+  vector<uint8> buf(StreamVByteMaxBytes(vals.size()));
+  uint8* next = StreamVByteEncodeDelta(vals.data(), vals.size(), vals[0], buf.data());
+  uint8* next2 = StreamVByteEncode(vals.data(), vals.size(), buf.data());
+  EXPECT_LT(next - buf.data(), next2 - buf.data());
+}
+
+DECLARE_BENCHMARK_FUNC(BM_StreamVByteEncode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(StreamVByteMaxBytes(iters));
+  StartBenchmarkTiming();
+  base::sink_result(StreamVByteEncode(vals.data(), vals.size(), buf.data()));
+}
+
+DECLARE_BENCHMARK_FUNC(BM_StreamVByteDecode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(StreamVByteMaxBytes(iters));
+  StreamVByteEncode(vals.data(), vals.size(), buf.data());
+  StartBenchmarkTiming();
+  base::sink_result(StreamVByteDecode(buf.data(), vals.size(), vals.data()));
+}
+
+DECLARE_BENCHMARK_FUNC(BM_StreamVByteDecodeScalar, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(StreamVByteMaxBytes(iters));
+  StreamVByteEncode(vals.data(), vals.size(), buf.data());
+  StartBenchmarkTiming();
+  base::sink_result(stream_vbyte_internal::Decode(buf.data(), vals.size(), false, 0, false,
+                                                  vals.data()));
+}
+
+DECLARE_BENCHMARK_FUNC(BM_StreamVByteDecodeDelta, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals(iters);
+  for (uint32 i = 0; i < iters; ++i)
+    vals[i] = i * 7 + (i % 17);
+  vector<uint8> buf(StreamVByteMaxBytes(iters));
+  StreamVByteEncodeDelta(vals.data(), vals.size(), 0, buf.data());
+  StartBenchmarkTiming();
+  base::sink_result(StreamVByteDecodeDelta(buf.data(), vals.size(), 0, vals.data()));
+}
+
+// The existing encodings on the same data.
+DECLARE_BENCHMARK_FUNC(BM_VarintEncode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(iters * Varint::kMax32);
+  StartBenchmarkTiming();
+  uint8* dest = buf.data();
+  for (uint32 v : vals)
+    dest = Varint::Encode32(dest, v);
+  base::sink_result(dest);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_VarintDecode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(iters * Varint::kMax32);
+  uint8* dest = buf.data();
+  for (uint32 v : vals)
+    dest = Varint::Encode32(dest, v);
+  StartBenchmarkTiming();
+  const uint8* src = buf.data();
+  for (uint32& v : vals)
+    src = Varint::Parse32Inline(src, &v);
+  base::sink_result(src);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_FastPForEncode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues((iters + 127) / 128 * 128);
+  FastPFor pfor;
+  size_t out_size = pfor.maxCompressedLength(vals.size());
+  vector<uint32> buf(out_size);
+  StartBenchmarkTiming();
+  pfor.encodeArray(vals.data(), vals.size(), buf.data(), out_size);
+  base::sink_result(out_size);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_FastPForDecode, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues((iters + 127) / 128 * 128);
+  FastPFor pfor;
+  size_t out_size = pfor.maxCompressedLength(vals.size());
+  vector<uint32> buf(out_size);
+  pfor.encodeArray(vals.data(), vals.size(), buf.data(), out_size);
+  StartBenchmarkTiming();
+  size_t num_vals = vals.size();
+  pfor.decodeArray(buf.data(), out_size, vals.data(), num_vals);
+  base::sink_result(num_vals);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_SimdBitUnpackSkewed, iters) {
+  StopBenchmarkTiming();
+  vector<uint32> vals = SkewedValues(iters);
+  vector<uint8> buf(SimdPackedByteCount(iters, 32) + BIT_PACK_MARGIN);
+  SimdBitPack(vals.data(), vals.size(), 32, buf.data());
+  StartBenchmarkTiming();
+  base::sink_result(SimdBitUnpack(buf.data(), vals.size(), 32, vals.data()));
+}
+
+}  // namespace coding
+}  // namespace util
@@ -21,6 +21,21 @@ inline uint32_t Value(const uint8_t* data, size_t n) {
   return Extend(0, data, n);
 }
 
+namespace internal {
+
+// Implementations behind Extend(). Exposed for tests and benchmarks.
+uint32_t ExtendPortable(uint32_t init_crc, const uint8_t* data, size_t n);
+
+// Returns true if the cpu supports SSE4.2 crc32 instruction.
+bool IsSse42Supported();
+
+// Both require IsSse42Supported(). ExtendSse42Interleaved runs 3 independent crc streams
+// on large buffers.
+uint32_t ExtendSse42(uint32_t init_crc, const uint8_t* data, size_t n);
+uint32_t ExtendSse42Interleaved(uint32_t init_crc, const uint8_t* data, size_t n);
+
+}  // namespace internal
+
 static const uint32_t kMaskDelta = 0xa282ead8ul;
 
 // Return a masked representation of crc.
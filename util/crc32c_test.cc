@@ -4,9 +4,12 @@
 
 #include "util/crc32c.h"
 
+#include <vector>
+#include "base/gtest.h"
 #include "base/integral_types.h"
+#include "base/logging.h"
+#include "base/random.h"
 #include "strings/stringpiece.h"
-#include <gtest/gtest.h>
 
 namespace util {
 namespace crc32c {
@@ -71,5 +74,63 @@ TEST(CRC, Mask) {
   ASSERT_EQ(crc, Unmask(Unmask(Mask(Mask(crc)))));
 }
 
+static constexpr size_t kLongBufSize = 1 << 18;
+
+TEST(CRC, Implementations) {
+  if (!internal::IsSse42Supported()) {
+    LOG(INFO) << "Skipping, SSE4.2 is not supported";
+    return;
+  }
+  MTRandom rnd(10);
+  std::vector<uint8> buf(kLongBufSize);
+  for (auto& v : buf) {
+    v = rnd.Rand8();
+  }
+  // Cover unaligned starts, tails and the thresholds of the interleaved loops.
+  const size_t kSizes[] = {0, 1, 7, 8, 9, 63, 64, 255, 767, 768, 769, 1000, 8192, 24575, 24576,
+                           24577, 30000, 100000, kLongBufSize - 3};
+  for (size_t sz : kSizes) {
+    for (size_t offset = 0; offset < 3; ++offset) {
+      const uint8* ptr = buf.data() + offset;
+      uint32_t expected = internal::ExtendPortable(0, ptr, sz);
+      EXPECT_EQ(expected, internal::ExtendSse42(0, ptr, sz)) << sz << " " << offset;
+      EXPECT_EQ(expected, internal::ExtendSse42Interleaved(0, ptr, sz)) << sz << " " << offset;
+      EXPECT_EQ(expected, Value(ptr, sz));
+
+      uint32_t init = 0x12345678;
+      expected = internal::ExtendPortable(init, ptr, sz);
+      EXPECT_EQ(expected, internal::ExtendSse42Interleaved(init, ptr, sz)) << sz;
+    }
+  }
+}
+
+typedef uint32_t (*ExtendFunc)(uint32_t, const uint8_t*, size_t);
+
+static void BM_Extend(uint32 iters, ExtendFunc func, size_t len) {
+  StopBenchmarkTiming();
+  if (func != internal::ExtendPortable && !internal::IsSse42Supported())
+    return;
+  std::vector<uint8> buf(len, 'x');
+  StartBenchmarkTiming();
+  uint32_t crc = 0;
+  for (uint32 i = 0; i < iters; ++i) {
+    crc = func(crc, buf.data(), len);
+  }
+  base::sink_result(crc);
+}
+
+#define DEFINE_CRC_BENCHMARKS(name, func) \
+  DECLARE_BENCHMARK_FUNC(BM_##name##_64, iters) { BM_Extend(iters, func, 64); } \
+  DECLARE_BENCHMARK_FUNC(BM_##name##_1K, iters) { BM_Extend(iters, func, 1 << 10); } \
+  DECLARE_BENCHMARK_FUNC(BM_##name##_16K, iters) { BM_Extend(iters, func, 1 << 14); } \
+  DECLARE_BENCHMARK_FUNC(BM_##name##_64K, iters) { BM_Extend(iters, func, 1 << 16); } \
+  DECLARE_BENCHMARK_FUNC(BM_##name##_1M, iters) { BM_Extend(iters, func, 1 << 20); }
+
+DEFINE_CRC_BENCHMARKS(Portable, internal::ExtendPortable)
+DEFINE_CRC_BENCHMARKS(Sse42, internal::ExtendSse42)
+DEFINE_CRC_BENCHMARKS(Sse42Interleaved, internal::ExtendSse42Interleaved)
+
+#undef DEFINE_CRC_BENCHMARKS
+
 }  // namespace crc32c
 }  // namespace util
\ No newline at end of file
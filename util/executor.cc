@@ -4,13 +4,20 @@
 #include "util/executor.h"
 
 #include <atomic>
+#include <deque>
 #include <event2/event.h>
 #include <event2/thread.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <mutex>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
 
 #include "base/logging.h"
-#include "base/sync_queue.h"
 #include "util/proc_stats.h"
 
 #define PTHREAD_CALL(x) \
@@ -21,6 +28,12 @@
 
 static constexpr int kThreadStackSize = 65536;
 
+// Number of empty scheduling rounds before an idle worker parks.
+static constexpr unsigned kSpinRounds = 16;
+
+// Maximal number of tasks a worker moves from the shared queue into its own deque at once.
+static constexpr size_t kMaxGlobalBatch = 32;
+
 namespace util {
 
 static pthread_once_t eventlib_init_once = PTHREAD_ONCE_INIT;
@@ -30,6 +43,16 @@ static void InitExecutorModule() {
   CHECK_EQ(0, evthread_use_pthreads());
 }
 
+static void FutexWait(std::atomic<uint32>* addr, uint32 val) {
+  syscall(SYS_futex, reinterpret_cast<uint32*>(addr), FUTEX_WAIT_PRIVATE, val, nullptr,
+          nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32>* addr, int count) {
+  syscall(SYS_futex, reinterpret_cast<uint32*>(addr), FUTEX_WAKE_PRIVATE, count, nullptr,
+          nullptr, 0);
+}
+
 static void ExecutorSigHandler(int sig, siginfo_t *info, void *secret) {
   LOG(INFO) << "Catched signal " << sig << ": " << strsignal(sig);
   if (signal_executor_instance) {
@@ -37,15 +60,118 @@ static void ExecutorSigHandler(int sig, siginfo_t *info, void *secret) {
   }
 }
 
+// Chase-Lev work-stealing deque of fixed capacity. The owner thread pushes and pops at the
+// bottom; other threads steal from the top. Push fails when the deque is full and
+// the caller falls back to the shared queue.
+class TaskDeque {
+ public:
+  typedef std::function<void()> Task;
+
+  TaskDeque() {
+    for (auto& slot : buf_) slot.store(nullptr, std::memory_order_relaxed);
+  }
+
+  ~TaskDeque() {
+    while (Task* t = Pop()) delete t;
+  }
+
+  // Called only by the owner.
+  bool Push(Task* task) {
+    int64 b = bottom_.load(std::memory_order_relaxed);
+    int64 t = top_.load(std::memory_order_acquire);
+    if (b - t >= kCapacity)
+      return false;
+    buf_[b & kMask].store(task, std::memory_order_relaxed);
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Called only by the owner. Returns the most recently pushed task.
+  Task* Pop() {
+    int64 b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task* task = buf_[b & kMask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // Last element - race with the thieves.
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        task = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Called by any thread. Returns the oldest task or nullptr if the deque is empty or
+  // the race for the task was lost.
+  Task* Steal() {
+    int64 t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 b = bottom_.load(std::memory_order_acquire);
+    if (t >= b)
+      return nullptr;
+    Task* task = buf_[t & kMask].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return task;
+  }
+
+  bool empty() const {
+    return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr int64 kCapacity = 1024;
+  static constexpr int64 kMask = kCapacity - 1;
+
+  // Keep the indices on separate cache lines - top_ is written by thieves.
+  std::atomic<int64> top_{0};
+  char pad_[64 - sizeof(std::atomic<int64>)];
+  std::atomic<int64> bottom_{0};
+  std::atomic<Task*> buf_[kCapacity];
+};
+
 class Executor::Rep {
-  event_base* base_ = nullptr;
+  typedef TaskDeque::Task Task;
+
+  struct Worker {
+    Rep* rep;
+    unsigned index;
+    pthread_t thread;
+    TaskDeque deque;
+  };
+
+  // Each event loop runs on its own thread. loops_[0] is the main loop.
+  struct EventLoop {
+    Rep* rep;
+    event_base* base;
+    pthread_t thread;
+  };
+  std::vector<EventLoop> loops_;
+
+  // Tasks submitted from outside of the pool threads or when the local deque is full.
+  std::mutex global_mu_;
+  std::deque<Task*> global_queue_;
+  std::atomic<size_t> global_size_{0};
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Idle workers sleep on park_epoch_ with futex. Producers bump the epoch after
+  // publishing a task and wake a sleeper only if there is one.
+  std::atomic<uint32> park_epoch_{0};
+  std::atomic<uint32> num_parked_{0};
 
-  base::sync_queue<std::function<void()>> tasks_queue_;
-  std::vector<pthread_t> pool_threads_;
-  pthread_t event_loop_thread_;
   pthread_cond_t shut_down_cond_ = PTHREAD_COND_INITIALIZER;
   pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
-  bool shut_down_;
+  unsigned loops_finished_count_;  // number of event loops that exited.
 
   std::atomic_bool start_cancel_;  // signals worker threads that they should stop running.
   uint32 poolthreads_finished_count_;  // number of worker threads that finished their run.
@@ -53,42 +179,82 @@ class Executor::Rep {
   // signals each time a worker thread finished.
   pthread_cond_t finished_pool_threads_ = PTHREAD_COND_INITIALIZER;
 
+  // The worker running on the current thread, if any.
+  static __thread Worker* current_worker_;
+
   static void* RunEventBase(void* me);
   static void* RunPoolThread(void* me);
+
+  Task* PopGlobal(Worker* worker);
+  Task* StealFromOthers(Worker* worker, uint32* seed);
+  bool HasWork() const;
+  void Park();
+  void WakeOne();
+
 public:
-  Rep() {
-    shut_down_ = false;
+  explicit Rep(unsigned num_loops) : loops_(num_loops) {
+    CHECK_GT(num_loops, 0);
+    loops_finished_count_ = 0;
     start_cancel_ = false;
     poolthreads_finished_count_ = 0;
 
-    base_ = CHECK_NOTNULL(event_base_new());
     pthread_attr_t attrs;
     PTHREAD_CALL(attr_init(&attrs));
     PTHREAD_CALL(attr_setstacksize(&attrs, kThreadStackSize));
-    PTHREAD_CALL(create(&event_loop_thread_, &attrs,  Executor::Rep::RunEventBase, this));
-    PTHREAD_CALL(setname_np(event_loop_thread_, "EventBaseThd"));
+    char buf[30] = {0};
+    for (unsigned i = 0; i < num_loops; ++i) {
+      EventLoop& loop = loops_[i];
+      loop.rep = this;
+      loop.base = CHECK_NOTNULL(event_base_new());
+    }
+    for (unsigned i = 0; i < num_loops; ++i) {
+      EventLoop& loop = loops_[i];
+      PTHREAD_CALL(create(&loop.thread, &attrs,  Executor::Rep::RunEventBase, &loop));
+      if (i == 0) {
+        PTHREAD_CALL(setname_np(loop.thread, "EventBaseThd"));
+      } else {
+        sprintf(buf, "EventBaseThd_%d", i);
+        PTHREAD_CALL(setname_np(loop.thread, buf));
+      }
+    }
     PTHREAD_CALL(attr_destroy(&attrs));
   }
 
   ~Rep() {
     StartCancel();
     WaitShutdown();
-    event_base_free(base_);
+    for (EventLoop& loop : loops_) {
+      event_base_free(loop.base);
+    }
+    for (Task* t : global_queue_) delete t;
   }
 
-  event_base* base() { return base_; }
+  event_base* base(unsigned index) {
+    DCHECK_LT(index, loops_.size());
+    return loops_[index].base;
+  }
+
+  unsigned num_loops() const { return loops_.size(); }
 
   void StartCancel() {
     start_cancel_ = true;
-    event_base_loopexit(base_, NULL); // signal to exit.
+    for (EventLoop& loop : loops_) {
+      event_base_loopexit(loop.base, NULL); // signal to exit.
+    }
+    park_epoch_.fetch_add(1);
+    FutexWake(&park_epoch_, INT_MAX);
   }
 
   bool was_cancelled() const { return start_cancel_; }
 
   void SetupThreadPool(unsigned num_threads) {
-    CHECK(pool_threads_.empty());
+    CHECK(workers_.empty());
     CHECK_GT(num_threads, 0);
-    pool_threads_.resize(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      workers_.emplace_back(new Worker);
+      workers_.back()->rep = this;
+      workers_.back()->index = i;
+    }
 
     char buf[30] = {0};
     pthread_attr_t attrs;
@@ -96,9 +262,10 @@ public:
     PTHREAD_CALL(attr_setstacksize(&attrs, kThreadStackSize));
 
     for (unsigned i = 0; i < num_threads; ++i) {
-      PTHREAD_CALL(create(&pool_threads_[i],  &attrs,  Executor::Rep::RunPoolThread, this));
+      Worker* w = workers_[i].get();
+      PTHREAD_CALL(create(&w->thread,  &attrs,  Executor::Rep::RunPoolThread, w));
       sprintf(buf, "ExecPool_%d", i);
-      PTHREAD_CALL(setname_np(pool_threads_[i], buf));
+      PTHREAD_CALL(setname_np(w->thread, buf));
     }
     PTHREAD_CALL(attr_destroy(&attrs));
   }
@@ -107,11 +274,11 @@ public:
     PTHREAD_CALL(mutex_lock(&mutex_));
     // We do not use pthread_join because it can not be used from multiple threads.
     // Here we allow the flexibility for several threads to wait for the loop to exit.
-    while (!shut_down_) {
+    while (loops_finished_count_ < loops_.size()) {
       PTHREAD_CALL(cond_wait(&shut_down_cond_, &mutex_));
     }
 
-    while (poolthreads_finished_count_ < pool_threads_.size()) {
+    while (poolthreads_finished_count_ < workers_.size()) {
       PTHREAD_CALL(cond_wait(&finished_pool_threads_, &mutex_));
     }
     PTHREAD_CALL(mutex_unlock(&mutex_));
@@ -120,21 +287,94 @@ public:
   void Add(std::function<void()> f) {
     if (was_cancelled())
       return;
-    tasks_queue_.push(f);
+    Task* task = new Task(std::move(f));
+    Worker* worker = current_worker_;
+    if (worker == nullptr || worker->rep != this || !worker->deque.Push(task)) {
+      std::lock_guard<std::mutex> lock(global_mu_);
+      global_queue_.push_back(task);
+      global_size_.fetch_add(1, std::memory_order_release);
+    }
+    WakeOne();
   }
 };
 
-void* Executor::Rep::RunEventBase(void* arg) {
-  Executor::Rep* me = (Executor::Rep*)arg;
+__thread Executor::Rep::Worker* Executor::Rep::current_worker_ = nullptr;
+
+// Takes a task from the shared queue and moves a fair share of the remaining ones
+// to the worker's deque, so that the shared lock is not taken for every task.
+auto Executor::Rep::PopGlobal(Worker* worker) -> Task* {
+  if (global_size_.load(std::memory_order_acquire) == 0)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(global_mu_);
+  if (global_queue_.empty())
+    return nullptr;
+  Task* res = global_queue_.front();
+  global_queue_.pop_front();
+  size_t batch = std::min<size_t>(global_queue_.size() / workers_.size(), kMaxGlobalBatch);
+  for (size_t i = 0; i < batch; ++i) {
+    if (!worker->deque.Push(global_queue_.front()))
+      break;
+    global_queue_.pop_front();
+  }
+  global_size_.store(global_queue_.size(), std::memory_order_release);
+  return res;
+}
+
+auto Executor::Rep::StealFromOthers(Worker* worker, uint32* seed) -> Task* {
+  const unsigned num = workers_.size();
+  *seed = *seed * 1103515245 + 12345;
+  unsigned start = (*seed >> 16) % num;
+  for (unsigned i = 0; i < num; ++i) {
+    Worker* victim = workers_[(start + i) % num].get();
+    if (victim == worker)
+      continue;
+    Task* task = victim->deque.Steal();
+    if (task)
+      return task;
+  }
+  return nullptr;
+}
 
-  int res;
-  while ((res = event_base_dispatch(me->base_)) == 1) {
-    pthread_yield();
+bool Executor::Rep::HasWork() const {
+  if (global_size_.load(std::memory_order_seq_cst) > 0)
+    return true;
+  for (const auto& w : workers_) {
+    if (!w->deque.empty())
+      return true;
   }
+  return false;
+}
+
+void Executor::Rep::Park() {
+  uint32 epoch = park_epoch_.load(std::memory_order_seq_cst);
+  num_parked_.fetch_add(1, std::memory_order_seq_cst);
+
+  // Re-check after announcing ourselves: a producer that did not see us parked must have
+  // published its task before our check.
+  if (!HasWork() && !start_cancel_) {
+    FutexWait(&park_epoch_, epoch);
+  }
+  num_parked_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Executor::Rep::WakeOne() {
+  park_epoch_.fetch_add(1, std::memory_order_seq_cst);
+  if (num_parked_.load(std::memory_order_seq_cst) > 0) {
+    FutexWake(&park_epoch_, 1);
+  }
+}
+
+void* Executor::Rep::RunEventBase(void* arg) {
+  EventLoop* loop = (EventLoop*)arg;
+  Executor::Rep* me = loop->rep;
+
+  // Secondary loops may have no events for a long time. EVLOOP_NO_EXIT_ON_EMPTY keeps
+  // the loop sleeping in the backend instead of returning until StartCancel() asks it to exit.
+  int res = event_base_loop(loop->base, EVLOOP_NO_EXIT_ON_EMPTY);
 
   VLOG(1) << "Finished running event_base_dispatch with res: " << res;
   PTHREAD_CALL(mutex_lock(&me->mutex_));
-  me->shut_down_ = true;
+  ++me->loops_finished_count_;
   PTHREAD_CALL(cond_broadcast(&me->shut_down_cond_));
   PTHREAD_CALL(mutex_unlock(&me->mutex_));
 
@@ -142,15 +382,37 @@ void* Executor::Rep::RunEventBase(void* arg) {
 }
 
 void* Executor::Rep::RunPoolThread(void* arg) {
-  Executor::Rep* me = (Executor::Rep*)arg;
+  Worker* worker = (Worker*)arg;
+  Executor::Rep* me = worker->rep;
+  current_worker_ = worker;
+  uint32 seed = worker->index + 1;
+  unsigned idle_rounds = 0;
+
   while (!me->start_cancel_) {
-    std::function<void()> val;
-    bool res = me->tasks_queue_.pop(5, &val);
-    if (res) val();
+    Task* task = worker->deque.Pop();
+    if (task == nullptr)
+      task = me->PopGlobal(worker);
+    if (task == nullptr)
+      task = me->StealFromOthers(worker, &seed);
+    if (task) {
+      idle_rounds = 0;
+      (*task)();
+      delete task;
+      continue;
+    }
+    // Spin a little before going to sleep - tasks often come in bursts.
+    if (++idle_rounds < kSpinRounds) {
+      sched_yield();
+    } else {
+      me->Park();
+      idle_rounds = 0;
+    }
   }
+  current_worker_ = nullptr;
+
   char buf[30] = {0};
   pthread_getname_np(pthread_self(), buf, sizeof buf);
-  VLOG(1) << "Finished running ThreadPool thread " << buf << " with " << me->tasks_queue_.size();
+  VLOG(1) << "Finished running ThreadPool thread " << buf;
   PTHREAD_CALL(mutex_lock(&me->mutex_));
   ++me->poolthreads_finished_count_;
   PTHREAD_CALL(cond_broadcast(&me->finished_pool_threads_));
@@ -160,9 +422,9 @@ void* Executor::Rep::RunPoolThread(void* arg) {
 }
 
 
-Executor::Executor(unsigned int num_threads) {
+Executor::Executor(unsigned int num_threads, unsigned int num_event_loops) {
   pthread_once(&eventlib_init_once, InitExecutorModule);
-  rep_.reset(new Rep());
+  rep_.reset(new Rep(num_event_loops));
 
   if (num_threads == 0) {
     uint32 num_cpus = sys::NumCPUs();
@@ -179,7 +441,15 @@ Executor::~Executor() {
 }
 
 event_base* Executor::ebase() {
-  return rep_->base();
+  return rep_->base(0);
+}
+
+event_base* Executor::ebase(unsigned index) {
+  return rep_->base(index);
+}
+
+unsigned Executor::num_event_loops() const {
+  return rep_->num_loops();
 }
 
 
@@ -4,6 +4,7 @@
 #ifndef _EXECUTOR_H
 #define _EXECUTOR_H
 
+#include <functional>
 #include <memory>
 
 struct event_base;
@@ -17,11 +18,24 @@ class Executor {
 public:
   // if num_threads is 0, then Executor will choose number of threads automatically
   // based on the number of cpus in the system.
-  explicit Executor(unsigned int num_threads = 0);
+  // num_event_loops is the number of event_base loops, each running on its own thread.
+  explicit Executor(unsigned int num_threads = 0, unsigned int num_event_loops = 1);
   ~Executor();
 
+  // Returns the main event loop.
   event_base* ebase();
 
+  // Returns the event loop with the given index, index < num_event_loops().
+  // Network code can spread its sockets across loops to use more than one core for I/O.
+  event_base* ebase(unsigned index);
+
+  unsigned num_event_loops() const;
+
+  // Schedules f to run on one of the pool threads. Each pool thread has its own deque and
+  // idle threads steal from the others. When called from a pool thread of this executor,
+  // f is pushed onto the caller's deque and is likely to run on the same thread (LIFO),
+  // which keeps the data of recursively spawned tasks in cache.
+  // Tasks added from other threads go to a shared queue.
   void Add(std::function<void()> f);
 
   // Async function that tells Executor to shut down all its worker threads and its event loop.
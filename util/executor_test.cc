@@ -2,9 +2,15 @@
 // Author: Roman Gershman (romange@gmail.com)
 //
 #include "util/executor.h"
+#include <algorithm>
 #include <atomic>
+#include <event2/event.h>
+#include <mutex>
 #include <thread>
-#include <gtest/gtest.h>
+#include <vector>
+#include "base/gtest.h"
+#include "base/histogram.h"
+#include "base/logging.h"
 
 namespace util {
 
@@ -37,4 +43,173 @@ TEST_F(ExecutorTest, ManyExecutors) {
   }
 }
 
+struct LoopThreads {
+  std::mutex mu;
+  std::vector<pthread_t> threads;
+
+  static void Record(int, short, void* arg) {
+    LoopThreads* me = static_cast<LoopThreads*>(arg);
+    std::lock_guard<std::mutex> lock(me->mu);
+    me->threads.push_back(pthread_self());
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mu);
+    return threads.size();
+  }
+};
+
+TEST_F(ExecutorTest, EventLoops) {
+  Executor executor(2, 3);
+  ASSERT_EQ(3, executor.num_event_loops());
+  EXPECT_EQ(executor.ebase(), executor.ebase(0));
+
+  // Each loop runs its callbacks on its own thread.
+  LoopThreads lt;
+  for (unsigned i = 0; i < 3; ++i) {
+    ASSERT_EQ(0, event_base_once(executor.ebase(i), -1, EV_TIMEOUT, LoopThreads::Record, &lt,
+                                 nullptr));
+  }
+  while (lt.size() < 3) {
+    std::this_thread::yield();
+  }
+  std::sort(lt.threads.begin(), lt.threads.end());
+  EXPECT_TRUE(std::unique(lt.threads.begin(), lt.threads.end()) == lt.threads.end());
+
+  executor.Shutdown();
+  executor.WaitForLoopToExit();
+}
+
+// Spawns a binary tree of tasks from within the pool threads.
+static void Spawn(Executor* executor, unsigned depth, std::atomic_long* count) {
+  count->fetch_add(1);
+  if (depth == 0)
+    return;
+  for (int i = 0; i < 2; ++i) {
+    executor->Add([executor, depth, count] { Spawn(executor, depth - 1, count); });
+  }
+}
+
+static void WaitForCount(const std::atomic_long& count, long expected) {
+  while (count.load() < expected) {
+    std::this_thread::yield();
+  }
+}
+
+TEST_F(ExecutorTest, LocalSubmit) {
+  Executor executor(4);
+  std::atomic_long count(0);
+  const unsigned kDepth = 14;
+  executor.Add([&] { Spawn(&executor, kDepth, &count); });
+  WaitForCount(count, (1 << (kDepth + 1)) - 1);
+
+  // Workers park after the burst and wake up for new work.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (int i = 0; i < 100; ++i) {
+    executor.Add([&count] { count.fetch_add(1); });
+  }
+  WaitForCount(count, (1 << (kDepth + 1)) - 1 + 100);
+  executor.Shutdown();
+  executor.WaitForLoopToExit();
+}
+
+TEST_F(ExecutorTest, ManyProducers) {
+  Executor executor(3);
+  std::atomic_long count(0);
+  std::vector<std::thread> producers;
+  for (int i = 0; i < 4; ++i) {
+    producers.emplace_back([&] {
+      for (int j = 0; j < 10000; ++j) {
+        executor.Add([&count] { count.fetch_add(1); });
+      }
+    });
+  }
+  for (auto& t : producers) t.join();
+  WaitForCount(count, 40000);
+  executor.Shutdown();
+  executor.WaitForLoopToExit();
+}
+
+static uint64 MonotonicMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Submits iters tasks from an external thread. Reports the submit-to-start latency
+// percentiles in microseconds.
+static void BM_ExternalSubmit(uint32 iters, unsigned num_threads) {
+  StopBenchmarkTiming();
+  Executor executor(num_threads);
+  std::atomic_long count(0);
+  std::vector<uint64> latency(iters);
+  StartBenchmarkTiming();
+  for (uint32 i = 0; i < iters; ++i) {
+    uint64 start = MonotonicMicros();
+    executor.Add([&count, &latency, i, start] {
+      latency[i] = MonotonicMicros() - start;
+      count.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  WaitForCount(count, iters);
+  StopBenchmarkTiming();
+
+  if (iters >= 10000) {
+    base::Histogram hist;
+    for (uint64 v : latency) hist.Add(v);
+    LOG(INFO) << num_threads << " threads, " << iters << " tasks, latency usec p50: "
+              << hist.Percentile(50) << " p99: " << hist.Percentile(99)
+              << " p99.9: " << hist.Percentile(99.9) << " max: " << hist.max();
+  }
+  executor.Shutdown();
+  executor.WaitForLoopToExit();
+}
+
+// iters tasks spawned recursively from within the pool threads.
+static void BM_LocalSpawn(uint32 iters, unsigned num_threads) {
+  StopBenchmarkTiming();
+  Executor executor(num_threads);
+  std::atomic_long count(0);
+  unsigned depth = 0;
+  while ((2u << depth) - 1 < iters) ++depth;
+  StartBenchmarkTiming();
+  executor.Add([&] { Spawn(&executor, depth, &count); });
+  WaitForCount(count, (2 << depth) - 1);
+  StopBenchmarkTiming();
+  executor.Shutdown();
+  executor.WaitForLoopToExit();
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ExternalSubmit_1Thread, iters) {
+  BM_ExternalSubmit(iters, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ExternalSubmit_2Threads, iters) {
+  BM_ExternalSubmit(iters, 2);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ExternalSubmit_4Threads, iters) {
+  BM_ExternalSubmit(iters, 4);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ExternalSubmit_8Threads, iters) {
+  BM_ExternalSubmit(iters, 8);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_LocalSpawn_1Thread, iters) {
+  BM_LocalSpawn(iters, 1);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_LocalSpawn_2Threads, iters) {
+  BM_LocalSpawn(iters, 2);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_LocalSpawn_4Threads, iters) {
+  BM_LocalSpawn(iters, 4);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_LocalSpawn_8Threads, iters) {
+  BM_LocalSpawn(iters, 8);
+}
+
 }  // namespace util
\ No newline at end of file
@@ -0,0 +1,256 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/json/json_index.h"
+
+#include <immintrin.h>
+#include <string.h>
+#include <algorithm>
+
+#include "base/bits.h"
+#include "base/logging.h"
+#include "base/port.h"
+
+namespace util {
+
+namespace {
+
+constexpr unsigned kBlockSize = 64;
+
+// Number of blocks classified in a single call.
+constexpr unsigned kBatchSize = 16;
+
+// Bit i of each mask corresponds to byte i of the block.
+// op marks '{', '}', '[', ']' and ':'. sep marks whitespace and commas that JsonParser skips.
+struct BlockMasks {
+  uint64 quote, backslash, op, sep;
+};
+
+// Classifier computes BlockMasks for num_blocks consecutive blocks of src and provides
+// the bit operations that have faster instructions on its target.
+//
+// '[' and ']' differ from '{' and '}' only by bit 0x20, therefore two compares find all four.
+struct Sse2Classifier {
+  static int CountOnes(uint64 n) { return Bits::CountOnes64(n); }
+
+  // Bit i of the result is the xor of bits 0..i of x.
+  static uint64 PrefixXor(uint64 x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+  }
+
+  static void Classify(const char* src, unsigned num_blocks, BlockMasks* masks) {
+    const __m128i kQuote = _mm_set1_epi8('"'), kBackslash = _mm_set1_epi8('\\');
+    const __m128i kOpen = _mm_set1_epi8('{'), kClose = _mm_set1_epi8('}');
+    const __m128i kColon = _mm_set1_epi8(':'), kCase = _mm_set1_epi8(0x20);
+    const __m128i kSpace = _mm_set1_epi8(' '), kTab = _mm_set1_epi8('\t');
+    const __m128i kLf = _mm_set1_epi8('\n'), kCr = _mm_set1_epi8('\r');
+    const __m128i kComma = _mm_set1_epi8(',');
+
+    for (BlockMasks* m = masks; m != masks + num_blocks; ++m, src += kBlockSize) {
+      *m = BlockMasks{0, 0, 0, 0};
+      for (unsigned i = 0; i < kBlockSize; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lower = _mm_or_si128(v, kCase);
+        __m128i op = _mm_or_si128(_mm_cmpeq_epi8(lower, kOpen), _mm_cmpeq_epi8(lower, kClose));
+        op = _mm_or_si128(op, _mm_cmpeq_epi8(v, kColon));
+        __m128i sep = _mm_or_si128(_mm_cmpeq_epi8(v, kSpace), _mm_cmpeq_epi8(v, kComma));
+        sep = _mm_or_si128(sep, _mm_or_si128(_mm_cmpeq_epi8(v, kTab), _mm_cmpeq_epi8(v, kLf)));
+        sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, kCr));
+        m->quote |= uint64(uint16(_mm_movemask_epi8(_mm_cmpeq_epi8(v, kQuote)))) << i;
+        m->backslash |= uint64(uint16(_mm_movemask_epi8(_mm_cmpeq_epi8(v, kBackslash)))) << i;
+        m->op |= uint64(uint16(_mm_movemask_epi8(op))) << i;
+        m->sep |= uint64(uint16(_mm_movemask_epi8(sep))) << i;
+      }
+    }
+  }
+};
+
+// Finds op and sep bytes with two nibble lookups instead of eight compares.
+// A byte belongs to a class if the lookups of its low and high nibbles share a bit:
+// 1 - '\t', '\n', '\r'; 2 - ' ', ','; 4 - ':'; 8 - '[', ']', '{', '}'.
+// Bytes above 0x7f have zero in the high nibble table.
+struct Avx2Classifier {
+  static int CountOnes(uint64 n) { return __builtin_popcountll(n); }
+
+  // Carry-less multiplication by all ones computes the prefix xor in one instruction.
+  __attribute__((target("pclmul")))
+  static uint64 PrefixXor(uint64 x) {
+    __m128i all_ones = _mm_set1_epi8(-1);
+    return _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128(x), all_ones, 0));
+  }
+
+  __attribute__((target("avx2")))
+  static void Classify(const char* src, unsigned num_blocks, BlockMasks* masks) {
+    const __m256i kLowTable = _mm256_setr_epi8(
+        2, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1 | 4, 8, 2, 1 | 8, 0, 0,
+        2, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1 | 4, 8, 2, 1 | 8, 0, 0);
+    const __m256i kHighTable = _mm256_setr_epi8(
+        1, 0, 2, 4, 0, 8, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 0, 2, 4, 0, 8, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i kQuote = _mm256_set1_epi8('"'), kBackslash = _mm256_set1_epi8('\\');
+    const __m256i kNibble = _mm256_set1_epi8(0xf), kOp = _mm256_set1_epi8(4 | 8);
+    const __m256i kSep = _mm256_set1_epi8(1 | 2), kZero = _mm256_setzero_si256();
+
+    for (BlockMasks* m = masks; m != masks + num_blocks; ++m, src += kBlockSize) {
+      *m = BlockMasks{0, 0, 0, 0};
+      for (unsigned i = 0; i < kBlockSize; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i low = _mm256_shuffle_epi8(kLowTable, _mm256_and_si256(v, kNibble));
+        __m256i high = _mm256_shuffle_epi8(
+            kHighTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), kNibble));
+        __m256i cls = _mm256_and_si256(low, high);
+        __m256i not_op = _mm256_cmpeq_epi8(_mm256_and_si256(cls, kOp), kZero);
+        __m256i not_sep = _mm256_cmpeq_epi8(_mm256_and_si256(cls, kSep), kZero);
+        m->quote |= uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, kQuote)))) << i;
+        m->backslash |=
+            uint64(uint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, kBackslash)))) << i;
+        m->op |= uint64(~uint32(_mm256_movemask_epi8(not_op))) << i;
+        m->sep |= uint64(~uint32(_mm256_movemask_epi8(not_sep))) << i;
+      }
+    }
+  }
+};
+
+// State carried from one block to the next.
+struct IndexState {
+  uint64 prev_ends_odd_backslash = 0;  // 1 if the previous block ends with an odd backslash run.
+  uint64 prev_in_string = 0;           // all ones if the previous block ends inside a string.
+  uint64 prev_scalar = 0;              // 1 if the previous block ends inside an unquoted token.
+};
+
+// Returns the mask of characters that follow an odd-length run of backslashes,
+// i.e. the escaped characters.
+inline uint64 FindEscaped(uint64 backslash, uint64* prev_ends_odd) {
+  const uint64 kEvenBits = 0x5555555555555555ULL;
+  const uint64 kOddBits = ~kEvenBits;
+
+  uint64 start_edges = backslash & ~(backslash << 1);
+
+  // A run that continues an odd run from the previous block starts at "odd" bit 0.
+  uint64 even_start_mask = kEvenBits ^ *prev_ends_odd;
+  uint64 even_starts = start_edges & even_start_mask;
+  uint64 odd_starts = start_edges & ~even_start_mask;
+
+  // Adding run starts to the runs carries past their ends.
+  uint64 even_carries = backslash + even_starts;
+  uint64 odd_carries = backslash + odd_starts;
+  bool ends_odd = odd_carries < backslash;
+  odd_carries |= *prev_ends_odd;
+  *prev_ends_odd = ends_odd;
+
+  uint64 even_carry_ends = even_carries & ~backslash;
+  uint64 odd_carry_ends = odd_carries & ~backslash;
+  return (even_carry_ends & kOddBits) | (odd_carry_ends & kEvenBits);
+}
+
+// IndexBlock and BuildIndex are always inlined, so that the AVX2 entry point compiles
+// them with its target flags.
+template<typename Classifier>
+ATTRIBUTE_ALWAYS_INLINE uint32* IndexBlock(const BlockMasks& m, uint32 offset,
+                                           IndexState* state, uint32* dest) {
+  uint64 quote = m.quote;
+  if (m.backslash | state->prev_ends_odd_backslash)
+    quote &= ~FindEscaped(m.backslash, &state->prev_ends_odd_backslash);
+
+  // Covers the opening quote and the contents of each string but not its closing quote.
+  uint64 in_string = Classifier::PrefixXor(quote) ^ state->prev_in_string;
+  state->prev_in_string = uint64(int64(in_string) >> 63);
+
+  uint64 op = m.op & ~in_string;
+  uint64 scalar = ~(m.op | m.sep | quote | in_string);
+  uint64 scalar_start = scalar & ~((scalar << 1) | state->prev_scalar);
+  state->prev_scalar = scalar >> 63;
+
+  uint64 bits = op | quote | scalar_start | (m.backslash & in_string);
+
+  // Writes positions in groups of 4 to shorten the dependency chain, possibly past the end.
+  // BuildIndex reserves kBlockSize entries for every block, so the garbage is overwritten later.
+  uint32* end = dest + Classifier::CountOnes(bits);
+  while (bits) {
+    for (unsigned i = 0; i < 4; ++i) {
+      // The high bit keeps the argument non-zero when bits run out in the middle of a group.
+      dest[i] = offset + Bits::FindLSBSetNonZero64(bits | (1ULL << 63));
+      bits &= bits - 1;
+    }
+    dest += 4;
+  }
+  return end;
+}
+
+template<typename Classifier>
+ATTRIBUTE_ALWAYS_INLINE size_t BuildIndex(StringPiece str, JsonIndexPositions* positions) {
+  CHECK_LT(str.size(), 1ULL << 32);
+
+  // Every block appends at most kBlockSize positions.
+  const size_t kBatchBytes = kBatchSize * kBlockSize;
+  size_t count = 0;
+  IndexState state;
+  BlockMasks masks[kBatchSize];
+  for (size_t offset = 0; offset < str.size(); offset += kBatchBytes) {
+    size_t len = std::min(str.size() - offset, kBatchBytes);
+    unsigned num_blocks = len / kBlockSize;
+    Classifier::Classify(str.data() + offset, num_blocks, masks);
+    if (len % kBlockSize) {
+      // Pad the last block with whitespace that is never indexed.
+      char buf[kBlockSize];
+      memset(buf, ' ', kBlockSize);
+      memcpy(buf, str.data() + offset + num_blocks * kBlockSize, len % kBlockSize);
+      Classifier::Classify(buf, 1, masks + num_blocks);
+      ++num_blocks;
+    }
+
+    if (positions->size() < count + num_blocks * kBlockSize) {
+      positions->resize(std::max(positions->size() * 2, count + num_blocks * kBlockSize));
+    }
+    uint32* dest = positions->data() + count;
+    for (unsigned i = 0; i < num_blocks; ++i) {
+      dest = IndexBlock<Classifier>(masks[i], offset + i * kBlockSize, &state, dest);
+    }
+    count = dest - positions->data();
+  }
+  return count;
+}
+
+}  // namespace
+
+namespace json_internal {
+
+bool HasAvx2() {
+  static const bool res = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul") &&
+                          __builtin_cpu_supports("popcnt");
+  return res;
+}
+
+size_t BuildJsonIndexSse2(StringPiece str, JsonIndexPositions* positions) {
+  return BuildIndex<Sse2Classifier>(str, positions);
+}
+
+__attribute__((target("avx2,pclmul,popcnt")))
+size_t BuildJsonIndexAvx2(StringPiece str, JsonIndexPositions* positions) {
+  return BuildIndex<Avx2Classifier>(str, positions);
+}
+
+}  // namespace json_internal
+
+void ReserveJsonIndex(size_t doc_size, JsonIndexPositions* positions) {
+  // BuildIndex has at most one position per byte it has already seen and needs kBlockSize
+  // entries for every block of the current batch.
+  size_t size = (doc_size + kBlockSize - 1) / kBlockSize * kBlockSize;
+  if (positions->size() < size)
+    positions->resize(size);
+}
+
+size_t BuildJsonIndex(StringPiece str, JsonIndexPositions* positions) {
+  if (json_internal::HasAvx2()) {
+    return json_internal::BuildJsonIndexAvx2(str, positions);
+  }
+  return json_internal::BuildJsonIndexSse2(str, positions);
+}
+
+}  // namespace util
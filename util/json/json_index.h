@@ -0,0 +1,50 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+// Structural index of a JSON document - the first stage of JsonParser indexed mode.
+// The index is built 64 bytes at a time: each block is classified with SIMD compares into
+// bitmasks of quotes, backslashes, brackets and whitespace, and the bitmasks are combined
+// with scalar bit arithmetic into a mask of "interesting" positions. The approach follows
+// "Parsing Gigabytes of JSON per Second" by Langdale and Lemire.
+#ifndef _UTIL_JSON_JSON_INDEX_H
+#define _UTIL_JSON_JSON_INDEX_H
+
+#include <vector>
+#include "base/arena.h"
+#include "base/integral_types.h"
+#include "strings/stringpiece.h"
+
+namespace util {
+
+// Offsets of the structural characters. Allocated from an arena when the allocator has one
+// and from the heap otherwise.
+typedef std::vector<uint32, base::ArenaAllocator<uint32>> JsonIndexPositions;
+
+// Fills positions with the offsets of every quote that is not escaped, every backslash inside
+// a string, every '{', '}', '[', ']' and ':' outside of strings and the first character of
+// every unquoted token (numbers, null, true, false and unquoted keys).
+// Commas and whitespace are not indexed.
+// Offsets are stored in increasing order. str must be shorter than 4GB.
+// Returns the number of offsets. positions only grows, so it can be reused between calls
+// without being cleared again, and its size may be larger than the returned number.
+// Uses AVX2, PCLMUL and POPCNT when the CPU supports them and SSE2 otherwise.
+size_t BuildJsonIndex(StringPiece str, JsonIndexPositions* positions);
+
+// Grows positions so that BuildJsonIndex does not allocate for documents of up to
+// doc_size bytes.
+void ReserveJsonIndex(size_t doc_size, JsonIndexPositions* positions);
+
+namespace json_internal {
+
+// Specific implementations of BuildJsonIndex. BuildJsonIndexAvx2 must be called only
+// if HasAvx2() returns true.
+size_t BuildJsonIndexSse2(StringPiece str, JsonIndexPositions* positions);
+size_t BuildJsonIndexAvx2(StringPiece str, JsonIndexPositions* positions);
+
+// True if the CPU supports AVX2, PCLMUL and POPCNT.
+bool HasAvx2();
+
+}  // namespace json_internal
+}  // namespace util
+
+#endif  // _UTIL_JSON_JSON_INDEX_H
@@ -8,6 +8,7 @@
 #include "strings/ascii_ctype.h"
 #include "strings/escaping.h"
 #include "strings/numbers.h"
+#include "util/json/json_index.h"
 
 namespace util {
 
@@ -15,7 +16,10 @@ std::ostream& operator<<(std::ostream& os, const JsonObject::Value& v) {
   os << "Value(" << v.type << ", ";
   switch (v.type) {
     case JsonObject::INTEGER:
-      os << v.u.int_val;
+      if (v.lazy)
+        os << v.u.token;
+      else
+        os << v.u.int_val;
       break;
     case JsonObject::OBJECT:
     case JsonObject::ARRAY:
@@ -29,7 +33,10 @@ std::ostream& operator<<(std::ostream& os, const JsonObject::Value& v) {
       os << v.u.primitive;
       break;
     case JsonObject::DOUBLE:
-      os << v.u.d_val;
+      if (v.lazy)
+        os << v.u.token;
+      else
+        os << v.u.d_val;
       break;
     case JsonObject::UNDEFINED:
       os << "undef";
@@ -40,8 +47,39 @@ std::ostream& operator<<(std::ostream& os, const JsonObject::Value& v) {
 }
 
 
-static JsonParser::Status parse_primitive(StringPiece str, JsonObject::Value* val,
-                                          uint32* skip) {
+// Fast path for the common integers: up to 18 digits with an optional minus sign.
+// Returns false for everything else and then strtoll should be used.
+static bool parse_small_int(StringPiece str, int64* res) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+  bool negative = (p != end && *p == '-');
+  if (negative) ++p;
+  if (p == end || end - p > 18)
+    return false;
+  int64 val = 0;
+  for (; p != end; ++p) {
+    unsigned digit = unsigned(*p) - '0';
+    if (digit > 9)
+      return false;
+    val = val * 10 + digit;
+  }
+  *res = negative ? -val : val;
+  return true;
+}
+
+// Converts the text of an integer. The text is followed by a delimiter in the parsed buffer.
+static int64 convert_int(StringPiece token) {
+  int64 res;
+  if (!parse_small_int(token, &res))
+    res = strtoll(token.data(), nullptr, 10);
+  return res;
+}
+
+// With lazy = true, numbers keep their text in val->u.token and are not validated.
+// With partial = true, str may end in the middle of the primitive, and then
+// MORE_INPUT_EXPECTED is returned.
+static JsonParser::Status parse_primitive(StringPiece str, bool lazy, bool partial,
+                                          JsonObject::Value* val, uint32* skip) {
   bool is_float = false;
   bool is_number = true;
   size_t i = 0;
@@ -65,16 +103,21 @@ static JsonParser::Status parse_primitive(StringPiece str, JsonObject::Value* va
       return JsonParser::INVALID_JSON;
     }
   }
+  if (partial)
+    return JsonParser::MORE_INPUT_EXPECTED;
 
 found:
   errno = 0;
-  char* endptr = nullptr;
-  if (is_float) {
+  val->lazy = is_number && lazy;
+  if (val->lazy) {
+    val->type = is_float ? JsonObject::DOUBLE : JsonObject::INTEGER;
+    val->u.token.set(str.data(), i);
+  } else if (is_float) {
     val->type = JsonObject::DOUBLE;
-    val->u.d_val = strtod(str.data(), &endptr);
+    val->u.d_val = strtod(str.data(), nullptr);
   } else if (is_number) {
     val->type = JsonObject::INTEGER;
-    val->u.int_val = strtoll(str.data(), &endptr, 10);
+    val->u.int_val = convert_int(StringPiece(str.data(), i));
   } else if (i == 4 && str.starts_with("null")) {
     val->type = JsonObject::PRIMITIVE;
     val->u.primitive = JsonObject::NULL_V;
@@ -90,6 +133,8 @@ found:
     if (i < str.size() && str[i] == ':') {
       val->type = JsonObject::KEY_NAME;
       val->u.token.set(str.data(), end);
+    } else if (partial && i == str.size()) {
+      return JsonParser::MORE_INPUT_EXPECTED;
     } else {
       VLOG(1) << "key name is not followed by ':', key: " << StringPiece(str.data(), end);
       return JsonParser::INVALID_JSON;
@@ -112,7 +157,8 @@ static JsonParser::Status parse_string(StringPiece str, JsonObject::Value* val)
 
     /* Backslash: Quoted symbol expected */
     if (c == '\\') {
-      i++;
+      if (++i == str.size())
+        break;
       switch (str[i]) {
         /* Allowed escaped symbols */
         case '\"': case '/' : case '\\' : case 'b' :
@@ -133,99 +179,235 @@ static JsonParser::Status parse_string(StringPiece str, JsonObject::Value* val)
 }
 
 JsonParser::JsonParser(bool check_fail_on_schema_errors)
-  : check_fail_on_schema_errors_(check_fail_on_schema_errors) {
+  : JsonParser(nullptr, check_fail_on_schema_errors) {
+}
+
+JsonParser::JsonParser(base::Arena* arena, bool check_fail_on_schema_errors)
+  : values_(base::ArenaAllocator<JsonObject::Value>(arena)),
+    depth_(base::ArenaAllocator<uint32>(arena)),
+    index_(base::ArenaAllocator<uint32>(arena)),
+    check_fail_on_schema_errors_(check_fail_on_schema_errors) {
   depth_.reserve(16);
   values_.reserve(128);
 }
 
-JsonParser::Status JsonParser::Parse(StringPiece str) {
+void JsonParser::Reset() {
   depth_.clear();
   values_.clear();
   parent_size_ = 0;
+  stream_buf_.clear();
+  stream_pos_ = 0;
+}
+
+void JsonParser::Reserve(size_t num_values, size_t doc_size) {
+  values_.reserve(num_values);
+  if (use_index_)
+    ReserveJsonIndex(doc_size, &index_);
+}
+
+void JsonParser::OpenComposite(JsonObject::Type type) {
+  if (!depth_.empty()) {
+    values_[depth_.back()].u.children.immediate += (parent_size_ + 1);
+  }
+  parent_size_ = 0;
+  depth_.push_back(values_.size());
+  values_.emplace_back(type);
+  values_.back().u.children.transitive = 0;
+}
+
+JsonParser::Status JsonParser::CloseComposite(JsonObject::Type type, size_t pos) {
+  if (depth_.empty()) {
+    VLOG(1) << "Unbalanced parenthesis at offset " << pos;
+    return INVALID_JSON; // todo: to add more info
+  }
+  DCHECK_LT(depth_.back(), values_.size());
+  JsonObject::Value& v = values_[depth_.back()];
+  if (v.type != type) {
+    VLOG(1) << "Unmatched parenthesis at offset " << pos;
+    return INVALID_JSON; // mismatched bracket.
+  }
+  v.u.children.immediate += parent_size_;
+  if (type == JsonObject::OBJECT && v.u.children.immediate % 2 != 0) {
+    VLOG(1) << "Odd number of tokens in object at offset " << pos;
+    return INVALID_JSON; // mismatched bracket.
+  }
+  parent_size_ = 0;
+  v.u.children.transitive = values_.size() - depth_.back() - 1;
+  depth_.pop_back();
+  return SUCCESS;
+}
 
-  JsonObject::Type type;
+JsonParser::Status JsonParser::SetKeyName() {
+  if (depth_.empty())
+    return INVALID_JSON;
+  DCHECK(!values_.empty());
+  if (values_.back().type != JsonObject::KEY_NAME) {
+    if (values_.back().type != JsonObject::STRING) {
+      VLOG(1) << "Unexpected type for key in json object " << values_.back().type;
+      return INVALID_JSON; // mismatched bracket.
+    }
+    values_.back().type = JsonObject::KEY_NAME;
+  }
+  return SUCCESS;
+}
+
+JsonParser::Status JsonParser::Parse(StringPiece str) {
+  Reset();
+
+  size_t pos = 0;
+  JsonParser::Status st = use_index_ ? ParseIndexed(str) : ParseScalar(str, false, &pos);
+  if (st == SUCCESS && !depth_.empty())
+     return MORE_INPUT_EXPECTED;
+  return st;
+}
+
+JsonParser::Status JsonParser::ParseChunk(StringPiece chunk) {
+  const char* old_base = stream_buf_.data();
+  stream_buf_.append(chunk.data(), chunk.size());
+  if (stream_buf_.data() != old_base) {
+    // Tokens point into stream_buf_, which has moved.
+    for (JsonObject::Value& v : values_) {
+      if (v.type == JsonObject::STRING || v.type == JsonObject::KEY_NAME ||
+          (lazy_ && (v.type == JsonObject::INTEGER || v.type == JsonObject::DOUBLE))) {
+        StringPiece token(v.u.token.data(), v.u.token.size());
+        v.u.token.set(stream_buf_.data() + (token.data() - old_base), token.size());
+      }
+    }
+  }
+
+  JsonParser::Status st = ParseScalar(stream_buf_, true, &stream_pos_);
+  if (st == SUCCESS && !depth_.empty())
+     return MORE_INPUT_EXPECTED;
+  return st;
+}
+
+JsonParser::Status JsonParser::ParseScalar(StringPiece str, bool partial, size_t* start) {
   JsonObject::Value val;
   JsonParser::Status st = SUCCESS;
-  uint32 line = 1;
-  for (size_t pos = 0; pos < str.size(); ++pos) {
+  size_t pos = *start;
+  for (; pos < str.size(); ++pos) {
     char c = str[pos];
     switch (c) {
       case '{': case '[':
-        type = (c == '{') ? JsonObject::OBJECT : JsonObject::ARRAY;
-        if (!depth_.empty()) {
-          values_[depth_.back()].u.children.immediate += (parent_size_ + 1);
-        }
-        parent_size_ = 0;
-        depth_.push_back(values_.size());
-        values_.emplace_back(type);
-        values_.back().u.children.transitive = 0;
+        OpenComposite(c == '{' ? JsonObject::OBJECT : JsonObject::ARRAY);
         break;
-      case '}': case ']': {
-          type = (c == '}') ? JsonObject::OBJECT : JsonObject::ARRAY;
-          if (depth_.empty()) {
-            VLOG(1) << "Unbalanced " << c << " line " << line;
-            return INVALID_JSON; // todo: to add more info
-          }
-          DCHECK_LT(depth_.back(), values_.size());
-          JsonObject::Value& v = values_[depth_.back()];
-          if (v.type != type) {
-            VLOG(1) << "Unmatched parenthis for " << c << " line " << line;
-            return INVALID_JSON; // mismatched bracket.
-          }
-          v.u.children.immediate += parent_size_;
-          if (type == JsonObject::OBJECT && v.u.children.immediate % 2 != 0) {
-            VLOG(1) << "Odd number of tokens in object."  << " line " << line;
-            return INVALID_JSON; // mismatched bracket.
-          }
-          parent_size_ = 0;
-          v.u.children.transitive = values_.size() - depth_.back() - 1;
-          depth_.pop_back();
-        }
+      case '}': case ']':
+        st = CloseComposite(c == '}' ? JsonObject::OBJECT : JsonObject::ARRAY, pos);
+        if (st != SUCCESS) return st;
         break;
       case '\"':
         st = parse_string(StringPiece(str, pos), &val);
-        if (st != SUCCESS) return st;
+        if (st != SUCCESS) {
+          *start = pos;
+          return st;
+        }
         values_.push_back(val);
         pos += val.u.token.size() + 1; // skip the string value.
         ++parent_size_;
         break;
-      case '\t' : case '\r' : case ',': case ' ':
-        break;
-      case '\n':
-        ++line;
+      case '\t' : case '\r' : case '\n' : case ',': case ' ':
         break;
       case ':':  // dictionary, we must be inside object
-        if (depth_.empty())
-          return INVALID_JSON;
-        DCHECK(!values_.empty());
-        if (values_.back().type != JsonObject::KEY_NAME) {
-          if (values_.back().type != JsonObject::STRING) {
-            VLOG(1) << "Unexpected type for key in json object " << values_.back().type;
-            return INVALID_JSON; // mismatched bracket.
+        st = SetKeyName();
+        if (st != SUCCESS) return st;
+        break;
+      /* In non-strict mode every unquoted value is a primitive */
+      default: {
+          uint32 skip = 0;
+          st = parse_primitive(StringPiece(str, pos), lazy_, partial, &val, &skip);
+          if (st != SUCCESS) {
+            *start = pos;
+            return st;
           }
-          values_.back().type = JsonObject::KEY_NAME;
+          values_.push_back(val);
+          pos += skip;
+          ++parent_size_;
         }
         break;
-      /* In non-strict mode every unquoted value is a primitive */
+    }
+  }
+  *start = pos;
+  return SUCCESS;
+}
+
+// Visits only the positions from index_ and skips the rest of the input.
+// Since both modes share the same tokenizers, they produce the same values.
+// The index is built without knowing where unquoted tokens end. When an unquoted token
+// contains a quote the index may be wrong after it, and we parse the input again in scalar mode.
+JsonParser::Status JsonParser::ParseIndexed(StringPiece str) {
+  const size_t index_size = BuildJsonIndex(str, &index_);
+
+  // Local copies, since the compiler can not prove that values_ does not alias them.
+  const uint32* index = index_.data();
+  const char* data = str.data();
+
+  JsonObject::Value val;
+  JsonParser::Status st = SUCCESS;
+  size_t next = 0;  // Positions below next belong to already parsed unquoted tokens.
+  for (size_t i = 0; i < index_size; ++i) {
+    size_t pos = index[i];
+    if (pos < next) {
+      if (data[pos] == '"') {
+        Reset();
+        size_t start = 0;
+        return ParseScalar(str, false, &start);
+      }
+      continue;
+    }
+    char c = data[pos];
+    switch (c) {
+      case '{': case '[':
+        OpenComposite(c == '{' ? JsonObject::OBJECT : JsonObject::ARRAY);
+        break;
+      case '}': case ']':
+        st = CloseComposite(c == '}' ? JsonObject::OBJECT : JsonObject::ARRAY, pos);
+        if (st != SUCCESS) return st;
+        break;
+      case '\"': {
+          // Inside a string the index has only backslashes, and the closing quote follows them.
+          size_t first = i + 1;
+          while (++i < index_size && data[index[i]] == '\\') {}
+          if (i == index_size)
+            return parse_string(StringPiece(str, pos), &val);  // not terminated.
+          if (i > first) {
+            // Validate escape sequences.
+            st = parse_string(StringPiece(str, pos), &val);
+            if (st != SUCCESS) return st;
+            DCHECK_EQ(index[i], pos + val.u.token.size() + 1);
+          }
+          val.type = JsonObject::STRING;
+          val.u.token.set(data + pos + 1, index[i] - pos - 1);
+
+          // Most strings are keys. Consume their ':' here to save a dispatch.
+          if (i + 1 < index_size && data[index[i + 1]] == ':' && !depth_.empty()) {
+            val.type = JsonObject::KEY_NAME;
+            ++i;
+          }
+          values_.push_back(val);
+          ++parent_size_;
+        }
+        break;
+      case ':':
+        st = SetKeyName();
+        if (st != SUCCESS) return st;
+        break;
       default: {
           uint32 skip = 0;
-          st = parse_primitive(StringPiece(str, pos), &val, &skip);
+          st = parse_primitive(StringPiece(str, pos), lazy_, false, &val, &skip);
           if (st != SUCCESS) return st;
           values_.push_back(val);
-          pos += skip;
+          next = pos + skip + 1;
           ++parent_size_;
         }
         break;
     }
   }
-  if (!depth_.empty())
-     return MORE_INPUT_EXPECTED;
   return SUCCESS;
 }
 
 JsonObject JsonObject::get(StringPiece key) const {
    if (slice_.empty())
-     return JsonObject(nullptr, false, key);
+     return JsonObject(nullptr, false, false, key);
    const JsonObject::Value& root = slice_[0];
    if (check_fail_on_schema_errors_) {
      CHECK_EQ(JsonObject::OBJECT, root.type) << ", key: " << key;
@@ -234,7 +416,8 @@ JsonObject JsonObject::get(StringPiece key) const {
      return JsonObject::Undefined();
    }
    DCHECK_LT(root.transitive_size(), slice_.size());
-   ObjectIterator it(ValueSlice(slice_, 1, root.transitive_size()), check_fail_on_schema_errors_);
+   ObjectIterator it(ValueSlice(slice_, 1, root.transitive_size()), check_fail_on_schema_errors_,
+                     lazy_);
    for (; !it.Done(); ++it) {
      auto key_val = it.GetKeyVal();
      if (key_val.first == key) {
@@ -242,13 +425,34 @@ JsonObject JsonObject::get(StringPiece key) const {
        return res;
      }
    }
-   return JsonObject(nullptr, false, key);
+   return JsonObject(nullptr, false, false, key);
+}
+
+JsonObject JsonObject::Extract(std::initializer_list<StringPiece> path) const {
+  JsonObject res = *this;
+  for (StringPiece key : path) {
+    if (res.type() != JsonObject::ARRAY) {
+      res = res.get(key);
+      continue;
+    }
+    uint32 index;
+    if (!safe_strtou32(key, &index) || index >= res.slice_[0].u.children.immediate) {
+      CHECK(!check_fail_on_schema_errors_) << "Bad index " << key;
+      return JsonObject::Undefined();
+    }
+    ArrayIterator it = res.GetArrayIterator();
+    for (; index > 0; --index) {
+      ++it;
+    }
+    res = it.GetObj();
+  }
+  return res;
 }
 
 JsonObject::ObjectIterator JsonObject::GetObjectIterator() const {
   if (type() == JsonObject::OBJECT) {
     return ObjectIterator(ValueSlice(slice_, 1, slice_[0].transitive_size()),
-                          check_fail_on_schema_errors_);
+                          check_fail_on_schema_errors_, lazy_);
   }
   if (!check_fail_on_schema_errors_ || !is_defined()) {
     return ObjectIterator();
@@ -266,7 +470,7 @@ JsonObject::ArrayIterator JsonObject::GetArrayIterator() const {
       is_array = false;
     case JsonObject::ARRAY:
       return ArrayIterator(ValueSlice(slice_, 1, slice_[0].transitive_size()),
-                           check_fail_on_schema_errors_, is_array);
+                           check_fail_on_schema_errors_, lazy_, is_array);
     case JsonObject::UNDEFINED:
       return ArrayIterator();
     default: {}
@@ -285,14 +489,14 @@ StringPiece JsonObject::GetStr() const {
 
 int64 JsonObject::GetInt() const {
   CHECK_EQ(type(), JsonObject::INTEGER);
-  return slice_[0].u.int_val;
+  return lazy_ ? convert_int(slice_[0].u.token) : slice_[0].u.int_val;
 }
 
 double JsonObject::GetDouble() const {
   CHECK(type() == JsonObject::DOUBLE || type() == JsonObject::INTEGER);
-  if (type() == JsonObject::DOUBLE)
-    return slice_[0].u.d_val;
-  return slice_[0].u.int_val;
+  if (type() == JsonObject::INTEGER)
+    return GetInt();
+  return lazy_ ? strtod(slice_[0].u.token.data(), nullptr) : slice_[0].u.d_val;
 }
 
 bool JsonObject::GetBool() const {
@@ -310,13 +514,13 @@ uint32 JsonObject::Size() const {
 string JsonObject::ToString() const {
   string res;
   switch(type()) {
-    case INTEGER: res = SimpleItoa(slice_[0].u.int_val); break;
+    case INTEGER: res = SimpleItoa(GetInt()); break;
     case STRING: {
       StringPiece token = slice_[0].token();
       res.append("\"").append(token.data(), token.size()).append("\"");
     }
     break;
-    case DOUBLE: res = SimpleDtoa(slice_[0].u.d_val); break;
+    case DOUBLE: res = SimpleDtoa(GetDouble()); break;
     case PRIMITIVE: {
       auto p = slice_[0].primitive();
       switch (p) {
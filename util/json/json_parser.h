@@ -5,12 +5,16 @@
 #ifndef JSON_PARSER_H
 #define JSON_PARSER_H
 
+#include <initializer_list>
 #include <ostream>
+#include <string>
 #include <vector>
 #include <utility>
 
+#include "base/arena.h"
 #include "base/logging.h"
 #include "strings/stringpiece.h"
+#include "util/json/json_index.h"
 
 namespace util {
 class JsonParser;
@@ -52,10 +56,14 @@ public:
     } __attribute__((aligned(4), packed));
 
     U u;
-    Type type = UNDEFINED;
+    Type type : 8;
 
-    Value() {}
-    Value(Type t) : type(t) {}
+    // For INTEGER and DOUBLE: the number has not been converted yet and u.token holds its
+    // text (see JsonParser::set_lazy).
+    bool lazy : 1;
+
+    Value() : type(UNDEFINED), lazy(false) {}
+    Value(Type t) : type(t), lazy(false) {}
 
     bool is_composite() const { return type == OBJECT || type == ARRAY; }
 
@@ -81,9 +89,10 @@ public:
   protected:
     ValueSlice slice_;
     bool check_fail_on_schema_errors_ = false;
+    bool lazy_ = false;
 
-    Iterator(ValueSlice slice, bool check_fail_on_schema_errors)
-      : slice_(slice), check_fail_on_schema_errors_(check_fail_on_schema_errors) {}
+    Iterator(ValueSlice slice, bool check_fail_on_schema_errors, bool lazy)
+      : slice_(slice), check_fail_on_schema_errors_(check_fail_on_schema_errors), lazy_(lazy) {}
     void AdvanceImmediate();
   public:
     Iterator() {}
@@ -101,6 +110,11 @@ public:
   JsonObject operator[](StringPiece key) const { return get(key); }
   JsonObject get(StringPiece key) const;
 
+  // Follows path of object keys and decimal array indices, for example
+  // Extract({"imp", "0", "banner", "w"}). Jumps over the subtrees that are not on the path.
+  // Returns an undefined object if the path does not exist.
+  JsonObject Extract(std::initializer_list<StringPiece> path) const;
+
   // When this->is_defined() is false, both methods return valid iterators with Done() = true.
   // ObjectIterator is deprecated.
   ObjectIterator GetObjectIterator() const  __attribute__ ((deprecated));
@@ -136,17 +150,20 @@ public:
   // For example, with "{ foo : 2 }". For JSON integer object "2", its name will be "foo".
   StringPiece name() const { return name_; }
 
-  static JsonObject Undefined() { return JsonObject(nullptr, false); }
+  static JsonObject Undefined() { return JsonObject(nullptr, false, false); }
 private:
-  explicit JsonObject(const Value* val, bool check_fail_on_schema_errors,
+  explicit JsonObject(const Value* val, bool check_fail_on_schema_errors, bool lazy,
                       StringPiece name = StringPiece())
-      : name_(name), check_fail_on_schema_errors_(check_fail_on_schema_errors) {
+      : name_(name), check_fail_on_schema_errors_(check_fail_on_schema_errors), lazy_(lazy) {
     if (val) slice_.set(val, val->transitive_size() + 1);
   }
 
   ValueSlice slice_; // slice to elements in JsonParser.values_
   StringPiece name_; // the name of the object if exists.
   bool check_fail_on_schema_errors_ = false;
+
+  // Numbers hold their text in u.token and are converted on access (see JsonParser::set_lazy).
+  bool lazy_ = false;
 };
 
 
@@ -154,8 +171,8 @@ class JsonObject::ObjectIterator : public Iterator {
   friend class JsonObject;
   mutable std::pair<StringPiece, JsonObject> res_;
 protected:
-  ObjectIterator(ValueSlice slice, bool check_fail_on_schema_errors)
-      : Iterator(slice, check_fail_on_schema_errors) {}
+  ObjectIterator(ValueSlice slice, bool check_fail_on_schema_errors, bool lazy)
+      : Iterator(slice, check_fail_on_schema_errors, lazy) {}
 
 public:
   ObjectIterator() {}
@@ -174,8 +191,8 @@ class JsonObject::ArrayIterator : public Iterator {
   mutable JsonObject obj_;
   bool is_array_;
 protected:
-  ArrayIterator(ValueSlice slice, bool check_fail_on_schema_errors, bool is_array)
-     : Iterator(slice, check_fail_on_schema_errors), is_array_(is_array) {}
+  ArrayIterator(ValueSlice slice, bool check_fail_on_schema_errors, bool lazy, bool is_array)
+     : Iterator(slice, check_fail_on_schema_errors, lazy), is_array_(is_array) {}
 
 public:
   ArrayIterator() {}
@@ -203,8 +220,45 @@ public:
   // when accessed wrongly. For example when array is accessed with obj["keyname"].
   JsonParser(bool check_fail_on_schema_errors = false);
 
+  // Allocates the values, the nesting stack and the structural index from arena, which must
+  // outlive the parser. Useful when a short-lived parser is created for every document.
+  // The arena never frees memory, so every time one of these arrays grows its old buffer
+  // stays in the arena until the arena is destroyed. Call Reserve() to avoid the regrowth.
+  explicit JsonParser(base::Arena* arena, bool check_fail_on_schema_errors = false);
+
+  // Parses str, replacing the values of the previous document. The parser keeps the capacity
+  // of its internal arrays, so reusing one parser for many similar documents does not
+  // allocate after the first few of them.
   Status Parse(StringPiece str);
 
+  // Parses a document that arrives in chunks. The chunks are appended to an internal buffer,
+  // and parsing resumes from the first token that the previous chunks did not complete.
+  // Returns MORE_INPUT_EXPECTED until all the opened objects and arrays are closed.
+  // A primitive at the end of the input is parsed only when a delimiter follows it.
+  // Always works in scalar mode. Call Reset() before starting a new document; Parse() does
+  // it as well. The chunks may be released after the call.
+  Status ParseChunk(StringPiece chunk);
+
+  // Drops the values of the last document but keeps the allocated capacity.
+  void Reset();
+
+  // Preallocates space for num_values values and, in indexed mode, for the structural
+  // index of documents of up to doc_size bytes.
+  void Reserve(size_t num_values, size_t doc_size = 0);
+
+  // In indexed mode Parse() works in two stages. First, it finds the positions of all
+  // quotes, brackets, colons and unquoted tokens with SIMD instructions (see json_index.h).
+  // Then it builds the values by visiting only those positions. Both modes produce the same
+  // values. The indexed mode skips strings and whitespace much faster, but it is not faster
+  // on small documents that consist mostly of short tokens.
+  void set_indexed(bool indexed) { use_index_ = indexed; }
+
+  // In lazy mode Parse() records the structure and the text of numbers but converts them
+  // only when JsonObject::GetInt() or GetDouble() is called. Useful when only a few fields
+  // of a large document are read. Numbers that overflow are not reported as INVALID_JSON.
+  // Works with both scalar and indexed modes.
+  void set_lazy(bool lazy) { lazy_ = lazy; }
+
   size_t value_size() const { return values_.size(); }
 
   const JsonObject::Value& operator[](size_t i) const {
@@ -216,18 +270,40 @@ public:
 
   JsonObject operator[](StringPiece key) const;
 
+  JsonObject Extract(std::initializer_list<StringPiece> path) const {
+    return root().Extract(path);
+  }
+
 private:
-  std::vector<JsonObject::Value> values_;
-  std::vector<uint32> depth_;
+  // Parses str from *start and sets *start to the position where it stopped. If partial is true,
+  // str may end in the middle of a token, and then *start is the beginning of that token.
+  Status ParseScalar(StringPiece str, bool partial, size_t* start);
+  Status ParseIndexed(StringPiece str);
+
+  void OpenComposite(JsonObject::Type type);
+  Status CloseComposite(JsonObject::Type type, size_t pos);
+
+  // Turns the last value into the key of the current object.
+  Status SetKeyName();
+
+  std::vector<JsonObject::Value, base::ArenaAllocator<JsonObject::Value>> values_;
+  std::vector<uint32, base::ArenaAllocator<uint32>> depth_;
+  JsonIndexPositions index_;
+
+  // ParseChunk() state: the input so far, and the position to resume from.
+  std::string stream_buf_;
+  size_t stream_pos_ = 0;
   uint32 parent_size_ = 0;
   bool check_fail_on_schema_errors_;
+  bool use_index_ = false;
+  bool lazy_ = false;
 };
 
 std::ostream& operator<<(std::ostream& os, const JsonObject::Value& v);
 
 inline JsonObject JsonParser::root() const {
   return values_.empty() ?  JsonObject::Undefined() :
-                            JsonObject(values_.data(), check_fail_on_schema_errors_);
+                            JsonObject(values_.data(), check_fail_on_schema_errors_, lazy_);
 }
 
 inline JsonObject JsonParser::operator[](StringPiece key) const {
@@ -244,7 +320,8 @@ inline std::pair<StringPiece, JsonObject>
   DCHECK(slice_.size() > 1 && slice_[0].type == KEY_NAME);
   DCHECK(slice_[1].type != KEY_NAME);
   StringPiece name = slice_[0].u.token;
-  return std::make_pair(name, JsonObject(slice_.data() + 1, check_fail_on_schema_errors_, name));
+  return std::make_pair(name, JsonObject(slice_.data() + 1, check_fail_on_schema_errors_, lazy_,
+                                         name));
 }
 
 inline JsonObject::ObjectIterator& JsonObject::ObjectIterator::operator++() {
@@ -259,12 +336,12 @@ inline JsonObject JsonObject::ArrayIterator::GetObj() const {
     return JsonObject::Undefined();
   }
   if (is_array_) {
-    return JsonObject(slice_.data(), check_fail_on_schema_errors_);
+    return JsonObject(slice_.data(), check_fail_on_schema_errors_, lazy_);
   }
   DCHECK(slice_.size() > 1 && slice_[0].type == KEY_NAME);
   DCHECK(slice_[1].type != KEY_NAME);
   StringPiece name = slice_[0].u.token;
-  return JsonObject(slice_.data() + 1, check_fail_on_schema_errors_, name);
+  return JsonObject(slice_.data() + 1, check_fail_on_schema_errors_, lazy_, name);
 }
 
 inline JsonObject::ArrayIterator& JsonObject::ArrayIterator::operator++() {
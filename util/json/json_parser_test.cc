@@ -3,10 +3,15 @@
 //
 #include "util/json/json_parser.h"
 
+#include "base/allocation_counter.h"
 #include "base/gtest.h"
+#include "base/random.h"
 #include "file/file_util.h"
+#include "strings/escaping.h"
 #include "strings/strcat.h"
+#include "util/json/json_index.h"
 #include <gmock/gmock.h>
+#include <sstream>
 
 namespace util {
 
@@ -183,17 +188,401 @@ TEST_F(JsonParserTest, Invalid) {
   ASSERT_FALSE(arr_it->is_defined());
 }
 
-void BM_Parse(uint32 iters) {
+static bool SameValue(const JsonObject::Value& a, const JsonObject::Value& b) {
+  if (a.type != b.type)
+    return false;
+  switch (a.type) {
+    case JsonObject::INTEGER:
+      return a.u.int_val == b.u.int_val;
+    case JsonObject::DOUBLE:
+      return a.u.d_val == b.u.d_val;
+    case JsonObject::PRIMITIVE:
+      return a.u.primitive == b.u.primitive;
+    case JsonObject::STRING:
+    case JsonObject::KEY_NAME:
+      return a.u.token.data() == b.u.token.data() && a.u.token.size() == b.u.token.size();
+    case JsonObject::OBJECT:
+    case JsonObject::ARRAY:
+      return a.u.children.immediate == b.u.children.immediate &&
+             a.u.children.transitive == b.u.children.transitive;
+    case JsonObject::UNDEFINED:
+      return true;
+  }
+  return false;
+}
+
+// Checks that both parser modes return the same status and values for str.
+static void ExpectSameParse(StringPiece str) {
+  JsonParser scalar, indexed;
+  indexed.set_indexed(true);
+  JsonParser::Status st = scalar.Parse(str);
+  ASSERT_EQ(st, indexed.Parse(str)) << strings::CEscape(str);
+  if (st != JsonParser::SUCCESS)
+    return;
+  ASSERT_EQ(scalar.value_size(), indexed.value_size()) << str;
+  for (size_t i = 0; i < scalar.value_size(); ++i) {
+    ASSERT_TRUE(SameValue(scalar[i], indexed[i])) << i << ": " << scalar[i] << " vs "
+                                                  << indexed[i] << " in " << strings::CEscape(str);
+  }
+}
+
+TEST_F(JsonParserTest, Indexed) {
+  parser_.set_indexed(true);
+  ASSERT_EQ(JsonParser::SUCCESS, parser_.Parse("{ foo : \"bar\", bar :null, "
+                                               "arr : [234, 456.0, false] }"));
+  ASSERT_EQ(10, parser_.value_size());
+  EXPECT_THAT(parser_[0], ComplexValue(JsonObject::OBJECT, 6, 9));
+  EXPECT_THAT(parser_[1], ValueWithString(JsonObject::KEY_NAME, "foo"));
+  EXPECT_THAT(parser_[2], ValueWithString(JsonObject::STRING, "bar"));
+  EXPECT_THAT(parser_[6], ComplexValue(JsonObject::ARRAY, 3, 3));
+  EXPECT_THAT(parser_[8], DoubleVal(456.0));
+  EXPECT_EQ(JsonParser::INVALID_JSON, parser_.Parse("{ key\n: 2, key2   : }"));
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.Parse("{ key: \"abc"));
+  EXPECT_EQ(JsonParser::INVALID_JSON, parser_.Parse("{ key: \"a\\xbc\" }"));
+
+  const char* kInputs[] = {
+    "", " ", "{}", "[1, 2, 3, ]", "{ key\n: 2, }", "{ \"key\":2 }", "{ key: \"\"}",
+    "[ { foo : [1,2, { key : 3}], bar : { key1 : [], key2: true}},\"str\"] ",
+    "[\"a\\\"b\", \"c\\\\\", \"\\\\\\\"\", 12]", "{ab\"c : 1, d: \"e\"}", "[tru]", "[1e5, -3, 0.5]",
+    "{\"a\":\"b\"}x", "[\"a\"1]", "[1{2]",
+  };
+  for (const char* input : kInputs) {
+    ExpectSameParse(input);
+  }
+
+  // Escapes and strings that cross 64 byte blocks.
+  for (unsigned len = 50; len < 140; ++len) {
+    for (unsigned slashes = 1; slashes < 4; ++slashes) {
+      string str = "{ key : \"" + string(len, 'a') + string(slashes, '\\') + "\"" +
+                   "\", k2: [1, \"x\"]}";
+      ExpectSameParse(str);
+    }
+  }
+
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  ExpectSameParse(contents);
+}
+
+TEST_F(JsonParserTest, IndexedRandom) {
+  const char kAlphabet[] = "{}[]:,\"\"\"\\ \na1.";
+  MTRandom rnd(10);
+  string str;
+  for (unsigned i = 0; i < 20000; ++i) {
+    str.resize(rnd.Rand32() % 200);
+    for (char& c : str) {
+      c = kAlphabet[rnd.Rand32() % (sizeof(kAlphabet) - 1)];
+    }
+    ExpectSameParse(str);
+  }
+
+  // Mutations of a valid document.
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  for (unsigned i = 0; i < 5000; ++i) {
+    str = contents;
+    for (unsigned j = rnd.Rand32() % 3; j > 0; --j) {
+      str[rnd.Rand32() % str.size()] = kAlphabet[rnd.Rand32() % (sizeof(kAlphabet) - 1)];
+    }
+    ExpectSameParse(str);
+  }
+}
+
+TEST_F(JsonParserTest, IndexSse2Avx2) {
+  if (!json_internal::HasAvx2())
+    return;
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  JsonIndexPositions sse2, avx2;
+  for (size_t len = 0; len < contents.size(); len += 17) {
+    StringPiece str(contents.data(), len);
+    size_t sse2_size = json_internal::BuildJsonIndexSse2(str, &sse2);
+    ASSERT_EQ(sse2_size, json_internal::BuildJsonIndexAvx2(str, &avx2));
+    sse2.resize(sse2_size);
+    avx2.resize(sse2_size);
+    ASSERT_EQ(sse2, avx2) << len;
+  }
+}
+
+TEST_F(JsonParserTest, NoAllocations) {
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+
+  for (bool indexed : {false, true}) {
+    JsonParser parser;
+    parser.set_indexed(indexed);
+    ASSERT_EQ(JsonParser::SUCCESS, parser.Parse(contents));
+    size_t value_size = parser.value_size();
+
+    uint64 start = base::NumAllocations();
+    for (unsigned i = 0; i < 10; ++i) {
+      ASSERT_EQ(JsonParser::SUCCESS, parser.Parse(contents));
+      ASSERT_EQ(JsonParser::SUCCESS, parser.Parse("{ foo : [1, 2], bar: \"baz\"}"));
+    }
+    EXPECT_EQ(0, base::NumAllocations() - start) << indexed;
+
+    parser.Reset();
+    EXPECT_EQ(0, parser.value_size());
+    EXPECT_FALSE(parser.root().is_defined());
+
+    JsonParser reserved;
+    reserved.set_indexed(indexed);
+    reserved.Reserve(value_size, contents.size());
+    start = base::NumAllocations();
+    ASSERT_EQ(JsonParser::SUCCESS, reserved.Parse(contents));
+    EXPECT_EQ(0, base::NumAllocations() - start) << indexed;
+  }
+}
+
+TEST_F(JsonParserTest, Arena) {
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+
+  JsonParser expected;
+  ASSERT_EQ(JsonParser::SUCCESS, expected.Parse(contents));
+  for (bool indexed : {false, true}) {
+    base::Arena arena;
+    for (unsigned i = 0; i < 3; ++i) {
+      JsonParser parser(&arena);
+      parser.set_indexed(indexed);
+      parser.Reserve(expected.value_size() * 2);
+      size_t memory = arena.MemoryUsage();
+      parser.Reserve(expected.value_size() * 2, contents.size());
+      if (indexed) {
+        // The structural index is allocated from the arena as well.
+        EXPECT_LE(memory + contents.size() * sizeof(uint32), arena.MemoryUsage());
+        memory = arena.MemoryUsage();
+      }
+
+      uint64 start = base::NumAllocations();
+      ASSERT_EQ(JsonParser::SUCCESS, parser.Parse(contents));
+      EXPECT_EQ(0, base::NumAllocations() - start) << indexed;
+      EXPECT_EQ(memory, arena.MemoryUsage()) << indexed;
+
+      ASSERT_EQ(expected.value_size(), parser.value_size());
+      for (size_t j = 0; j < parser.value_size(); ++j) {
+        ASSERT_TRUE(SameValue(expected[j], parser[j])) << j;
+      }
+      EXPECT_EQ(0.0, parser["pf"].GetDouble());
+    }
+  }
+}
+
+// Checks that all numbers of a and b are equal. a and b should have the same structure.
+static void ExpectSameNumbers(JsonObject a, JsonObject b) {
+  ASSERT_EQ(a.type(), b.type());
+  switch (a.type()) {
+    case JsonObject::INTEGER:
+      EXPECT_EQ(a.GetInt(), b.GetInt()) << a.name();
+      break;
+    case JsonObject::DOUBLE:
+      EXPECT_EQ(a.GetDouble(), b.GetDouble()) << a.name();
+      break;
+    case JsonObject::ARRAY:
+    case JsonObject::OBJECT: {
+        auto it_a = a.GetArrayIterator(), it_b = b.GetArrayIterator();
+        for (; !it_a.Done(); ++it_a, ++it_b) {
+          ASSERT_FALSE(it_b.Done());
+          ExpectSameNumbers(*it_a, *it_b);
+        }
+        EXPECT_TRUE(it_b.Done());
+      }
+      break;
+    default:
+      EXPECT_EQ(a.ToString(), b.ToString());
+  }
+}
+
+TEST_F(JsonParserTest, Lazy) {
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  contents.append(" [1, -2, 3.5, 123456789012345678901234, -0.25, null, true]");
+
+  for (bool indexed : {false, true}) {
+    JsonParser lazy;
+    lazy.set_lazy(true);
+    lazy.set_indexed(indexed);
+    StringPiece doc(contents.data(), contents.rfind(" ["));
+    ASSERT_EQ(JsonParser::SUCCESS, lazy.Parse(doc));
+    ASSERT_EQ(JsonParser::SUCCESS, parser_.Parse(doc));
+    EXPECT_EQ(parser_.value_size(), lazy.value_size());
+    ExpectSameNumbers(parser_.root(), lazy.root());
+
+    // The eager parser reports the overflow.
+    StringPiece arr(doc.end() + 1, contents.size() - doc.size() - 1);
+    EXPECT_EQ(JsonParser::INVALID_JSON, parser_.Parse(arr));
+    ASSERT_EQ(JsonParser::SUCCESS, lazy.Parse(arr));
+    auto it = lazy.root().GetArrayIterator();
+    EXPECT_EQ(1, it->GetInt());
+    EXPECT_EQ(-2, (++it)->GetInt());
+    EXPECT_EQ(3.5, (++it)->GetDouble());
+    EXPECT_EQ(kint64max, (++it)->GetInt());
+    EXPECT_EQ("-0.25", (++it)->ToString());
+    EXPECT_TRUE((++it)->IsNull());
+    EXPECT_TRUE((++it)->GetBool());
+  }
+}
+
+TEST_F(JsonParserTest, LazyValueOutput) {
+  const char kDoc[] = "[12, -0.25, 1.50]";
+  ASSERT_EQ(JsonParser::SUCCESS, parser_.Parse(kDoc));
+  JsonParser lazy;
+  lazy.set_lazy(true);
+  ASSERT_EQ(JsonParser::SUCCESS, lazy.Parse(kDoc));
+
+  // Numbers that were not converted yet are printed as their text.
+  std::ostringstream eager_os, lazy_os;
+  for (size_t i = 1; i < parser_.value_size(); ++i) {
+    eager_os << parser_[i];
+    lazy_os << lazy[i];
+  }
+  EXPECT_EQ("Value(6, 12) Value(5, -0.25) Value(5, 1.50) ", lazy_os.str());
+  EXPECT_EQ("Value(6, 12) Value(5, -0.25) Value(5, 1.5) ", eager_os.str());
+}
+
+TEST_F(JsonParserTest, Extract) {
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+
+  for (bool lazy : {false, true}) {
+    parser_.set_lazy(lazy);
+    ASSERT_EQ(JsonParser::SUCCESS, parser_.Parse(contents));
+    EXPECT_EQ(320, parser_.Extract({"imp", "0", "w"}).GetInt());
+    EXPECT_EQ("5d6dedf3-17bb-11e2-b5c0-1040f38b83e0",
+              parser_.Extract({"imp", "0", "impid"}).GetStr());
+    EXPECT_EQ(0.0, parser_.Extract({"pf"}).GetDouble());
+    EXPECT_EQ(200, parser_.Extract({"tmax"}).GetInt());
+    EXPECT_EQ("IAB31", parser_.Extract({"site", "cat", "1"}).GetStr());
+    EXPECT_EQ(1, parser_.Extract({"device", "js"}).GetInt());
+    EXPECT_EQ(JsonObject::OBJECT, parser_.Extract({}).type());
+    EXPECT_EQ(0, parser_.Extract({"restrictions", "badv"}).Size());
+
+    EXPECT_FALSE(parser_.Extract({"imp", "1", "w"}).is_defined());
+    EXPECT_FALSE(parser_.Extract({"imp", "w"}).is_defined());
+    EXPECT_FALSE(parser_.Extract({"imp", "0", "w", "x"}).is_defined());
+    EXPECT_FALSE(parser_.Extract({"site", "cat", "-1"}).is_defined());
+    EXPECT_FALSE(parser_.Extract({"foo", "0"}).is_defined());
+  }
+}
+
+TEST_F(JsonParserTest, ParseChunk) {
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  ASSERT_EQ(JsonParser::SUCCESS, parser_.Parse(contents));
+  const string expected = parser_.root().ToString();
+  const size_t value_size = parser_.value_size();
+
+  for (bool lazy : {false, true}) {
+    JsonParser parser;
+    parser.set_lazy(lazy);
+
+    // Split into two chunks at every position.
+    for (size_t split = 0; split <= contents.size(); ++split) {
+      parser.Reset();
+      string chunk = contents.substr(0, split);
+      JsonParser::Status st = parser.ParseChunk(chunk);
+      bool complete = split == 0 || split > contents.rfind('}');
+      ASSERT_EQ(complete ? JsonParser::SUCCESS : JsonParser::MORE_INPUT_EXPECTED, st) << split;
+      chunk = contents.substr(split);
+      ASSERT_EQ(JsonParser::SUCCESS, parser.ParseChunk(chunk)) << split;
+      ASSERT_EQ(value_size, parser.value_size());
+      ASSERT_EQ(expected, parser.root().ToString()) << split;
+    }
+
+    // Random chunks.
+    MTRandom rnd(lazy);
+    for (unsigned i = 0; i < 100; ++i) {
+      parser.Reset();
+      JsonParser::Status st = JsonParser::SUCCESS;
+      for (size_t pos = 0; pos < contents.size();) {
+        size_t len = rnd.Rand32() % 20;
+        ASSERT_NE(JsonParser::INVALID_JSON, st);
+        st = parser.ParseChunk(StringPiece(contents, pos, len));
+        pos += len;
+      }
+      ASSERT_EQ(JsonParser::SUCCESS, st);
+      ASSERT_EQ(expected, parser.root().ToString());
+    }
+  }
+
+  parser_.Reset();
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("{ key : 12"));
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("3"));
+  EXPECT_EQ(JsonParser::SUCCESS, parser_.ParseChunk("}"));
+  EXPECT_EQ(123, parser_["key"].GetInt());
+
+  parser_.Reset();
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("{ \"key\\"));
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("\"\" : tr"));
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("ue"));
+  EXPECT_EQ(JsonParser::SUCCESS, parser_.ParseChunk(" }"));
+  EXPECT_TRUE(parser_["key\\\""].GetBool());
+
+  parser_.Reset();
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("{ ke"));
+  EXPECT_EQ(JsonParser::MORE_INPUT_EXPECTED, parser_.ParseChunk("y  "));
+  EXPECT_EQ(JsonParser::INVALID_JSON, parser_.ParseChunk(" , 1}"));
+}
+
+// bidRequestMopub.json is 788 bytes. Throughput in MB/s is 788 * 1000 / (ns per iteration).
+static void BM_ParseFile(uint32 iters, bool indexed, bool new_parser) {
   StopBenchmarkTiming();
   string file = base::ProgramRunfile("bidRequestMopub.json");
   string contents;
   file_util::ReadFileToStringOrDie(file, &contents);
   JsonParser parser;
+  parser.set_indexed(indexed);
+  uint64 start = base::NumAllocations();
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    if (new_parser) {
+      JsonParser tmp;
+      tmp.set_indexed(indexed);
+      tmp.Parse(contents);
+    } else {
+      parser.Parse(contents);
+    }
+  }
+  StopBenchmarkTiming();
+  LOG(INFO) << "Allocations per parse: " << double(base::NumAllocations() - start) / iters;
+}
+
+DECLARE_BENCHMARK_FUNC(BM_Parse, iters) {
+  BM_ParseFile(iters, false, false);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ParseIndexed, iters) {
+  BM_ParseFile(iters, true, false);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ParseNewParser, iters) {
+  BM_ParseFile(iters, false, true);
+}
+
+// Parses the document and reads a few of its fields.
+static void BM_ExtractFields(uint32 iters, bool lazy) {
+  StopBenchmarkTiming();
+  string contents;
+  file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &contents);
+  JsonParser parser;
+  parser.set_lazy(lazy);
   StartBenchmarkTiming();
   for (int i = 0; i < iters; ++i) {
     parser.Parse(contents);
+    base::sink_result(parser.Extract({"imp", "0", "w"}).GetInt());
+    base::sink_result(parser.Extract({"imp", "0", "h"}).GetInt());
+    base::sink_result(parser.Extract({"device", "ip"}).GetStr().size());
+    base::sink_result(parser.Extract({"site", "cat", "0"}).GetStr().size());
+    base::sink_result(parser.Extract({"tmax"}).GetInt());
   }
 }
-BENCHMARK(BM_Parse);
+
+DECLARE_BENCHMARK_FUNC(BM_ExtractEager, iters) {
+  BM_ExtractFields(iters, false);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_ExtractLazy, iters) {
+  BM_ExtractFields(iters, true);
+}
 
 }  // namespace util
@@ -0,0 +1,77 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/json/ndjson_reader.h"
+
+namespace util {
+
+static inline StringPiece AsStringPiece(strings::Slice s) {
+  return StringPiece(reinterpret_cast<const char*>(s.data()), s.size());
+}
+
+NdjsonReader::NdjsonReader(Source* source, Ownership ownership)
+  : source_(source), ownership_(ownership) {
+}
+
+NdjsonReader::~NdjsonReader() {
+  if (ownership_ == TAKE_OWNERSHIP) {
+    delete source_;
+  }
+}
+
+bool NdjsonReader::Next(JsonObject* result) {
+  while (true) {
+    if (pending_skip_) {
+      source_->Skip(pending_skip_);
+      pending_skip_ = 0;
+    }
+    StringPiece region = AsStringPiece(source_->Peek());
+    if (region.empty())
+      return false;
+
+    JsonParser::Status st;
+    size_t eol = region.find('\n');
+    if (eol != StringPiece::npos) {
+      // The tokens point into the source buffer, so we skip the line only on the next call.
+      ++line_num_;
+      pending_skip_ = eol + 1;
+      st = parser_.Parse(StringPiece(region.data(), eol));
+    } else {
+      st = ParseCrossingLine();
+    }
+
+    if (st == JsonParser::SUCCESS) {
+      if (parser_.value_size() == 0)
+        continue;  // empty line.
+      *result = parser_.root();
+      return true;
+    }
+    VLOG(1) << "Invalid json at line " << line_num_;
+    ++num_invalid_;
+  }
+}
+
+JsonParser::Status NdjsonReader::ParseCrossingLine() {
+  parser_.Reset();
+  ++line_num_;
+
+  JsonParser::Status st = JsonParser::SUCCESS;
+  while (true) {
+    StringPiece region = AsStringPiece(source_->Peek());
+    if (region.empty()) {
+      // The last line without '\n'. The delimiter completes a primitive at its end.
+      return st == JsonParser::INVALID_JSON ? st : parser_.ParseChunk("\n");
+    }
+    size_t eol = region.find('\n');
+    size_t len = (eol == StringPiece::npos) ? region.size() : eol + 1;
+
+    // After an error we still need to skip the rest of the line.
+    if (st != JsonParser::INVALID_JSON)
+      st = parser_.ParseChunk(StringPiece(region.data(), len));
+    source_->Skip(len);
+    if (eol != StringPiece::npos)
+      return st;
+  }
+}
+
+}  // namespace util
@@ -0,0 +1,50 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#ifndef _UTIL_JSON_NDJSON_READER_H
+#define _UTIL_JSON_NDJSON_READER_H
+
+#include "util/json/json_parser.h"
+#include "util/sinksource.h"
+
+namespace util {
+
+// Reads newline-delimited JSON: one document per line.
+// A line that fits in a region returned by source->Peek() is parsed in place, without copying.
+// Only lines that cross regions are copied, by passing their pieces to JsonParser::ParseChunk().
+class NdjsonReader {
+public:
+  NdjsonReader(Source* source, Ownership ownership);
+  ~NdjsonReader();
+
+  // Parses the next line into result. Returns false at the end of the stream.
+  // The result is valid until the next call to Next().
+  // Empty lines are skipped. Lines with invalid or incomplete JSON are skipped as well and
+  // counted by num_invalid().
+  bool Next(JsonObject* result);
+
+  // Allows to configure the parser, for example with set_lazy().
+  JsonParser* parser() { return &parser_; }
+
+  uint64 line_num() const { return line_num_; }
+  uint64 num_invalid() const { return num_invalid_; }
+
+  Status status() const { return source_->status(); }
+
+private:
+  // Parses a line that crosses the current region of the source and skips it.
+  JsonParser::Status ParseCrossingLine();
+
+  Source* source_;
+  Ownership ownership_;
+  JsonParser parser_;
+
+  // The length of the line that was parsed in place. It is skipped on the next call.
+  size_t pending_skip_ = 0;
+  uint64 line_num_ = 0;
+  uint64 num_invalid_ = 0;
+};
+
+}  // namespace util
+
+#endif  // _UTIL_JSON_NDJSON_READER_H
@@ -0,0 +1,73 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/json/ndjson_reader.h"
+
+#include "base/gtest.h"
+#include "file/file_util.h"
+#include "strings/strcat.h"
+
+namespace util {
+
+class NdjsonReaderTest : public testing::Test {
+protected:
+  void SetUp() override {
+    file_util::ReadFileToStringOrDie(base::ProgramRunfile("bidRequestMopub.json"), &doc_);
+    for (char& c : doc_) {
+      if (c == '\n') c = ' ';
+    }
+    JsonParser parser;
+    ASSERT_EQ(JsonParser::SUCCESS, parser.Parse(doc_));
+    expected_ = parser.root().ToString();
+  }
+
+  string doc_;
+  string expected_;
+};
+
+TEST_F(NdjsonReaderTest, Basic) {
+  string input = StrCat("{a: 1, b: [2, 3]}\n\n", doc_, "\r\n", "{c : \"d\"}\n");
+  input.append("[1, 2\n").append("{}\n").append("true");
+  for (uint32 block_size : {1u, 7u, 100u, 1000u, kuint32max}) {
+    NdjsonReader reader(new StringSource(input, block_size), TAKE_OWNERSHIP);
+    JsonObject obj;
+    ASSERT_TRUE(reader.Next(&obj)) << block_size;
+    EXPECT_EQ(1, obj["a"].GetInt());
+    EXPECT_EQ(2, obj["b"].Size());
+    ASSERT_TRUE(reader.Next(&obj));
+    EXPECT_EQ(expected_, obj.ToString());
+    EXPECT_EQ(3, reader.line_num());
+    ASSERT_TRUE(reader.Next(&obj));
+    EXPECT_EQ("d", obj["c"].GetStr());
+
+    // "[1, 2" is incomplete.
+    ASSERT_TRUE(reader.Next(&obj));
+    EXPECT_EQ(JsonObject::OBJECT, obj.type());
+    EXPECT_EQ(1, reader.num_invalid());
+
+    ASSERT_TRUE(reader.Next(&obj));
+    EXPECT_TRUE(obj.GetBool());
+    EXPECT_FALSE(reader.Next(&obj));
+    EXPECT_EQ(7, reader.line_num());
+    EXPECT_TRUE(reader.status().ok());
+  }
+}
+
+TEST_F(NdjsonReaderTest, Lazy) {
+  string input;
+  for (unsigned i = 0; i < 100; ++i) {
+    StrAppend(&input, "{ id : ", i, ", doc : ", doc_, "}\n");
+  }
+  NdjsonReader reader(new StringSource(input, 4096), TAKE_OWNERSHIP);
+  reader.parser()->set_lazy(true);
+  JsonObject obj;
+  for (unsigned i = 0; i < 100; ++i) {
+    ASSERT_TRUE(reader.Next(&obj));
+    EXPECT_EQ(i, obj["id"].GetInt());
+    EXPECT_EQ(expected_, obj["doc"].ToString());
+  }
+  EXPECT_FALSE(reader.Next(&obj));
+  EXPECT_EQ(0, reader.num_invalid());
+}
+
+}  // namespace util
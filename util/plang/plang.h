@@ -4,7 +4,9 @@
 #ifndef _PLANG_H
 #define _PLANG_H
 
+#include <functional>
 #include <memory>
+#include <vector>
 #include "strings/stringpiece.h"
 
 namespace google {
@@ -87,6 +89,10 @@ class Expr {
 public:
   typedef std::function<bool(const ExprValue&)> ExprValueCb;
 
+  // RTTI is disabled, so the compiler uses kind() to downcast the nodes.
+  enum Kind { INT_LITERAL, STRING_TERM, BIN_OP, FUNCTION, IS_DEF };
+  virtual Kind kind() const = 0;
+
   // cb will be called for each value evaluated by Expr until it goes over all values returned by
   // this expression or cb returns false.
   // We need this weird interface because of the repeated fields.
@@ -115,12 +121,15 @@ public:
     return lit;
   }
 
+  ExprValue value() const {
+    return unsigned_ ? ExprValue::fromUInt(val_.uval) : ExprValue::fromInt(val_.signed_val);
+  }
+
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override {
-    if (unsigned_)
-      cb(ExprValue::fromUInt(val_.uval));
-    else
-      cb(ExprValue::fromInt(val_.signed_val));
+    cb(value());
   }
+
+  virtual Kind kind() const override { return INT_LITERAL; }
 };
 
 class StringTerm : public Expr {
@@ -132,7 +141,10 @@ public:
   StringTerm(const std::string& v, Type t) : val_(v), type_(t) {}
 
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+  virtual Kind kind() const override { return STRING_TERM; }
+
   const std::string& val() const { return val_; }
+  Type type() const { return type_; }
 private:
   Type type_;
 };
@@ -146,6 +158,13 @@ public:
   BinOp(Type t, Expr* l, Expr* r) : left_(l), right_(r), type_(t) {}
 
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+  virtual Kind kind() const override { return BIN_OP; }
+
+  Type type() const { return type_; }
+  const Expr* left() const { return left_.get(); }
+
+  // nullptr for NOT.
+  const Expr* right() const { return right_.get(); }
 private:
   Type type_;
 };
@@ -158,6 +177,9 @@ public:
   ~FunctionTerm();
 
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+  virtual Kind kind() const override { return FUNCTION; }
+
+  const std::string& name() const { return name_; }
 };
 
 class IsDefFun : public Expr {
@@ -165,6 +187,9 @@ class IsDefFun : public Expr {
 public:
   IsDefFun(const std::string& name) : name_(name) {};
   virtual void eval(const gpb::Message& msg, ExprValueCb cb) const override;
+  virtual Kind kind() const override { return IS_DEF; }
+
+  const std::string& name() const { return name_; }
 };
 
 bool EvaluateBoolExpr(const Expr& e, const gpb::Message& msg);
@@ -0,0 +1,397 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#include "util/plang/plang_compiler.h"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include "base/logging.h"
+
+namespace plang {
+
+typedef gpb::FieldDescriptor FD;
+
+static bool Compare(BinOp::Type cmp_op, const ExprValue& left, const ExprValue& right) {
+  switch (cmp_op) {
+    case BinOp::EQ:
+      return left.Equal(right);
+    case BinOp::LT:
+      return left.Less(right);
+    case BinOp::LE:
+      return left.Less(right) || left.Equal(right);
+    default:
+      LOG(FATAL) << "Not a comparison " << cmp_op;
+  }
+  return false;
+}
+
+static bool ConstScalar(const Expr& e, ExprValue* val) {
+  if (e.kind() == Expr::INT_LITERAL) {
+    *val = static_cast<const IntLiteral&>(e).value();
+    return true;
+  }
+  if (e.kind() == Expr::STRING_TERM) {
+    const StringTerm& term = static_cast<const StringTerm&>(e);
+    if (term.type() == StringTerm::CONST) {
+      *val = ExprValue(StringPiece(term.val()));
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns 0 or 1 if the boolean expression does not depend on the message, -1 otherwise.
+static int ConstBool(const Expr& e) {
+  if (e.kind() != Expr::BIN_OP)
+    return -1;
+  const BinOp& op = static_cast<const BinOp&>(e);
+  switch (op.type()) {
+    case BinOp::EQ:
+    case BinOp::LT:
+    case BinOp::LE: {
+      ExprValue left, right;
+      if (!ConstScalar(*op.left(), &left) || !ConstScalar(*op.right(), &right))
+        return -1;
+      return Compare(op.type(), left, right);
+    }
+    case BinOp::NOT: {
+      int val = ConstBool(*op.left());
+      return val < 0 ? val : !val;
+    }
+    case BinOp::AND: {
+      int left = ConstBool(*op.left()), right = ConstBool(*op.right());
+      if (left == 0 || right == 0) return 0;
+      return left == 1 && right == 1 ? 1 : -1;
+    }
+    case BinOp::OR: {
+      int left = ConstBool(*op.left()), right = ConstBool(*op.right());
+      // def() over repeated messages may have no values, and then OR is false.
+      if (left == 1 || (right == 1 && op.left()->kind() != Expr::IS_DEF)) return 1;
+      return left == 0 && right == 0 ? 0 : -1;
+    }
+  }
+  return -1;
+}
+
+static ExprValue FieldValue(const gpb::Message& msg, const gpb::Reflection* refl, const FD* fd,
+                            string* tmp) {
+  switch (fd->cpp_type()) {
+    case FD::CPPTYPE_INT32:
+      return ExprValue::fromInt(refl->GetInt32(msg, fd));
+    case FD::CPPTYPE_UINT32:
+      return ExprValue::fromUInt(refl->GetUInt32(msg, fd));
+    case FD::CPPTYPE_INT64:
+      return ExprValue::fromInt(refl->GetInt64(msg, fd));
+    case FD::CPPTYPE_UINT64:
+      return ExprValue::fromUInt(refl->GetUInt64(msg, fd));
+    case FD::CPPTYPE_STRING:
+      return ExprValue(refl->GetStringReference(msg, fd, tmp));
+    case FD::CPPTYPE_BOOL:
+      return ExprValue::fromInt(refl->GetBool(msg, fd));
+    case FD::CPPTYPE_ENUM:
+      return ExprValue(refl->GetEnum(msg, fd));
+    default:
+      LOG(FATAL) << "Not supported yet " << fd->cpp_type_name();
+  }
+  return ExprValue();
+}
+
+static ExprValue RepeatedFieldValue(const gpb::Message& msg, const gpb::Reflection* refl,
+                                    const FD* fd, int index, string* tmp) {
+  switch (fd->cpp_type()) {
+    case FD::CPPTYPE_INT32:
+      return ExprValue::fromInt(refl->GetRepeatedInt32(msg, fd, index));
+    case FD::CPPTYPE_UINT32:
+      return ExprValue::fromUInt(refl->GetRepeatedUInt32(msg, fd, index));
+    case FD::CPPTYPE_INT64:
+      return ExprValue::fromInt(refl->GetRepeatedInt64(msg, fd, index));
+    case FD::CPPTYPE_UINT64:
+      return ExprValue::fromUInt(refl->GetRepeatedUInt64(msg, fd, index));
+    case FD::CPPTYPE_STRING:
+      return ExprValue(refl->GetRepeatedStringReference(msg, fd, index, tmp));
+    case FD::CPPTYPE_BOOL:
+      return ExprValue::fromInt(refl->GetRepeatedBool(msg, fd, index));
+    case FD::CPPTYPE_ENUM:
+      return ExprValue(refl->GetRepeatedEnum(msg, fd, index));
+    default:
+      LOG(FATAL) << "Not supported yet " << fd->cpp_type_name();
+  }
+  return ExprValue();
+}
+
+// Calls f(msg, refl, fd) for each message that holds the last field of the path, until f
+// returns true. Repeated messages on the way are expanded. Returns true if f returned true.
+// f is a template argument so that it is inlined.
+template<typename F> static bool VisitLeafMessages(const gpb::Message& msg, const FD* const* fd,
+                                                   const FD* const* last, const F& f) {
+  const gpb::Reflection* refl = msg.GetReflection();
+  if (fd == last)
+    return f(msg, refl, *fd);
+  if (!(*fd)->is_repeated())
+    return VisitLeafMessages(refl->GetMessage(msg, *fd), fd + 1, last, f);
+  int size = refl->FieldSize(msg, *fd);
+  for (int i = 0; i < size; ++i) {
+    if (VisitLeafMessages(refl->GetRepeatedMessage(msg, *fd, i), fd + 1, last, f))
+      return true;
+  }
+  return false;
+}
+
+// Calls f for each value of the field path until it returns true.
+template<typename F> static bool VisitValues(const gpb::Message& msg,
+                                             const std::vector<const FD*>& path, const F& f) {
+  return VisitLeafMessages(msg, path.data(), &path.back(),
+      [&f](const gpb::Message& pmsg, const gpb::Reflection* refl, const FD* fd) {
+        string tmp;
+        if (!fd->is_repeated())
+          return f(FieldValue(pmsg, refl, fd, &tmp));
+        int size = refl->FieldSize(pmsg, fd);
+        for (int i = 0; i < size; ++i) {
+          if (f(RepeatedFieldValue(pmsg, refl, fd, i, &tmp)))
+            return true;
+        }
+        return false;
+      });
+}
+
+static bool IsFieldSet(const gpb::Message& msg, const gpb::Reflection* refl, const FD* fd) {
+  return fd->is_repeated() ? refl->FieldSize(msg, fd) > 0 : refl->HasField(msg, fd);
+}
+
+CompiledExpr::CompiledExpr(const Expr& e, const gpb::Descriptor* descr) : descr_(descr) {
+  Emit(e, true);
+  VLOG(1) << "Compiled " << code_.size() << " instructions";
+}
+
+void CompiledExpr::Emit(const Expr& e, bool top_level) {
+  int const_val = ConstBool(e);
+  if (const_val >= 0) {
+    Append(CONST, const_val);
+    return;
+  }
+  if (e.kind() == Expr::IS_DEF) {
+    // EvaluateBoolExpr() returns the last of the values.
+    Append(top_level ? IS_DEF_LAST : IS_DEF,
+           ResolvePath(static_cast<const IsDefFun&>(e).name()));
+    return;
+  }
+  CHECK_EQ(Expr::BIN_OP, e.kind()) << "Expected a boolean expression";
+
+  const BinOp& op = static_cast<const BinOp&>(e);
+  switch (op.type()) {
+    case BinOp::EQ:
+    case BinOp::LT:
+    case BinOp::LE:
+      EmitComparison(op);
+    break;
+    case BinOp::NOT:
+      if (op.left()->kind() == Expr::IS_DEF) {
+        // NOT is true if any of the def() values is false.
+        Append(IS_DEF_ALL, ResolvePath(static_cast<const IsDefFun&>(*op.left()).name()));
+      } else {
+        Emit(*op.left());
+      }
+      Append(NOT, 0);
+    break;
+    case BinOp::AND:
+    case BinOp::OR: {
+      // A constant operand that does not decide the result is dropped.
+      int neutral = op.type() == BinOp::AND;
+      if (ConstBool(*op.left()) == neutral) {
+        Emit(*op.right());
+        break;
+      }
+      if (ConstBool(*op.right()) == neutral) {
+        Emit(*op.left());
+        break;
+      }
+      int32 no_messages = -1;
+      if (op.type() == BinOp::OR && op.left()->kind() == Expr::IS_DEF) {
+        uint32 path = ResolvePath(static_cast<const IsDefFun&>(*op.left()).name());
+        if (ThroughRepeated(path)) {
+          // Without def() values OR does not evaluate its right operand and is false.
+          Append(HAS_MESSAGES, path);
+          no_messages = Append(JUMP_IF_FALSE, 0);
+        }
+        Append(IS_DEF, path);
+      } else {
+        Emit(*op.left());
+      }
+      uint32 jump = Append(op.type() == BinOp::AND ? JUMP_IF_FALSE : JUMP_IF_TRUE, 0);
+      Emit(*op.right());
+      code_[jump].arg = code_.size();
+      if (no_messages >= 0)
+        code_[no_messages].arg = code_.size();
+    }
+    break;
+  }
+}
+
+void CompiledExpr::EmitComparison(const BinOp& op) {
+  Comparison cmp;
+  cmp.left = CompileOperand(*op.left());
+  cmp.right = CompileOperand(*op.right());
+  ResolveEnumConstant(cmp.left, &cmp.right);
+  ResolveEnumConstant(cmp.right, &cmp.left);
+  cmps_.push_back(cmp);
+
+  uint32 index = Append(CMP, cmps_.size() - 1);
+  code_[index].cmp_op = op.type();
+}
+
+CompiledExpr::Operand CompiledExpr::CompileOperand(const Expr& e) {
+  Operand res;
+  switch (e.kind()) {
+    case Expr::INT_LITERAL:
+      res.value = static_cast<const IntLiteral&>(e).value();
+    break;
+    case Expr::STRING_TERM: {
+      const StringTerm& term = static_cast<const StringTerm&>(e);
+      if (term.type() == StringTerm::CONST) {
+        strings_.push_back(term.val());
+        res.value = ExprValue(StringPiece(strings_.back()));
+        break;
+      }
+      res.path = ResolvePath(term.val());
+      const FD* fd = paths_[res.path].back();
+      CHECK(fd->cpp_type() != FD::CPPTYPE_DOUBLE && fd->cpp_type() != FD::CPPTYPE_FLOAT &&
+            fd->cpp_type() != FD::CPPTYPE_MESSAGE) << "Not supported yet " << fd->cpp_type_name();
+    }
+    break;
+    case Expr::FUNCTION:
+      LOG(FATAL) << "Unknown function " << static_cast<const FunctionTerm&>(e).name();
+    break;
+    default:
+      LOG(FATAL) << "Expected a scalar expression";
+  }
+  return res;
+}
+
+uint32 CompiledExpr::ResolvePath(const std::string& path) {
+  FieldPath field_path;
+  const gpb::Descriptor* descr = descr_;
+  size_t start = 0;
+  while (true) {
+    size_t next = path.find('.', start);
+    std::string part = path.substr(start, next - start);
+    const FD* fd = descr->FindFieldByName(part);
+    CHECK(fd != nullptr) << "Could not find field " << part;
+    field_path.push_back(fd);
+    if (next == std::string::npos)
+      break;
+    CHECK_EQ(fd->cpp_type(), FD::CPPTYPE_MESSAGE) << part << " is not a message.";
+    descr = fd->message_type();
+    start = next + 1;
+  }
+  paths_.push_back(std::move(field_path));
+  return paths_.size() - 1;
+}
+
+bool CompiledExpr::ThroughRepeated(uint32 path) const {
+  const FieldPath& field_path = paths_[path];
+  for (size_t i = 0; i + 1 < field_path.size(); ++i) {
+    if (field_path[i]->is_repeated())
+      return true;
+  }
+  return false;
+}
+
+void CompiledExpr::ResolveEnumConstant(const Operand& field, Operand* constant) const {
+  if (field.path < 0 || constant->path >= 0)
+    return;
+  const FD* fd = paths_[field.path].back();
+  if (fd->cpp_type() != FD::CPPTYPE_ENUM)
+    return;
+
+  // Comparing enum descriptors is a pointer comparison, while comparing an enum with a string
+  // allocates on every value.
+  const ExprValue& val = constant->value;
+  const gpb::EnumValueDescriptor* enum_val = nullptr;
+  if (val.type == ExprValue::CPPTYPE_STRING) {
+    enum_val = fd->enum_type()->FindValueByName(val.val.str.as_string());
+  } else if (val.type == ExprValue::CPPTYPE_INT64 && val.val.int_val == int32(val.val.int_val)) {
+    enum_val = fd->enum_type()->FindValueByNumber(val.val.int_val);
+  }
+  if (enum_val != nullptr)
+    constant->value = ExprValue(enum_val);
+}
+
+bool CompiledExpr::EvalComparison(BinOp::Type cmp_op, const Comparison& cmp,
+                                  const gpb::Message& msg) const {
+  const Operand& left = cmp.left;
+  const Operand& right = cmp.right;
+  if (right.path < 0) {
+    return VisitValues(msg, paths_[left.path], [cmp_op, &right](const ExprValue& val) {
+      return Compare(cmp_op, val, right.value);
+    });
+  }
+  if (left.path < 0) {
+    return VisitValues(msg, paths_[right.path], [cmp_op, &left](const ExprValue& val) {
+      return Compare(cmp_op, left.value, val);
+    });
+  }
+  const FieldPath& right_path = paths_[right.path];
+  return VisitValues(msg, paths_[left.path], [cmp_op, &msg, &right_path](const ExprValue& lval) {
+    return VisitValues(msg, right_path, [cmp_op, &lval](const ExprValue& rval) {
+      return Compare(cmp_op, lval, rval);
+    });
+  });
+}
+
+bool CompiledExpr::Evaluate(const gpb::Message& msg) const {
+  DCHECK(msg.GetDescriptor() == descr_);
+  bool reg = false;
+  size_t pc = 0;
+  while (pc < code_.size()) {
+    const Instr& instr = code_[pc++];
+    switch (instr.op) {
+      case CONST:
+        reg = instr.arg;
+      break;
+      case CMP:
+        reg = EvalComparison(instr.cmp_op, cmps_[instr.arg], msg);
+      break;
+      case IS_DEF: {
+        const FieldPath& path = paths_[instr.arg];
+        reg = VisitLeafMessages(msg, path.data(), &path.back(), IsFieldSet);
+      }
+      break;
+      case IS_DEF_ALL: {
+        const FieldPath& path = paths_[instr.arg];
+        reg = !VisitLeafMessages(msg, path.data(), &path.back(),
+            [](const gpb::Message& pmsg, const gpb::Reflection* refl, const FD* fd) {
+              return !IsFieldSet(pmsg, refl, fd);
+            });
+      }
+      break;
+      case IS_DEF_LAST: {
+        const FieldPath& path = paths_[instr.arg];
+        reg = false;
+        VisitLeafMessages(msg, path.data(), &path.back(),
+            [&reg](const gpb::Message& pmsg, const gpb::Reflection* refl, const FD* fd) {
+              reg = IsFieldSet(pmsg, refl, fd);
+              return false;
+            });
+      }
+      break;
+      case HAS_MESSAGES: {
+        const FieldPath& path = paths_[instr.arg];
+        reg = VisitLeafMessages(msg, path.data(), &path.back(),
+            [](const gpb::Message&, const gpb::Reflection*, const FD*) { return true; });
+      }
+      break;
+      case NOT:
+        reg = !reg;
+      break;
+      case JUMP_IF_FALSE:
+        if (!reg) pc = instr.arg;
+      break;
+      case JUMP_IF_TRUE:
+        if (reg) pc = instr.arg;
+      break;
+    }
+  }
+  return reg;
+}
+
+}  // namespace plang
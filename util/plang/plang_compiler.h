@@ -0,0 +1,112 @@
+// Copyright 2014, Beeri 15.  All rights reserved.
+// Author: Roman Gershman (romange@gmail.com)
+//
+#ifndef _PLANG_COMPILER_H
+#define _PLANG_COMPILER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/plang/plang.h"
+
+namespace google {
+namespace protobuf {
+class Descriptor;
+class FieldDescriptor;
+}  // namespace protobuf
+}  // namespace google
+
+namespace plang {
+
+// A boolean expression compiled for a specific message type.
+// Compilation resolves the field paths to FieldDescriptor chains, folds constant
+// subexpressions and lowers the tree to a flat program. Evaluate() runs the program without
+// looking up fields by name and without calling std::function for every value.
+// It returns the same result as EvaluateBoolExpr(). That includes def() over a path through
+// repeated messages, which yields one value per message, or none if the repeated field is
+// empty. The operator that consumes these values decides how they are combined: AND and the
+// right operand of OR need any of them to be true, NOT needs any of them to be false, a top
+// level def() returns the last one and OR returns false if its left operand has no values.
+// The compiled expression does not reference the original tree.
+class CompiledExpr {
+public:
+  // Dies if the expression references a field that does not exist in descr, or has
+  // an unsupported type.
+  CompiledExpr(const Expr& e, const gpb::Descriptor* descr);
+
+  // msg must be of the type passed to the constructor.
+  // Evaluate() does not change the object and can be called from several threads.
+  bool Evaluate(const gpb::Message& msg) const;
+
+  // The number of instructions in the program. Constant expressions compile to one instruction.
+  size_t size() const { return code_.size(); }
+
+private:
+  // The program works with a single boolean register.
+  enum OpCode : uint8 {
+    CONST,           // reg = arg.
+    CMP,             // reg = the result of comparison cmps_[arg].
+    // The IS_DEF family checks the field at paths_[arg] in every message that holds it.
+    IS_DEF,          // reg = true if the field is set in any of the messages.
+    IS_DEF_ALL,      // reg = true if the field is set in all the messages or there are none.
+    IS_DEF_LAST,     // reg = true if the field is set in the last message.
+    HAS_MESSAGES,    // reg = true if there is at least one message.
+    NOT,             // reg = !reg.
+    JUMP_IF_FALSE,   // if (!reg) jump to arg.
+    JUMP_IF_TRUE,    // if (reg) jump to arg.
+  };
+
+  struct Instr {
+    OpCode op;
+    BinOp::Type cmp_op;  // EQ, LT or LE for CMP.
+    uint32 arg;
+  };
+
+  typedef std::vector<const gpb::FieldDescriptor*> FieldPath;
+
+  // Either a field path or a constant.
+  struct Operand {
+    int32 path = -1;  // index into paths_ or -1 for a constant.
+    ExprValue value;
+  };
+
+  struct Comparison {
+    Operand left, right;
+  };
+
+  // top_level is true for the root of the expression.
+  void Emit(const Expr& e, bool top_level = false);
+  void EmitComparison(const BinOp& op);
+
+  Operand CompileOperand(const Expr& e);
+  uint32 ResolvePath(const std::string& path);
+
+  // True if the path goes through a repeated message and may reach any number of messages.
+  bool ThroughRepeated(uint32 path) const;
+
+  // Converts a constant compared with an enum field to the enum value.
+  void ResolveEnumConstant(const Operand& field, Operand* constant) const;
+
+  uint32 Append(OpCode op, uint32 arg) {
+    code_.push_back(Instr{op, BinOp::EQ, arg});
+    return code_.size() - 1;
+  }
+
+  bool EvalComparison(BinOp::Type cmp_op, const Comparison& cmp, const gpb::Message& msg) const;
+
+  const gpb::Descriptor* descr_;
+  std::vector<Instr> code_;
+  std::vector<Comparison> cmps_;
+  std::vector<FieldPath> paths_;
+
+  // String constants referenced by the operands. deque keeps their addresses stable.
+  std::deque<std::string> strings_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompiledExpr);
+};
+
+}  // namespace plang
+
+#endif  // _PLANG_COMPILER_H
@@ -3,9 +3,10 @@
 //
 #include "util/plang/plang.h"
 
+#include "base/gtest.h"
 #include "util/plang/addressbook.pb.h"
+#include "util/plang/plang_compiler.h"
 #include "util/plang/plang_parser.h"
-#include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
 namespace plang {
@@ -240,4 +241,134 @@ TEST_F(PlangTest, RepeatedMsgs) {
   parse("phone.number = '4'");
   EXPECT_FALSE(parser_->eval(person));
 }
+
+TEST_F(PlangTest, Compiled) {
+  const char* kExprs[] = {
+    "name = \"Roman\"", "\"Roman\" = name", "id = 6", "id < 7", "id > 5", "id >= 6",
+    "id <= 5", "not id > 6", "id != 5", "(id=6) AND name=\"Roman\"",
+    "(id=6) or name=\"Foo\"", "def(email)", "def(phone)", "def(account.address.street)",
+    "phone.number = '2'", "phone.type = 'WORK'", "phone.type = 1", "phone.type = 'FOO'",
+    "account.activity_id = 8", "account.activity_id > 8", "id = account.activity_id",
+    "phone.number = phone2.number", "not def(account.bank_name) and id < 10",
+  };
+  std::vector<Person> persons(4);
+  persons[0].set_name("Roman");
+  persons[0].set_id(6);
+  persons[1].set_name("Foo");
+  persons[1].set_id(5);
+  persons[1].set_email("foo@bar");
+  persons[1].add_phone()->set_number("1");
+  persons[1].add_phone()->set_number("2");
+  persons[1].mutable_phone(1)->set_type(Person::WORK);
+  persons[1].add_phone2()->set_number("2");
+  persons[2] = persons[1];
+  persons[2].set_id(8);
+  persons[2].mutable_account()->add_activity_id(8);
+  persons[2].mutable_account()->mutable_address()->set_street("Herzl");
+  persons[3] = persons[2];
+  persons[3].mutable_account()->add_activity_id(9);
+  persons[3].mutable_account()->set_bank_name(kBankVal);
+  persons[3].clear_phone2();
+
+  for (const char* expr : kExprs) {
+    ASSERT_EQ(0, parse(expr)) << expr;
+    CompiledExpr compiled(*parser_->res_val, Person::descriptor());
+    for (const Person& person : persons) {
+      EXPECT_EQ(parser_->eval(person), compiled.Evaluate(person))
+          << expr << " " << person.ShortDebugString();
+    }
+  }
+}
+
+// def() over a path through repeated messages yields one value per message, or none if
+// there are no messages. Compiled expressions combine them the same way as EvaluateBoolExpr().
+TEST_F(PlangTest, CompiledRepeatedDef) {
+  Person empty;
+  empty.set_id(1);
+  Person phones = empty;
+  phones.add_phone()->set_type(Person::WORK);
+  phones.add_phone();
+  Person last_phone = empty;
+  last_phone.add_phone();
+  last_phone.add_phone()->set_type(Person::WORK);
+
+  struct {
+    const char* expr;
+    const Person& person;
+    bool expected;
+  } kCases[] = {
+    {"def(phone.type)", phones, false},  // takes the last phone.
+    {"def(phone.type)", last_phone, true},
+    {"def(phone.type)", empty, false},
+    {"not def(phone.type)", phones, true},
+    {"not def(phone.type)", empty, false},
+    {"not not def(phone.type)", empty, true},
+    {"def(phone.type) or id = 1", empty, false},
+    {"def(phone.type) or id = 1", phones, true},
+    {"def(phone.type) or 1 = 1", empty, false},
+    {"id = 1 or def(phone.type)", empty, true},
+    {"def(phone.type) and id = 1", phones, true},
+    {"def(phone.type) and id = 1", empty, false},
+    {"def(phone.type) and 1 = 1", phones, true},
+  };
+  for (const auto& c : kCases) {
+    ASSERT_EQ(0, parse(c.expr)) << c.expr;
+    CompiledExpr compiled(*parser_->res_val, Person::descriptor());
+    EXPECT_EQ(c.expected, compiled.Evaluate(c.person)) << c.expr;
+    EXPECT_EQ(c.expected, parser_->eval(c.person)) << c.expr;
+  }
+}
+
+TEST_F(PlangTest, ConstantFolding) {
+  Person person;
+  person.set_id(6);
+  parse("\"Foo\" = \"Bar\"");
+  CompiledExpr expr1(*parser_->res_val, Person::descriptor());
+  EXPECT_EQ(1, expr1.size());
+  EXPECT_FALSE(expr1.Evaluate(person));
+
+  parse("1 < 2 and (id = 6 or 2 = 3)");
+  CompiledExpr expr2(*parser_->res_val, Person::descriptor());
+  EXPECT_EQ(1, expr2.size());
+  EXPECT_TRUE(expr2.Evaluate(person));
+
+  parse("1 < 2 or id = 7");
+  CompiledExpr expr3(*parser_->res_val, Person::descriptor());
+  EXPECT_EQ(1, expr3.size());
+  EXPECT_TRUE(expr3.Evaluate(person));
+}
+
+static void BM_Where(bool compiled, uint32 iters) {
+  StopBenchmarkTiming();
+  std::istringstream istr("(id > 5 and name = 'Roman') or phone.type = 'WORK'");
+  std::ostringstream ostr;
+  Parser parser(istr, ostr);
+  CHECK_EQ(0, parser.parse());
+  CompiledExpr expr(*parser.res_val, Person::descriptor());
+  std::vector<Person> persons(64);
+  for (unsigned i = 0; i < persons.size(); ++i) {
+    persons[i].set_name(i % 3 ? "Anna" : "Roman");
+    persons[i].set_id(i);
+    for (unsigned j = 0; j < i % 4; ++j) {
+      persons[i].add_phone()->set_number("1");
+    }
+  }
+  StartBenchmarkTiming();
+
+  for (uint32 i = 0; i < iters; ++i) {
+    unsigned count = 0;
+    for (const Person& person : persons) {
+      count += compiled ? expr.Evaluate(person) : EvaluateBoolExpr(*parser.res_val, person);
+    }
+    base::sink_result(count);
+  }
+}
+
+DECLARE_BENCHMARK_FUNC(BM_WhereInterpreted, iters) {
+  BM_Where(false, iters);
+}
+
+DECLARE_BENCHMARK_FUNC(BM_WhereCompiled, iters) {
+  BM_Where(true, iters);
+}
 }  // namespace plang
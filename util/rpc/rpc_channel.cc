@@ -76,7 +76,12 @@ struct Channel::Rep {
 
   explicit Rep(Executor* exec) : state(DISCONNECTED),
      executor_(exec), // bev_(nullptr),
-     alarmer_handler_id_(Scheduler::INVALID_HANDLE) {}
+     alarmer_handler_id_(Scheduler::INVALID_HANDLE) {
+    // Spread channels across the event loops of the executor in round-robin order.
+    static std::atomic_uint next_loop(0);
+    ebase_ = exec->ebase(next_loop.fetch_add(1, std::memory_order_relaxed) %
+                         exec->num_event_loops());
+  }
 
   ~Rep();
 
@@ -91,10 +96,14 @@ struct Channel::Rep {
 
   void ConnectWithAddrInfo(int cause);
   bool WaitToConnect(uint32 milliseconds);
+  void EnableWriteBatching(uint32 max_delay_usec, uint32 max_bytes);
 
   void AddRequest(const gpb::Message* request, const RpcControlRequest& rpc_info,
                   const OutstandingCall& call, uint32 deadline);
 
+  // Fails the outstanding call with CANCELLED and asks the server to cancel it.
+  void CancelCall(int64 event_id);
+
 private:
   void ReplyHandler(strings::Slice cntrl, strings::Slice msg);
 
@@ -111,6 +120,9 @@ private:
 
 
   Executor* executor_ = nullptr;
+
+  // The event loop that serves the connection of this channel.
+  event_base* ebase_ = nullptr;
   Scheduler::handler_t alarmer_handler_id_;
 
   // TODO: consider using deque for outstanding_calls_. Since ids are monotonic,
@@ -123,6 +135,9 @@ private:
   // the back of the queue.
   std::deque<PendingDeadline> pending_deadlines_;
   std::unique_ptr<MessageReader> m_reader;
+
+  // Not null if write batching is enabled. Set once.
+  std::unique_ptr<PacketBatcher> batcher_;
 };
 
 Channel::Rep::~Rep() {
@@ -203,16 +218,21 @@ void Channel::Rep::ConnectWithAddrInfo(int cause) {
     if (state == SHUTTING_DOWN)
       return;
     FlushOutstanding();
-    this->bev.reset(bufferevent_socket_new(executor_->ebase(), -1,
+    this->bev.reset(bufferevent_socket_new(ebase_, -1,
                                            BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE),
                     bufferevent_deleter);
     m_reader.reset(new MessageReader(std::bind(&Channel::Rep::ReplyHandler, this, _1, _2),
                                      std::bind(&Channel::Rep::ReadErrorCallback, this)));
+    if (batcher_)
+      batcher_->Reset(bev);
     bufferevent_setcb(bev.get(), readcb, NULL, eventcb, this);
-    int status = bufferevent_socket_connect(bev.get(), serv_addr->ai_addr, serv_addr->ai_addrlen);
-    CHECK_EQ(status, 0) << evutil_socket_error_to_string(status);
     bufferevent_setwatermark(bev.get(), EV_READ, MessageReader::min_packet_size(), 0);
+
+    // Enable reading before connecting: a refused connect may run eventcb on the loop
+    // thread before bufferevent_socket_connect returns.
     bufferevent_enable(bev.get(), EV_READ);
+    int status = bufferevent_socket_connect(bev.get(), serv_addr->ai_addr, serv_addr->ai_addrlen);
+    CHECK_EQ(status, 0) << evutil_socket_error_to_string(status);
   }
   /*if (tmp != nullptr) {
     bufferevent_free(tmp);
@@ -230,6 +250,13 @@ bool Channel::Rep::WaitToConnect(uint32 milliseconds) {
   return true;
 }
 
+void Channel::Rep::EnableWriteBatching(uint32 max_delay_usec, uint32 max_bytes) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  CHECK(!batcher_) << "EnableWriteBatching can be called at most once";
+  batcher_.reset(new PacketBatcher(ebase_, max_delay_usec, max_bytes));
+  batcher_->Reset(bev);
+}
+
 void Channel::Rep::AddRequest(
     const gpb::Message* request, const RpcControlRequest& rpc_info,
     const OutstandingCall& call, uint32 deadline) {
@@ -248,8 +275,39 @@ void Channel::Rep::AddRequest(
     }
   }
   outstanding_calls_.emplace(id, call);
+  PacketBatcher* batcher = batcher_.get();
+  mutex_.unlock();
+  if (batcher) {
+    batcher->Write(rpc_info, request);
+  } else {
+    WriteRpcPacket(rpc_info, request, bufferevent_get_output(tmp.get()));
+  }
+}
+
+void Channel::Rep::CancelCall(int64 event_id) {
+  mutex_.lock();
+  auto it = outstanding_calls_.find(event_id);
+  if (it == outstanding_calls_.end()) {
+    mutex_.unlock();
+    return;
+  }
+  it->second.context->SetError(Status::CANCELLED);
+  auto task = ClosureFunc(it->second.done);
+  outstanding_calls_.erase(it);
+  PullPendindDeadline(event_id);
+  std::shared_ptr<bufferevent> tmp(bev);
+  PacketBatcher* batcher = batcher_.get();
   mutex_.unlock();
-  WriteRpcPacket(rpc_info, request, bufferevent_get_output(tmp.get()));
+
+  RpcControlRequest cancel_request;
+  cancel_request.set_command(RpcControlRequest::CANCEL);
+  cancel_request.set_event_id(event_id);
+  if (batcher) {
+    batcher->Write(cancel_request, nullptr);
+  } else if (tmp) {
+    WriteRpcPacket(cancel_request, nullptr, bufferevent_get_output(tmp.get()));
+  }
+  executor_->Add(task);
 }
 
 void Channel::Rep::ReplyHandler(strings::Slice cntrl, strings::Slice msg) {
@@ -387,6 +445,10 @@ void Channel::set_rpc_deadline(uint32 milliseconds) {
 }
 
 
+void Channel::EnableWriteBatching(uint32 max_delay_usec, uint32 max_bytes) {
+  rep_->EnableWriteBatching(max_delay_usec, max_bytes);
+}
+
 void Channel::CallMethod(const gpb::MethodDescriptor* method,
                          gpb::RpcController* controller,
                          const gpb::Message* request,
@@ -402,11 +464,17 @@ void Channel::CallMethod(const gpb::MethodDescriptor* method,
   }
 
   int64 id = next_id_.fetch_add(1);
+  uint32 deadline = deadline_.load();
   RpcControlRequest rpc_info;
   rpc_info.set_event_id(id);
   rpc_info.set_method_full_name(method->full_name());
+  if (deadline > 0) {
+    rpc_info.set_deadline_msec(deadline);
+  }
+  Rep* rep = rep_.get();
+  context->set_canceller([rep, id] { rep->CancelCall(id); });
   rep_->AddRequest(request, rpc_info, OutstandingCall{context, response, CHECK_NOTNULL(done)},
-                   deadline_.load());
+                   deadline);
 }
 
 }  // namespace rpc
@@ -49,8 +49,16 @@ class Channel : public gpb::RpcChannel {
   // If the deadline is set and the response was not received during the specified timeout,
   // then the done callback will be called and rpc::Context will return Status::DEADLINE_EXCEEDED.
   // The deadline is relevent only when sending requests and has no affect during
-  // WaitToConnect call.
+  // WaitToConnect call. It is also passed to the server, which does not run calls that expire
+  // before they start executing.
   void set_rpc_deadline(uint32 milliseconds);
+
+  // Enables pipelining of requests: calls issued within max_delay_usec from each other, or
+  // until max_bytes are pending, are coalesced into a single socket write.
+  // Trades up to max_delay_usec of latency for fewer syscalls. With max_delay_usec = 0 the
+  // calls issued before the event loop runs are written together, which also reduces the
+  // latency. Should be called before issuing calls.
+  void EnableWriteBatching(uint32 max_delay_usec, uint32 max_bytes = 1 << 16);
 private:
 
   class Rep;
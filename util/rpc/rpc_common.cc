@@ -3,9 +3,11 @@
 //
 #include "util/rpc/rpc_common.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <arpa/inet.h>  // inet_ntop
+#include <sys/socket.h>  // sendmsg
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/event.h>
@@ -31,27 +33,118 @@ void WriteRpcPacket(const ::google::protobuf::MessageLite& control,
   uint32 control_size = control.ByteSize();
   uint32 payload_size = payload ? payload->ByteSize() : 0;
   uint32 total_size = payload_size + control_size;
-
   DCHECK_GT(total_size, 0);
-  std::unique_ptr<uint8[]> data(new uint8[total_size]);
 
-  // TODO: wrap ev_buf as io::ZeroCopyOutputStream or to use evbuffer_reserve_space/ commit for
-  uint8* next = control.SerializeWithCachedSizesToArray(data.get());
+  const uint32 packet_size = kMagicStringSize + 6 + total_size;
+
+  // Must protect in order to make reserve/commit atomic.
+  evbuffer_lock(output);
+  evbuffer_iovec vec;
+  CHECK_EQ(1, evbuffer_reserve_space(output, packet_size, &vec, 1));
+  uint8* next = reinterpret_cast<uint8*>(vec.iov_base);
+  memcpy(next, kMagicString, kMagicStringSize);
+  next += kMagicStringSize;
+  LittleEndian::Store16(next, control_size);
+  LittleEndian::Store32(next + 2, payload_size);
+  next = control.SerializeWithCachedSizesToArray(next + 6);
   if (payload)
     payload->SerializeWithCachedSizesToArray(next);
-
-  uint8 tmp_buf[6];
-  LittleEndian::Store16(tmp_buf, control_size);
-  LittleEndian::Store32(tmp_buf + 2, payload_size);
-
-  evbuffer_lock(output); // Must protect in order to make multiple writes atomic.
-  CHECK_EQ(0, evbuffer_add(output, kMagicString, kMagicStringSize));
-  CHECK_EQ(0, evbuffer_add(output, tmp_buf, sizeof tmp_buf));
-  CHECK_EQ(0, evbuffer_add(output, data.get(), total_size));
+  vec.iov_len = packet_size;
+  CHECK_EQ(0, evbuffer_commit_space(output, &vec, 1));
   evbuffer_unlock(output);
   VLOG(2) << "WriteRpcPacket Finish";
 }
 
+PacketBatcher::PacketBatcher(event_base* base, uint32 max_delay_usec, uint32 max_bytes)
+    : pending_(evbuffer_new()), staging_(evbuffer_new()),
+      max_delay_usec_(max_delay_usec), max_bytes_(max_bytes) {
+  flush_event_ = CHECK_NOTNULL(event_new(base, -1, 0, flush_cb, this));
+}
+
+PacketBatcher::~PacketBatcher() {
+  // Waits for the running flush_cb to finish.
+  event_free(flush_event_);
+  evbuffer_free(pending_);
+  evbuffer_free(staging_);
+}
+
+void PacketBatcher::Reset(const std::shared_ptr<bufferevent>& bev) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  evbuffer_drain(pending_, evbuffer_get_length(pending_));
+  target_ = bev;
+}
+
+void PacketBatcher::Write(const gpb::MessageLite& control, const gpb::MessageLite* payload) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  WriteRpcPacket(control, payload, pending_);
+  if (state_ == ACTIVE)
+    return;
+
+  // Flushes always run on the event loop thread. We never touch the target output here,
+  // because Write() may be called from inside of the bufferevent callbacks that hold its lock.
+  // Activating a delayed event runs it immediately and removes its timeout.
+  if (max_delay_usec_ == 0 || evbuffer_get_length(pending_) >= max_bytes_) {
+    state_ = ACTIVE;
+    event_active(flush_event_, EV_TIMEOUT, 0);
+  } else if (state_ == IDLE) {
+    state_ = DELAYED;
+    timeval tv = {max_delay_usec_ / 1000000, max_delay_usec_ % 1000000};
+    event_add(flush_event_, &tv);
+  }
+}
+
+void PacketBatcher::flush_cb(int fd, short events, void* arg) {
+  reinterpret_cast<PacketBatcher*>(arg)->Flush();
+}
+
+void PacketBatcher::Flush() {
+  std::shared_ptr<bufferevent> bev;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    state_ = IDLE;
+    bev = target_.lock();
+    evbuffer_add_buffer(staging_, pending_);
+  }
+  VLOG(2) << "Flushing " << evbuffer_get_length(staging_) << " bytes";
+  if (!bev) {
+    evbuffer_drain(staging_, evbuffer_get_length(staging_));
+    return;
+  }
+
+  // The output shares its lock with the bufferevent, so nothing can be queued between the
+  // check and the send. If the output is empty, the batch goes to the socket right away.
+  // Going through the output would arm the write event, which costs a loop iteration and
+  // two epoll_ctl calls per batch. Whatever the socket does not take is left to the
+  // bufferevent.
+  bufferevent_lock(bev.get());
+  evbuffer* output = bufferevent_get_output(bev.get());
+  if (evbuffer_get_length(output) == 0) {
+    SendStaging(bufferevent_getfd(bev.get()));
+  }
+  if (evbuffer_get_length(staging_) > 0)
+    evbuffer_add_buffer(output, staging_);
+  bufferevent_unlock(bev.get());
+}
+
+void PacketBatcher::SendStaging(int fd) {
+  if (fd < 0)
+    return;
+  constexpr int kMaxChunks = 16;
+  evbuffer_iovec vec[kMaxChunks];  // Has the same layout as iovec.
+  int num_chunks = evbuffer_peek(staging_, -1, NULL, vec, kMaxChunks);
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = reinterpret_cast<iovec*>(vec);
+  msg.msg_iovlen = std::min(num_chunks, kMaxChunks);
+
+  // Errors, including EAGAIN on a socket that is still connecting, are left to the
+  // bufferevent, which sees them on its next write. MSG_NOSIGNAL avoids SIGPIPE on a closed
+  // connection.
+  ssize_t res = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (res > 0)
+    evbuffer_drain(staging_, res);
+}
+
 std::string PrintAddrInfo(const struct sockaddr* sock_addr, size_t addr_len) {
   string result;
   result.resize(INET6_ADDRSTRLEN, 0);
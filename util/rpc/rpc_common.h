@@ -4,9 +4,13 @@
 #ifndef _RPC_COMMON_H
 #define _RPC_COMMON_H
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include "base/integral_types.h"
 
+struct event;
+struct event_base;
 struct evbuffer;
 struct bufferevent;
 struct sockaddr;
@@ -24,9 +28,46 @@ namespace rpc {
 
 namespace gpb = ::google::protobuf;
 
+// Serializes the packet directly into the output buffer with a single evbuffer write.
 void WriteRpcPacket(const gpb::MessageLite& control, const gpb::MessageLite* payload,
                     evbuffer* output);
 
+// Coalesces rpc packets written by many threads into a single write to a bufferevent.
+// Packets are accumulated in a private buffer and moved into the output of the target
+// bufferevent by the event loop of base, either after max_delay_usec since the first pending
+// packet or as soon as max_bytes are pending. With max_delay_usec = 0 all packets written
+// before the loop gets to run are flushed together, i.e. once per loop iteration.
+// A flush writes to the socket directly if the bufferevent has no queued output.
+// The batcher does not own the target: packets pending when the target is closed are dropped.
+class PacketBatcher {
+ public:
+  PacketBatcher(event_base* base, uint32 max_delay_usec, uint32 max_bytes);
+  ~PacketBatcher();
+
+  // Drops pending packets and directs the following ones to bev.
+  void Reset(const std::shared_ptr<bufferevent>& bev);
+
+  // Thread-safe.
+  void Write(const gpb::MessageLite& control, const gpb::MessageLite* payload);
+
+ private:
+  static void flush_cb(int fd, short events, void* arg);
+  void Flush();
+
+  // Sends as much of staging_ as the socket accepts without blocking.
+  void SendStaging(int fd);
+
+  std::mutex mutex_;
+  std::weak_ptr<bufferevent> target_;
+  evbuffer* pending_;
+  evbuffer* staging_;  // accessed only by Flush() on the event loop thread.
+  event* flush_event_;
+  enum { IDLE, DELAYED, ACTIVE } state_ = IDLE;
+
+  const uint32 max_delay_usec_;
+  const uint32 max_bytes_;
+};
+
 std::string PrintAddrInfo(const struct sockaddr* sock_addr, size_t addr_len);
 
 class ClosureRunner {
@@ -18,5 +18,68 @@ bool Context::Failed() const {
 Context::~Context() {
 }
 
+void Context::Reset() {
+  std::lock_guard<std::mutex> lk(mu_);
+  DCHECK(cancel_cb_ == nullptr);
+  status_.Clear();
+  canceled_.store(false, std::memory_order_relaxed);
+  canceller_ = nullptr;
+}
+
+std::string Context::ErrorText() const {
+  if (!Failed())
+    return std::string();
+  std::string res = Status::Code_Name(status_.code());
+  if (!status_.details().empty()) {
+    res.append(": ").append(status_.details());
+  }
+  return res;
+}
+
+void Context::StartCancel() {
+  std::function<void()> f;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    f.swap(canceller_);
+  }
+  if (f)
+    f();
+}
+
+void Context::NotifyOnCancel(::google::protobuf::Closure* callback) {
+  std::unique_lock<std::mutex> lk(mu_);
+  CHECK(cancel_cb_ == nullptr) << "NotifyOnCancel must be called no more than once";
+  if (!canceled_.load(std::memory_order_relaxed)) {
+    cancel_cb_ = callback;
+    return;
+  }
+  lk.unlock();
+  callback->Run();
+}
+
+void Context::set_canceller(std::function<void()> f) {
+  std::lock_guard<std::mutex> lk(mu_);
+  canceller_.swap(f);
+}
+
+::google::protobuf::Closure* Context::Cancel() {
+  std::lock_guard<std::mutex> lk(mu_);
+  canceled_.store(true, std::memory_order_release);
+  ::google::protobuf::Closure* cb = cancel_cb_;
+  cancel_cb_ = nullptr;
+  return cb;
+}
+
+void Context::Finish() {
+  ::google::protobuf::Closure* cb;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    cb = cancel_cb_;
+    cancel_cb_ = nullptr;
+  }
+  if (cb)
+    cb->Run();
+}
+
 }  // namespace util
 }  // namespace util
@@ -4,7 +4,10 @@
 #ifndef _RPC_CONTEXT_H
 #define _RPC_CONTEXT_H
 
+#include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <google/protobuf/service.h>
 
 #include "base/logging.h"
@@ -13,6 +16,9 @@
 namespace util {
 namespace rpc {
 
+class Channel;
+class ServerConnection;
+
 class Context : public ::google::protobuf::RpcController {
  public:
   inline Context() {}
@@ -27,9 +33,7 @@ class Context : public ::google::protobuf::RpcController {
 
   // Resets the RpcController to its initial state so that it may be reused in
   // a new call.  Must not be called while an RPC is in progress.
-  virtual void Reset() {
-    LOG(FATAL) << "Not implemented";
-  }
+  virtual void Reset();
 
   // After a call has finished, returns true if the call failed.  The possible
   // reasons for failure depend on the RPC implementation.  Failed() must not
@@ -38,19 +42,16 @@ class Context : public ::google::protobuf::RpcController {
   virtual bool Failed() const;
 
   // If Failed() is true, returns a human-readable description of the error.
-  virtual std::string ErrorText() const {
-    LOG(FATAL) << "Not implemented";
-    return "";
-  }
+  virtual std::string ErrorText() const;
 
   // Advises the RPC system that the caller desires that the RPC call be
   // canceled.  The RPC system may cancel it immediately, may wait awhile and
   // then cancel it, or may not even cancel the call at all.  If the call is
   // canceled, the "done" callback will still be called and the RpcController
   // will indicate that the call failed at that time.
-  virtual void StartCancel() {
-    LOG(FATAL) << "Not implemented";
-  }
+  // Our channel fails the call immediately with CANCELLED and asks the server to cancel it.
+  // Must be called only while the call is in progress.
+  virtual void StartCancel();
 
   // Server-side methods ---------------------------------------------
   // These calls may be made from the server side only.  Their results
@@ -67,7 +68,7 @@ class Context : public ::google::protobuf::RpcController {
   // as well give up on replying to it.  The server should still call the
   // final "done" callback.
   virtual bool IsCanceled() const {
-    return false;
+    return canceled_.load(std::memory_order_acquire);
   }
 
   // Asks that the given callback be called when the RPC is canceled.  The
@@ -77,9 +78,7 @@ class Context : public ::google::protobuf::RpcController {
   // will be called immediately.
   //
   // NotifyOnCancel() must be called no more than once per request.
-  virtual void NotifyOnCancel(::google::protobuf::Closure* callback) {
-    LOG(FATAL) << "Not implemented";
-  }
+  virtual void NotifyOnCancel(::google::protobuf::Closure* callback);
 
   const Status& status() const { return status_; }
 
@@ -95,7 +94,26 @@ class Context : public ::google::protobuf::RpcController {
       status_.set_details(details);
   }
  private:
+  friend class Channel;
+  friend class ServerConnection;
+
+  // Client side: set by the channel for the duration of the call.
+  void set_canceller(std::function<void()> f);
+
+  // Server side: marks the call as canceled. Returns the NotifyOnCancel callback, if any,
+  // which the caller must run.
+  ::google::protobuf::Closure* Cancel();
+
+  // Server side: runs the NotifyOnCancel callback, if it was not run yet, once the call
+  // completes.
+  void Finish();
+
   Status status_;
+
+  std::mutex mu_;
+  std::atomic_bool canceled_{false};
+  std::function<void()> canceller_;
+  ::google::protobuf::Closure* cancel_cb_ = nullptr;
 };
 
 class DoneBarrier : public ::google::protobuf::Closure {
@@ -1,21 +1,36 @@
 // Copyright 2013, Beeri 15.  All rights reserved.
 // Author: Roman Gershman (romange@gmail.com)
 //
+#include <event2/thread.h>
+#include "base/allocation_counter.h"
 #include "base/googleinit.h"
+#include "base/histogram.h"
+#include "strings/strcat.h"
 #include "util/rpc/rpc_sample.pb.h"
 
-#include "util/rpc/executor.h"
+#include "util/executor.h"
 #include "util/rpc/rpc_channel.h"
 #include "util/rpc/rpc_context.h"
+#include "util/rpc/rpc_server2.h"
 #include <thread>
 #include <iostream>
 #include <atomic>
 #include <chrono>
+#include <mutex>
 
-DEFINE_string(address, "", "Host:Port pair.");
+DEFINE_string(address, "", "Host:Port pair. If empty, runs an in-process server on --port.");
+DEFINE_int32(port, 45001, "Port of the in-process server.");
+DEFINE_int32(server_loops, 1, "Number of event loops of the in-process server.");
+DEFINE_int32(client_loops, 1, "Number of event loops serving the client channels.");
+DEFINE_int32(num_channels, 1, "Number of channels, each driven by its own thread.");
+DEFINE_int32(batch_delay_usec, -1, "If non-negative, enables batching of channel writes "
+             "with this delay and batching of in-process server replies.");
+DEFINE_int32(payload_size, 0, "If positive, requests carry a payload of this size and the "
+             "in-process server echoes it back.");
+DEFINE_int32(service_usec, 0, "Cpu time the in-process server spends on each call.");
+DEFINE_int32(max_queued_calls, 0, "Load shedding threshold of the in-process server.");
 DEFINE_int32(num_requests, 1000, "");
 DEFINE_int32(num_bursts, 10, "");
-//DEFINE_int32(num_threads, 10, "");
 DEFINE_int32(deadline, 100, "");
 DEFINE_int32(sleep, 1, "");
 
@@ -27,10 +42,33 @@ static std::atomic_ulong total_timeouts(0);
 static std::atomic_ullong total_time(0);
 static std::atomic_ulong total_success(0);
 static std::atomic_long pending_calls(0);
+static std::atomic_ulong server_calls(0);
+
+// Latencies of successful calls in microseconds.
+static std::mutex latency_mu;
+static base::Histogram latency_hist;
 
 namespace util {
 namespace rpc {
 
+class TestRpcServiceImpl : public TestRpcService {
+ public:
+  void func1(gpb::RpcController* controller, const Request* request,
+             Response* response, gpb::Closure* done) override {
+    ++server_calls;
+    if (FLAGS_service_usec > 0) {
+      auto end = chrono::steady_clock::now() + chrono::microseconds(FLAGS_service_usec);
+      while (chrono::steady_clock::now() < end) {}
+    }
+    if (request->name().empty()) {
+      response->set_result("Hello World!");
+    } else {
+      response->set_result(request->name());
+    }
+    done->Run();
+  }
+};
+
 struct PendingCall {
   Request request;
   Response response;
@@ -53,16 +91,21 @@ void DoneCallback(PendingCall* call) {
   else {
     total_time += duration.count();
     ++total_success;
+    std::lock_guard<std::mutex> lk(latency_mu);
+    latency_hist.Add(duration.count() / 1000.0);
   }
 }
 
-void ClientFunction() {
-  std::unique_ptr<Channel> channel(new Channel(&Executor::Default(), FLAGS_address));
-  std::unique_ptr<TestRpcService::Stub> stub(new TestRpcService::Stub(channel.get()));
+void ClientFunction(Channel* channel) {
+  std::unique_ptr<TestRpcService::Stub> stub(new TestRpcService::Stub(channel));
+  channel->set_rpc_deadline(FLAGS_deadline);
+  const string payload(FLAGS_payload_size, 'a');
 
   for (int i = 0;  i < FLAGS_num_requests; ++i) {
     for (int j = 0; j < FLAGS_num_bursts; ++j) {
       PendingCall* call = new PendingCall;
+      if (!payload.empty())
+        call->request.set_name(payload);
       call->start = chrono::system_clock::now();
       stub->func1(&call->context, &call->request, &call->response,
                   gpb::NewCallback(DoneCallback, call));
@@ -76,18 +119,69 @@ void ClientFunction() {
 
 int main(int argc, char **argv) {
   MainInitGuard guard(&argc, &argv);
-  CHECK(!FLAGS_address.empty());
+  CHECK_EQ(0, evthread_use_pthreads());
+
+  util::rpc::TestRpcServiceImpl service;
+  std::unique_ptr<util::Executor> server_executor;
+  std::unique_ptr<util::rpc::RpcServer> server;
+  string address = FLAGS_address;
+  if (address.empty()) {
+    server_executor.reset(new util::Executor(0, FLAGS_server_loops));
+    server.reset(new util::rpc::RpcServer("LoadTestServer"));
+    server->ExportService(&service);
+    if (FLAGS_batch_delay_usec >= 0)
+      server->EnableReplyBatching();
+    server->set_max_queued_calls(FLAGS_max_queued_calls);
+    server->Open(FLAGS_port, server_executor.get());
+    address = StrCat("localhost:", FLAGS_port);
+  }
+
+  util::Executor client_executor(0, FLAGS_client_loops);
+  std::vector<std::unique_ptr<util::rpc::Channel>> channels;
+  for (int i = 0; i < FLAGS_num_channels; ++i) {
+    channels.emplace_back(new util::rpc::Channel(&client_executor, address));
+    if (FLAGS_batch_delay_usec >= 0)
+      channels.back()->EnableWriteBatching(FLAGS_batch_delay_usec);
+    CHECK(channels.back()->WaitToConnect(1000)) << "Could not connect to " << address;
+  }
+
+  uint64 start_allocations = base::NumAllocations();
   auto start = chrono::system_clock::now();
-  unsigned long total_requests = FLAGS_num_requests*FLAGS_num_bursts;
+  unsigned long total_requests = FLAGS_num_requests*FLAGS_num_bursts*FLAGS_num_channels;
 
-  util::rpc::ClientFunction();
+  std::vector<std::thread> client_threads;
+  for (auto& channel : channels) {
+    client_threads.emplace_back(util::rpc::ClientFunction, channel.get());
+  }
+  for (auto& t : client_threads) {
+    t.join();
+  }
 
   while (total_success + total_timeouts < total_requests) {
      this_thread::sleep_for(milliseconds(20));
   }
+  LOG(INFO) << "Server loops: " << FLAGS_server_loops << ", client loops: " << FLAGS_client_loops
+            << ", channels: " << FLAGS_num_channels << ", batch delay: " << FLAGS_batch_delay_usec;
   LOG(INFO) << "Timeout ratio: " << double(total_timeouts) / total_requests;
+  uint64 allocations = base::NumAllocations() - start_allocations;
   LOG(INFO) << "Average latency " << double(total_time)/(1000000.0*total_success);
+  LOG(INFO) << "Latency usec p50: " << latency_hist.Percentile(50)
+            << ", p99: " << latency_hist.Percentile(99)
+            << ", p99.9: " << latency_hist.Percentile(99.9);
+  LOG(INFO) << "Allocations per request: " << double(allocations) / total_requests;
+  if (server) {
+    LOG(INFO) << "Calls executed by the server: " << server_calls;
+  }
   auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now() - start);
   LOG(INFO) << "QPS: " <<  double(total_requests)/ duration.count()*1000.0;
+
+  channels.clear();
+  client_executor.Shutdown();
+  client_executor.WaitForLoopToExit();
+  server.reset();
+  if (server_executor) {
+    server_executor->Shutdown();
+    server_executor->WaitForLoopToExit();
+  }
   return 0;
-}
\ No newline at end of file
+}
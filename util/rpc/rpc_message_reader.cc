@@ -20,6 +20,13 @@ constexpr uint8 kMagicPrefixLen = sizeof kMagicPrefix;
 constexpr uint8 kHeaderSize = kMagicPrefixLen + 6;
 constexpr uint32 kMaxPacketSize = 1024*1024*10;  // 10MB
 
+// Frames that are contiguous in the input buffer are passed to the callback directly from the
+// evbuffer memory. Fragmented frames up to this size are kept in the input buffer until they are
+// received completely and then linearized with evbuffer_pullup. Larger fragmented frames are
+// copied into msg_control_/msg_payload_ as they arrive: pulling them up would make libevent
+// allocate a new chain for each frame, while our buffers are reused.
+constexpr uint32 kMaxPullupSize = 4096;
+
 
 // The frame format is:
 // 1. kMagicPrefix
@@ -52,11 +59,28 @@ void MessageReader::ParseData(struct evbuffer* input) {
         state_ = FATAL_ERROR;
         return;
       }
+      size_t frame_size = kHeaderSize + control_size + payload_size;
+      size_t contiguous_len = evbuffer_get_contiguous_space(input);
       VLOG(2) << "Contrl size " << control_size << ", payload size: " << payload_size
-              << ", len: " << evbuffer_get_length(input) << ", contigious len: "
-              << evbuffer_get_contiguous_space(input);
+              << ", len: " << len << ", contigious len: " << contiguous_len;
+
+      if (contiguous_len >= frame_size || frame_size <= kMaxPullupSize) {
+        if (len < frame_size) {
+          // Wait for the rest of the frame.
+          break;
+        }
+        // Does not copy if the frame is contiguous.
+        const char* frame = reinterpret_cast<const char*>(evbuffer_pullup(input, frame_size));
+        CHECK(frame != nullptr);
+        const char* control = frame + kHeaderSize;
+        rpc_cb_(strings::Slice(control, control_size),
+                strings::Slice(control + control_size, payload_size));
+        evbuffer_drain(input, frame_size);
+        continue;
+      }
 
-      // TODO: to use evbuffer_get_contiguous_space to save allocation.
+      // Fragmented large frame.
+      evbuffer_drain(input, kHeaderSize);
       msg_control_.resize(control_size);
       msg_payload_.resize(payload_size);
       next_ptr_ = &msg_control_.front();
@@ -122,7 +146,10 @@ bool MessageReader::ParseStartRpcHeader(struct evbuffer* input,
   }
   buf += 2;
   *payload_size = LittleEndian::Load32(buf);
-  evbuffer_drain(input, kHeaderSize);
+  if (*payload_size > kMaxPacketSize) {
+    LOG(ERROR) << "Payload size " << *payload_size << " exceeds the limit";
+    return false;
+  }
   return true;
 }
 
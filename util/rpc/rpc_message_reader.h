@@ -4,6 +4,7 @@
 #ifndef _RPC_MESSAGE_READER_H
 #define _RPC_MESSAGE_READER_H
 
+#include <functional>
 #include <string>
 #include "strings/slice.h"
 
@@ -30,9 +31,12 @@ class MessageReader {
 
   void ReadData(struct evbuffer* input);
 
+  // Peeks into the header without consuming it.
   bool ParseStartRpcHeader(struct evbuffer* input, uint32* ctrl_size, uint32* payload_size);
 
 public:
+  // control and payload may point directly into the input evbuffer and are valid only during
+  // the call. The callback should parse them (e.g. with ParseFromArray) and not keep them.
   typedef std::function<void(strings::Slice control, strings::Slice payload)> MessageCallback;
   typedef std::function<void()> ErrorCallback;
 
@@ -48,7 +52,8 @@ public:
   static size_t min_packet_size();
 
 private:
-  std::string msg_control_;  // buffer for storing the packet.
+  // buffers for storing large fragmented packets.
+  std::string msg_control_;
   std::string msg_payload_;
 
   char* next_ptr_ = nullptr;
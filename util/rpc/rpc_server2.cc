@@ -21,10 +21,13 @@
 
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/service.h>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <thread>
+#include <vector>
 
 using namespace std::placeholders;
 using std::string;
@@ -45,6 +48,11 @@ void ReplyError(evbuffer* output, int64 event_id, Status::Code code,
   WriteRpcPacket(response, nullptr, output);
 }
 
+inline uint64 SteadyMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 http::VarzMapCount rpc_requests("rpc_requests");
 http::VarzMapAverage rpc_latency("rpc_latency(ms)");
 
@@ -63,11 +71,24 @@ struct RpcServer::Rep {
 
   std::unordered_map<std::string, gpb::Service*> services_;
 
+  struct MethodInfo {
+    std::string received_varz;
+    std::unique_ptr<CallPool> call_pool;
+  };
+
+  // Maps full method names of the exported services. Built by Open and immutable afterwards.
+  std::unordered_map<std::string, MethodInfo> methods_;
+
   bool IsOpen() const { return listener_ != nullptr; }
 
   std::unique_ptr<http::Server> http_server;
   string name;
+  bool batch_replies = false;
+  uint32 max_queued_calls = 0;
 private:
+  // Runs in a pool thread of the executor.
+  void RunCall(ServerConnection::Call* call);
+
   static void accept_error_cb(struct evconnlistener *listener, void *ctx) {
     int err = EVUTIL_SOCKET_ERROR();
     LOG(ERROR) << "Got an error " << err << " " << evutil_socket_error_to_string(err)
@@ -78,12 +99,25 @@ private:
                              int sokcet_fd, struct sockaddr *address, int socklen,
                              void *ctx);
 
+  // Returns the index of the event loop with the least open connections.
+  // Ties are broken in round-robin order.
+  unsigned PickEventLoop();
+
   struct evconnlistener* listener_ = nullptr;
 
   Executor* executor_ = nullptr;
 
   // modified only by the accept_conn_cb() or by destructor.
   std::unordered_set<ServerConnection*> connections_;
+
+  // Number of open connections per event loop. Incremented by accept_conn_cb() and
+  // decremented by the event loop thread that closes the connection.
+  std::unique_ptr<std::atomic<unsigned>[]> loop_connections_;
+  unsigned num_loops_ = 0;
+  unsigned next_loop_ = 0;
+
+  // Calls that were passed to the executor but did not start running yet.
+  std::atomic<uint32> queued_calls_{0};
 };
 
 RpcServer::Rep::~Rep() {
@@ -106,53 +140,97 @@ RpcServer::Rep::~Rep() {
   std::this_thread::sleep_for(std::chrono::milliseconds(140));
 }
 
-// The following function runs in base_event_loop thread.
+// The following function runs in the event loop thread of the connection.
 // TODO: should not call any user code directly.
 void RpcServer::Rep::IncomingRpcHandler(ServerConnection* conn, strings::Slice cntrl,
                                         strings::Slice msg) {
-  RpcControlRequest request;
+  RpcControlRequest& request = *conn->control_request();
   CHECK(request.ParseFromArray(cntrl.data(), cntrl.size()));
   VLOG(2) << request.ShortDebugString() << ",   payload size " << msg.size();
-  size_t pos = request.method_full_name().rfind('.');
-  CHECK_NE(pos, string::npos);
-  string service_name = request.method_full_name().substr(0, pos);
+  if (request.command() == RpcControlRequest::CANCEL) {
+    rpc_requests.Inc("cancel-received");
+    conn->CancelCall(request.event_id());
+    return;
+  }
   std::shared_ptr<bufferevent> tmp(conn->bev());
   if (!tmp)
     return;
-  evbuffer* output = bufferevent_get_output(tmp.get());
 
-  // services_ is immutable when rpc server is running.
-  auto it = services_.find(service_name);
-  if (it == services_.end()) {
-    ReplyError(output, request.event_id(), Status::INVALID_SERVICE, service_name);
+  // methods_ is immutable when rpc server is running.
+  auto it = methods_.find(request.method_full_name());
+  if (it == methods_.end()) {
+    evbuffer* output = bufferevent_get_output(tmp.get());
+    size_t pos = request.method_full_name().rfind('.');
+    CHECK_NE(pos, string::npos);
+    string service_name = request.method_full_name().substr(0, pos);
+    if (services_.find(service_name) == services_.end()) {
+      ReplyError(output, request.event_id(), Status::INVALID_SERVICE, service_name);
+    } else {
+      ReplyError(output, request.event_id(), Status::INVALID_METHOD,
+                 request.method_full_name());
+    }
     return;
   }
-  gpb::Service* service = it->second;
-  const gpb::ServiceDescriptor* sdescr = CHECK_NOTNULL(service->GetDescriptor());
+  rpc_requests.Inc(it->second.received_varz);
 
-  string method_name = request.method_full_name().substr(pos + 1);
-  const gpb::MethodDescriptor* mdescr = sdescr->FindMethodByName(method_name);
-  if (mdescr == nullptr) {
-    ReplyError(output, request.event_id(), Status::INVALID_METHOD, request.method_full_name());
+  // Shed the load early, before we spend any cpu on the call.
+  if (max_queued_calls > 0 && queued_calls_.load(std::memory_order_relaxed) >= max_queued_calls) {
+    rpc_requests.Inc("overloaded");
+    ReplyError(bufferevent_get_output(tmp.get()), request.event_id(), Status::OVERLOADED);
     return;
   }
-  rpc_requests.Inc(StrCat(mdescr->name(), "-received"));
 
-  ServerConnection::Call* call =
-      conn->AllocateCall(request.event_id(), service->GetRequestPrototype(mdescr).New(),
-                         service->GetResponsePrototype(mdescr).New());
+  ServerConnection::Call* call = conn->AllocateCall(request.event_id(),
+                                                    it->second.call_pool.get());
   CHECK(call->msg_request->ParseFromArray(msg.data(), msg.size()));
+  if (request.has_deadline_msec()) {
+    call->deadline_usec = SteadyMicros() + uint64(request.deadline_msec()) * 1000;
+  }
+
+  // The closure is small enough to avoid a heap allocation.
+  queued_calls_.fetch_add(1, std::memory_order_relaxed);
+  executor_->Add([this, call] { RunCall(call); });
+}
+
+void RpcServer::Rep::RunCall(ServerConnection::Call* call) {
+  queued_calls_.fetch_sub(1, std::memory_order_relaxed);
 
-  executor_->Add(std::bind(&gpb::Service::CallMethod, service,
-                           mdescr, &call->context, call->msg_request.get(),
-                           call->msg_response.get(),
-                           gpb::NewCallback(conn, &ServerConnection::ReplierCb, call)));
+  // The client has already given up on these calls.
+  if (call->context.IsCanceled()) {
+    rpc_requests.Inc("canceled");
+    call->context.SetError(Status::CANCELLED);
+    call->Run();
+    return;
+  }
+  if (call->deadline_usec && SteadyMicros() >= call->deadline_usec) {
+    rpc_requests.Inc("expired");
+    call->context.SetError(Status::DEADLINE_EXCEEDED);
+    call->Run();
+    return;
+  }
+  CallPool* pool = call->pool;
+  pool->service()->CallMethod(pool->method(), &call->context, call->msg_request.get(),
+                              call->msg_response.get(), call);
 }
 
 void RpcServer::Rep::Open(const sockaddr_in& addr, Executor* executor) {
   CHECK(executor_ == nullptr) << "Open() can be called only once.";
 
   executor_ = executor;
+  num_loops_ = executor->num_event_loops();
+  loop_connections_.reset(new std::atomic<unsigned>[num_loops_]);
+  for (unsigned i = 0; i < num_loops_; ++i)
+    loop_connections_[i] = 0;
+  for (const auto& name_service : services_) {
+    gpb::Service* service = name_service.second;
+    const gpb::ServiceDescriptor* sdescr = service->GetDescriptor();
+    for (int i = 0; i < sdescr->method_count(); ++i) {
+      const gpb::MethodDescriptor* mdescr = sdescr->method(i);
+      MethodInfo& info = methods_[mdescr->full_name()];
+      info.received_varz = StrCat(mdescr->name(), "-received");
+      info.call_pool.reset(new CallPool(service, mdescr));
+    }
+  }
   const sockaddr* saddr = reinterpret_cast<const sockaddr*>(&addr);
   int rpc_port = ntohs(addr.sin_port);
   listener_ = evconnlistener_new_bind(
@@ -175,32 +253,54 @@ void RpcServer::Rep::Open(const sockaddr_in& addr, Executor* executor) {
   }
 }
 
-// Runs in event thread.
+unsigned RpcServer::Rep::PickEventLoop() {
+  unsigned res = next_loop_ % num_loops_;
+  unsigned res_load = loop_connections_[res].load(std::memory_order_relaxed);
+  for (unsigned i = 1; i < num_loops_; ++i) {
+    unsigned index = (next_loop_ + i) % num_loops_;
+    unsigned load = loop_connections_[index].load(std::memory_order_relaxed);
+    if (load < res_load) {
+      res = index;
+      res_load = load;
+    }
+  }
+  next_loop_ = res + 1;
+  return res;
+}
+
+// Runs in the main event thread. The connection is served by the least loaded event loop:
+// its socket reads, message parsing and reply writes all run on that loop's thread.
 void RpcServer::Rep::accept_conn_cb(struct evconnlistener *listener,
                                     int socket_fd, struct sockaddr *address, int socklen,
                                     void *ctx) {
-  struct event_base* base = evconnlistener_get_base(listener);
-  struct bufferevent* bev = bufferevent_socket_new(base, socket_fd,
-     BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
-
   RpcServer::Rep* me = reinterpret_cast<RpcServer::Rep*>(ctx);
-  ServerConnection* conn =
-      new ServerConnection(bev, std::bind(&Rep::IncomingRpcHandler, me, _1, _2, _3));
-
-  VLOG(1) << "Accepting connection from " << PrintAddrInfo(address, socklen)
-          << ", socket_fd = " << bufferevent_getfd(bev);
 
   // GC unused connections.
   // we can either add a pointer to Rep in ServerConnection or do it in O(n) every time.
   auto it = me->connections_.begin();
   while (it != me->connections_.end()) {
-    if (!(*it)->bev()) {
+    if ((*it)->closed()) {
       (*it)->DecRef();
       it = me->connections_.erase(it);
     } else {
       ++it;
     }
   }
+
+  unsigned loop_index = me->PickEventLoop();
+  struct bufferevent* bev = bufferevent_socket_new(me->executor_->ebase(loop_index), socket_fd,
+     BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
+
+  std::atomic<unsigned>* load = &me->loop_connections_[loop_index];
+  load->fetch_add(1, std::memory_order_relaxed);
+  ServerConnection* conn =
+      new ServerConnection(bev, std::bind(&Rep::IncomingRpcHandler, me, _1, _2, _3),
+                           me->batch_replies,
+                           [load] { load->fetch_sub(1, std::memory_order_relaxed); });
+
+  VLOG(1) << "Accepting connection from " << PrintAddrInfo(address, socklen)
+          << ", socket_fd = " << bufferevent_getfd(bev) << ", event loop " << loop_index;
+
   me->connections_.insert(conn);
   VLOG(2) << "accept_conn_cb Exit\n\n";
 }
@@ -221,6 +321,16 @@ void RpcServer::ExportService(gpb::Service* service) {
                        << s_descr->full_name();
 }
 
+void RpcServer::EnableReplyBatching() {
+  CHECK(!rep_->IsOpen()) << "EnableReplyBatching should be called before RpcServer::Open";
+  rep_->batch_replies = true;
+}
+
+void RpcServer::set_max_queued_calls(uint32 max_queued_calls) {
+  CHECK(!rep_->IsOpen()) << "set_max_queued_calls should be called before RpcServer::Open";
+  rep_->max_queued_calls = max_queued_calls;
+}
+
 void RpcServer::Open(int port, Executor* executor) {
   struct sockaddr_in my_addr;
   memset(&my_addr, 0, sizeof(my_addr));
@@ -6,6 +6,7 @@
 
 #include <memory>
 #include <string>
+#include "base/integral_types.h"
 
 namespace google {
 namespace protobuf {
@@ -30,10 +31,21 @@ public:
   explicit RpcServer(const std::string& name, http::Server* server = nullptr);
 
   ~RpcServer();
+
+  // Starts listening on the port. Incoming connections are spread across the event loops
+  // of the executor and rpc handlers run on its pool threads.
   void Open(int port, Executor* executor);
 
   void ExportService(::google::protobuf::Service* service);
 
+  // Replies that become ready during the same event loop iteration are written to their
+  // connection with a single socket write. Should be called before Open.
+  void EnableReplyBatching();
+
+  // Rejects new calls with Status::OVERLOADED while max_queued_calls calls are waiting for
+  // a pool thread. 0 means no limit. Should be called before Open.
+  void set_max_queued_calls(uint32 max_queued_calls);
+
   http::Server* http_server();
 private:
   std::unique_ptr<Rep> rep_;
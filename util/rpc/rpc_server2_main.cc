@@ -12,6 +12,7 @@
 #include "util/rpc/rpc_sample.pb.h"
 
 DEFINE_int32(port, 45000, "server port");
+DEFINE_int32(event_loops, 1, "Number of event loops serving the connections");
 
 namespace gpb = ::google::protobuf;
 
@@ -35,9 +36,10 @@ int main(int argc, char **argv) {
 
   util::rpc::RpcServer server("SampleRpcServer");
   server.ExportService(&test_service);
-  util::Executor* executor = &util::Executor::Default();
-  server.Open(FLAGS_port, executor);
-  executor->WaitForLoopToExit();
+  util::Executor executor(0, FLAGS_event_loops);
+  executor.StopOnTermSignal();
+  server.Open(FLAGS_port, &executor);
+  executor.WaitForLoopToExit();
 
   return 0;
 }
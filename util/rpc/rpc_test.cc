@@ -4,6 +4,7 @@
 #include "util/rpc/rpc_channel.h"
 
 #include <array>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <memory>
@@ -14,7 +15,7 @@
 #include <gtest/gtest.h>
 
 #include "base/logging.h"
-#include "util/rpc/executor.h"
+#include "util/executor.h"
 #include "util/rpc/rpc_sample.pb.h"
 #include "util/rpc/rpc_context.h"
 #include "util/rpc/rpc_server2.h"
@@ -31,12 +32,23 @@ static const char kTestString[] = "Hello World, ";
 class TestRpcServiceImpl : public TestRpcService {
  public:
   uint32 msec_delay = 0;
+
+  // If set, blocks the calling pool thread.
+  uint32 sync_msec_delay = 0;
+  std::atomic_int num_calls{0};
+
   virtual void func1(gpb::RpcController* controller,
                      const ::rpc::testing::Request* request,
                      ::rpc::testing::Response* response,
                      gpb::Closure* done) {
+    ++num_calls;
     string str(kTestString);
     response->set_result(str + request->name());
+    if (sync_msec_delay > 0) {
+      std::this_thread::sleep_for(milliseconds(sync_msec_delay));
+      done->Run();
+      return;
+    }
     /*std::this_thread::sleep_for(milliseconds(msec_delay));
     done->Run();*/
 
@@ -61,6 +73,7 @@ protected:
 
   void TearDown() override {
     rpc_server_.reset(nullptr);
+    server_executor_.reset(nullptr);
     channel_.reset(nullptr);
     VLOG(1) << "Closing executor";
     executor_.reset(nullptr);
@@ -72,7 +85,20 @@ protected:
     rpc_server_->Open(45000, executor_.get());
   }
 
+  // Restarts the server on a single pool thread and reconnects the channel.
+  void RestartSingleThreadServer(uint32 max_queued_calls) {
+    rpc_server_.reset(nullptr);
+    server_executor_.reset(new Executor(1));
+    rpc_server_.reset(new RpcServer("TestRpcServer"));
+    rpc_server_->ExportService(&service_impl_);
+    rpc_server_->set_max_queued_calls(max_queued_calls);
+    rpc_server_->Open(45000, server_executor_.get());
+    channel_.reset(new Channel(executor_.get(), "localhost:45000"));
+    stub_.reset(new TestRpcService::Stub(channel_.get()));
+  }
+
   std::unique_ptr<Executor> executor_;
+  std::unique_ptr<Executor> server_executor_;
   std::unique_ptr<TestRpcService::Stub> stub_;
   std::unique_ptr<Channel> channel_;
   TestRpcServiceImpl service_impl_;
@@ -171,5 +197,97 @@ TEST_F(RpcTest, ConnectionStopped) {
   EXPECT_EQ(Status::CONNECTION_REFUSED, rpc4.status().code());
 }
 
+TEST_F(RpcTest, Cancel) {
+  ASSERT_TRUE(channel_->WaitToConnect(1000));
+  service_impl_.msec_delay = 200;
+
+  auto start = steady_clock::now();
+  stub_->func1(&rpc_context_, &request_, &response_, &barrier_);
+  rpc_context_.StartCancel();
+  ASSERT_TRUE(barrier_.Wait(100));
+  EXPECT_EQ(Status::CANCELLED, rpc_context_.status().code());
+  EXPECT_EQ("CANCELLED", rpc_context_.ErrorText());
+  EXPECT_LT(duration_cast<milliseconds>(steady_clock::now() - start).count(), 100);
+
+  // Make sure that server callbacks are run.
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+}
+
+TEST_F(RpcTest, Overloaded) {
+  RestartSingleThreadServer(1);
+  ASSERT_TRUE(channel_->WaitToConnect(1000));
+  service_impl_.sync_msec_delay = 50;
+
+  // At most one call runs and one waits in the queue, the rest are rejected.
+  constexpr int kNumCalls = 6;
+  std::array<Response, kNumCalls> responses;
+  std::array<Context, kNumCalls> contexts;
+  std::array<DoneBarrier, kNumCalls> done_barriers;
+  for (int i = 0; i < kNumCalls; ++i) {
+    stub_->func1(&contexts[i], &request_, &responses[i], &done_barriers[i]);
+  }
+  int num_ok = 0, num_overloaded = 0;
+  for (int i = 0; i < kNumCalls; ++i) {
+    ASSERT_TRUE(done_barriers[i].Wait(1000));
+    if (contexts[i].status().code() == Status::OK) {
+      ++num_ok;
+    } else if (contexts[i].status().code() == Status::OVERLOADED) {
+      ++num_overloaded;
+    }
+  }
+  EXPECT_GE(num_ok, 1);
+  EXPECT_LE(num_ok, 2);
+  EXPECT_EQ(kNumCalls, num_ok + num_overloaded);
+}
+
+TEST_F(RpcTest, ExpiredNotRun) {
+  RestartSingleThreadServer(0);
+  ASSERT_TRUE(channel_->WaitToConnect(1000));
+  channel_->set_rpc_deadline(20);
+  service_impl_.sync_msec_delay = 40;
+
+  // The second call waits for the first one and expires before it gets a pool thread.
+  Context rpc2;
+  DoneBarrier done2;
+  Response response2;
+  stub_->func1(&rpc_context_, &request_, &response_, &barrier_);
+  stub_->func1(&rpc2, &request_, &response2, &done2);
+  ASSERT_TRUE(barrier_.Wait(1000));
+  ASSERT_TRUE(done2.Wait(1000));
+  EXPECT_EQ(Status::DEADLINE_EXCEEDED, rpc2.status().code());
+
+  // Wait for the server to dequeue the second call.
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  EXPECT_EQ(1, service_impl_.num_calls);
+}
+
+TEST_F(RpcTest, Batching) {
+  rpc_server_.reset(nullptr);
+  rpc_server_.reset(new RpcServer("TestRpcServer"));
+  rpc_server_->ExportService(&service_impl_);
+  rpc_server_->EnableReplyBatching();
+  rpc_server_->Open(45000, executor_.get());
+  channel_.reset(new Channel(executor_.get(), "localhost:45000"));
+  channel_->EnableWriteBatching(0);
+  stub_.reset(new TestRpcService::Stub(channel_.get()));
+
+  // The first batch is flushed while the channel is still connecting. Large requests do not
+  // fit into the socket buffer and are partially left to the bufferevent.
+  request_.set_name(string(100000, 'a'));
+  constexpr int kNumCalls = 64;
+  std::array<Response, kNumCalls> responses;
+  std::array<Context, kNumCalls> contexts;
+  std::array<DoneBarrier, kNumCalls> done_barriers;
+  for (int i = 0; i < kNumCalls; ++i) {
+    stub_->func1(&contexts[i], &request_, &responses[i], &done_barriers[i]);
+  }
+  string expected = kTestString + request_.name();
+  for (int i = 0; i < kNumCalls; ++i) {
+    ASSERT_TRUE(done_barriers[i].Wait(5000));
+    EXPECT_EQ(Status::OK, contexts[i].status().code());
+    EXPECT_EQ(expected, responses[i].result());
+  }
+}
+
 }  // namespace rpc
 }  // namespace util
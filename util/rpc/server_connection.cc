@@ -5,6 +5,7 @@
 
 #include <event2/bufferevent.h>
 #include <event2/event.h>
+#include <google/protobuf/descriptor.h>
 
 #include "util/rpc/rpc_common.h"
 #include "util/rpc/rpc_message_reader.h"
@@ -17,10 +18,15 @@ namespace rpc {
 
 ServerConnection::ServerConnection(
     bufferevent* buff_ev,
-    std::function<void(ServerConnection*, strings::Slice, strings::Slice)> cb)
-    : bev_(buff_ev, bufferevent_deleter) {
+    std::function<void(ServerConnection*, strings::Slice, strings::Slice)> cb,
+    bool batch_replies, std::function<void()> close_cb)
+    : bev_(buff_ev, bufferevent_deleter), close_cb_(std::move(close_cb)) {
   auto err_cb = std::bind(&ServerConnection::ReadErrorCallback, this);
   reader_.reset(new MessageReader(std::bind(cb, this, _1, _2), err_cb));
+  if (batch_replies) {
+    batcher_.reset(new PacketBatcher(bufferevent_get_base(buff_ev), 0, kuint32max));
+    batcher_->Reset(bev_);
+  }
 
   bufferevent_setcb(buff_ev, ServerConnection::readcb, NULL, connection_event_cb, this);
   bufferevent_setwatermark(buff_ev, EV_READ, MessageReader::min_packet_size(), 0);
@@ -30,9 +36,45 @@ ServerConnection::ServerConnection(
 ServerConnection::~ServerConnection() {
 }
 
+void ServerConnection::Call::Run() {
+  conn->ReplierCb(this);
+}
+
+ServerConnection::Call* ServerConnection::AllocateCall(int64 id, CallPool* pool) {
+  AddRef();
+  Call* call = pool->Get();
+  call->event_id = id;
+  call->conn = this;
+
+  std::lock_guard<std::mutex> lk(calls_mu_);
+  call->next = active_calls_;
+  if (active_calls_)
+    active_calls_->prev = call;
+  active_calls_ = call;
+  return call;
+}
+
+void ServerConnection::CancelCall(int64 id) {
+  // Cancel requests are rare, therefore we can afford a linear scan.
+  gpb::Closure* cancel_cb = nullptr;
+  {
+    std::lock_guard<std::mutex> lk(calls_mu_);
+    for (Call* call = active_calls_; call != nullptr; call = call->next) {
+      if (call->event_id == id) {
+        VLOG(1) << "Canceling call " << id;
+        cancel_cb = call->context.Cancel();
+        break;
+      }
+    }
+  }
+  // Run outside of the lock since the callback may complete the call.
+  if (cancel_cb)
+    cancel_cb->Run();
+}
+
 void ServerConnection::readcb(struct bufferevent* bev, void *ptr) {
   ServerConnection* me = (ServerConnection*)ptr;
-  std::shared_ptr<bufferevent> tmp(me->bev_);  // shared_ptrs are thread safe (and lock free).
+  std::shared_ptr<bufferevent> tmp(me->bev());
   if (!tmp)
     return;
   evbuffer* input = bufferevent_get_input(tmp.get());
@@ -62,12 +104,15 @@ void ServerConnection::connection_event_cb(struct bufferevent *bev, short events
 }
 
 void ServerConnection::ScheduleClose() {
-  std::shared_ptr<bufferevent> tmp;
-  tmp.swap(bev_);
+  // tmp releases the bufferevent outside of the atomic swap.
+  std::shared_ptr<bufferevent> tmp = std::atomic_exchange(&bev_, std::shared_ptr<bufferevent>());
+  if (!closed_.exchange(true, std::memory_order_acq_rel) && close_cb_)
+    close_cb_();
 }
 
 void ServerConnection::ReadErrorCallback() {
-  int sfd = bufferevent_getfd(bev_.get());
+  std::shared_ptr<bufferevent> tmp(bev());
+  int sfd = tmp ? bufferevent_getfd(tmp.get()) : -1;
   if (sfd != -1) {
     struct sockaddr addr;
     socklen_t addrlen = sizeof addr;
@@ -83,24 +128,84 @@ void ServerConnection::ReadErrorCallback() {
 
 void ServerConnection::ReplierCb(Call* call) {
   VLOG(1) << "ReplierCb start " << this;
-  std::shared_ptr<bufferevent> tmp(bev_);
-  if (tmp) {
-    evbuffer* output = bufferevent_get_output(tmp.get());
+  {
+    std::lock_guard<std::mutex> lk(calls_mu_);
+    if (call->prev) {
+      call->prev->next = call->next;
+    } else {
+      active_calls_ = call->next;
+    }
+    if (call->next)
+      call->next->prev = call->prev;
+    call->prev = call->next = nullptr;
+  }
+  call->context.Finish();
+
+  std::shared_ptr<bufferevent> tmp(bev());
+
+  // The client of a canceled call does not wait for the reply.
+  if (tmp && !call->context.IsCanceled()) {
     RpcControlResponse control_response;
     control_response.set_event_id(call->event_id);
+    const gpb::Message* payload = nullptr;
     if (call->context.Failed()) {
       VLOG(1) << "Replying with error status " << call->context.status().ShortDebugString();
       control_response.mutable_status()->Swap(call->context.mutable_status());
-      WriteRpcPacket(control_response, nullptr, output);
     } else {
       VLOG(2) << "Replying with response: " << call->msg_response->ShortDebugString();
-      WriteRpcPacket(control_response, call->msg_response.get(), output);
+      payload = call->msg_response.get();
+    }
+    if (batcher_) {
+      batcher_->Write(control_response, payload);
+    } else {
+      WriteRpcPacket(control_response, payload, bufferevent_get_output(tmp.get()));
     }
   }
+  call->pool->Release(call);
   auto r = DecRef();
-  delete call;
   VLOG(1) << "ReplierCb end " << tmp.get() << " " << r;
 }
 
+CallPool::CallPool(gpb::Service* service, const gpb::MethodDescriptor* method,
+                   unsigned max_free_calls)
+    : service_(service), method_(method), max_free_calls_(max_free_calls) {
+}
+
+CallPool::~CallPool() {
+  for (ServerConnection::Call* call : free_calls_) {
+    delete call;
+  }
+}
+
+ServerConnection::Call* CallPool::Get() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!free_calls_.empty()) {
+      ServerConnection::Call* call = free_calls_.back();
+      free_calls_.pop_back();
+      return call;
+    }
+  }
+  return new ServerConnection::Call(this, service_->GetRequestPrototype(method_).New(),
+                                    service_->GetResponsePrototype(method_).New());
+}
+
+void CallPool::Release(ServerConnection::Call* call) {
+  DCHECK(call->pool == this);
+  call->msg_request->Clear();
+  call->msg_response->Clear();
+  call->context.Reset();
+  call->conn = nullptr;
+  call->deadline_usec = 0;
+
+  std::unique_lock<std::mutex> lk(mu_);
+  if (free_calls_.size() < max_free_calls_) {
+    free_calls_.push_back(call);
+    return;
+  }
+  lk.unlock();
+  delete call;
+}
+
 }  // namespace rpc
 }  // namespace util
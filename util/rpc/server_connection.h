@@ -4,7 +4,11 @@
 #ifndef _SERVER_CONNECTION_H
 #define _SERVER_CONNECTION_H
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include "base/refcount.h"
 
 #include "strings/slice.h"
@@ -15,40 +19,72 @@ struct bufferevent;
 namespace util {
 namespace rpc {
 
+class CallPool;
 class MessageReader;
+class PacketBatcher;
 
 namespace gpb = ::google::protobuf;
 
 class ServerConnection : public base::RefCount<ServerConnection> {
   std::unique_ptr<MessageReader> reader_;
+
+  // Read and reset from several threads, therefore accessed only with std::atomic_load and
+  // std::atomic_exchange.
   std::shared_ptr<bufferevent> bev_;
+  std::atomic<bool> closed_{false};
+  std::unique_ptr<PacketBatcher> batcher_;
+  std::function<void()> close_cb_;
   enum Type {UNDEFINED, RPC, HTTP } type_ = UNDEFINED;
+
+  // Accessed only by the event loop thread of the connection.
+  RpcControlRequest control_request_;
 public:
-  struct Call {
+  // Server side rpc call. It is also the done closure passed to the service: Run() writes
+  // the reply back to the client and returns the call to its pool.
+  struct Call : public gpb::Closure {
     Context context;
 
-    int64 event_id;
+    int64 event_id = 0;
     std::unique_ptr<gpb::Message> msg_request;
     std::unique_ptr<gpb::Message> msg_response;
 
-    Call(int64 id, gpb::Message* req, gpb::Message* resp)
-        : event_id(id), msg_request(req), msg_response(resp) {}
+    ServerConnection* conn = nullptr;
+    CallPool* const pool;
+
+    // Absolute deadline in microseconds of the steady clock, 0 if there is none.
+    uint64 deadline_usec = 0;
+
+    // Links in the list of active calls of the connection.
+    Call* prev = nullptr;
+    Call* next = nullptr;
+
+    Call(CallPool* p, gpb::Message* req, gpb::Message* resp)
+        : msg_request(req), msg_response(resp), pool(p) {}
+
+    void Run() override;
   };
 
-  explicit ServerConnection(bufferevent* buff_ev,
-        std::function<void(ServerConnection*, strings::Slice, strings::Slice)> cb);
+  // If batch_replies is true, replies that become ready during the same event loop iteration
+  // are written to the socket together. close_cb, if set, is called once when the connection
+  // is closed, on the thread that closes it.
+  ServerConnection(bufferevent* buff_ev,
+        std::function<void(ServerConnection*, strings::Slice, strings::Slice)> cb,
+        bool batch_replies = false, std::function<void()> close_cb = nullptr);
 
   static void readcb(struct bufferevent* bev, void *ptr);
   static void connection_event_cb(struct bufferevent *bev, short events, void *ctx);
 
-  Call* AllocateCall(int64 id, gpb::Message* req, gpb::Message* resp) {
-    AddRef();
-    return new Call{id, req, resp};
-  }
+  Call* AllocateCall(int64 id, CallPool* pool);
+
+  // Marks the active call with the given id as canceled. Does nothing if there is no such call.
+  void CancelCall(int64 id);
+
+  // Reusable message for parsing the control part of incoming requests.
+  RpcControlRequest* control_request() { return &control_request_; }
 
   void ReadErrorCallback();
 
-  // writes the answer back the client and deletes the call.
+  // writes the answer back the client and returns the call to its pool.
   // Note that this function receives output pointer that can be invalid by the time
   // it's called.
   // TODO: We should keep all the incoming connections in set and be able to check
@@ -59,10 +95,45 @@ public:
 
   ~ServerConnection();
 
+  // Returns null after the connection was closed.
   std::shared_ptr<bufferevent> bev() const {
-    return bev_;
+    return std::atomic_load(&bev_);
   }
 
+  // Set by ScheduleClose(). Allows other threads to check the connection without
+  // touching bev_.
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+  // Calls that were allocated but did not reply yet. Intrusive list, so that tracking them
+  // does not allocate.
+  std::mutex calls_mu_;
+  Call* active_calls_ = nullptr;
+};
+
+// Recycles calls of a single rpc method so that the Call objects and their request and
+// response messages are not heap allocated per rpc. Released messages are cleared, which
+// keeps the memory of their string and repeated fields for the next rpc. Thread-safe.
+class CallPool {
+ public:
+  // Keeps at most max_free_calls unused calls.
+  CallPool(gpb::Service* service, const gpb::MethodDescriptor* method,
+           unsigned max_free_calls = 1024);
+  ~CallPool();
+
+  ServerConnection::Call* Get();
+  void Release(ServerConnection::Call* call);
+
+  gpb::Service* service() const { return service_; }
+  const gpb::MethodDescriptor* method() const { return method_; }
+
+ private:
+  gpb::Service* const service_;
+  const gpb::MethodDescriptor* const method_;
+  const unsigned max_free_calls_;
+
+  std::mutex mu_;
+  std::vector<ServerConnection::Call*> free_calls_;
 };
 
 }  // namespace rpc
@@ -51,9 +51,8 @@ bool Scheduler::Remove(handler_t h) {
 inline void Scheduler::ScheduleHandlerLocked(uint64 period, handler_t h) {
   struct timeval now;
   gettimeofday(&now, NULL);
-  period += now.tv_sec * 1000;
-  period += now.tv_usec / 1000;
-  queue_.emplace_back(period, h);
+  uint64 next = period * 1000 + now.tv_sec * 1000000ULL + now.tv_usec;
+  queue_.emplace_back(next, h);
   std::push_heap(queue_.begin(), queue_.end(), std::greater<scheduled_pair>());
 }
 
@@ -73,9 +72,9 @@ void Scheduler::ThreadMain() {
       continue;
     }
     uint64 next = queue_.front().first;
-    VLOG(1) << "Next timepoint in millis " << next;
-    time_spec.tv_sec = next/1000;
-    time_spec.tv_nsec = (next % 1000) * 1000000UL;
+    VLOG(1) << "Next timepoint in micros " << next;
+    time_spec.tv_sec = next / 1000000;
+    time_spec.tv_nsec = (next % 1000000) * 1000UL;
     int status = pthread_cond_timedwait(&cond_var_, &mutex_, &time_spec);
     if (status == 0) {
       continue;
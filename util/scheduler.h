@@ -43,7 +43,8 @@ public:
   static Scheduler& Default();
 private:
   // typedef std::chrono::time_point<std::chrono::system_clock> time_point;
-  // milliseconds
+  // Absolute time point in microseconds since epoch. Microseconds rather than
+  // milliseconds so that handlers are not fired up to 1ms early.
   typedef std::pair<uint64, handler_t> scheduled_pair;
 
   void ThreadMain();  // exits when next_id_ is 0 (assuming that we never reach maxuint32)
@@ -9,6 +9,7 @@
 #include "file/proto_writer.h"
 #include "strings/escaping.h"
 #include "util/lmdb/disk_table.h"
+#include "util/plang/plang_compiler.h"
 #include "util/plang/plang_parser.h"
 #include "util/tools/pprint_utils.h"
 #include "util/map-util.h"
@@ -51,6 +52,11 @@ static const gpb::Descriptor* FindDescriptor() {
   return descriptor;
 }
 
+// Returns nullptr if there is no --where constraint.
+static plang::CompiledExpr* CompileWhere(const plang::Expr* expr, const gpb::Message& msg) {
+  return expr ? new plang::CompiledExpr(*expr, msg.GetDescriptor()) : nullptr;
+}
+
 using namespace file;
 int main(int argc, char **argv) {
   MainInitGuard guard(&argc, &argv);
@@ -83,12 +89,13 @@ int main(int argc, char **argv) {
       iter->SeekToFirst();
       tmp_msg.reset(AllocateMsgFromDescr(FindDescriptor()));
       Printer printer(tmp_msg->GetDescriptor());
+      std::unique_ptr<plang::CompiledExpr> where(CompileWhere(test_expr.get(), *tmp_msg));
 
       while(iter->Valid()) {
         auto val = iter->value();
         CHECK(tmp_msg->ParseFromArray(val.data(), val.size()))
           << "string size: " << val.size() << ", key: " << iter->key().ToString();
-        if (test_expr && !plang::EvaluateBoolExpr(*test_expr, *tmp_msg))
+        if (where && !where->Evaluate(*tmp_msg))
           continue;
         printer.Output(*tmp_msg);
         iter->Next();
@@ -123,12 +130,13 @@ int main(int argc, char **argv) {
         tmp_msg.reset(AllocateMsgFromDescr(FindDescriptor()));
       }
       Printer printer(tmp_msg->GetDescriptor());
+      std::unique_ptr<plang::CompiledExpr> where(CompileWhere(test_expr.get(), *tmp_msg));
       auto it = table.GetIterator();
 
       while (it.Next(&key, &val)) {
         CHECK(tmp_msg->ParseFromArray(val.data(), val.size()))
           << "string size: " << val.size() << ", string: " << strings::CHexEscape(val);
-        if (test_expr && !plang::EvaluateBoolExpr(*test_expr, *tmp_msg))
+        if (where && !where->Evaluate(*tmp_msg))
           continue;
         // printer.Output(*tmp_msg);
       }
@@ -150,9 +158,10 @@ int main(int argc, char **argv) {
         tmp_msg.reset(AllocateMsgFromDescr(FindDescriptor()));
       }
       Printer printer(tmp_msg->GetDescriptor());
+      std::unique_ptr<plang::CompiledExpr> where(CompileWhere(test_expr.get(), *tmp_msg));
       for (it->SeekToFirst(); it->Valid(); it->Next()) {
         CHECK(tmp_msg->ParseFromArray(it->value().data(), it->value().size()));
-        if (test_expr && !plang::EvaluateBoolExpr(*test_expr, *tmp_msg))
+        if (where && !where->Evaluate(*tmp_msg))
           continue;
         std::cout << strings::CHexEscape(it->key()) << " : ";
         printer.Output(*tmp_msg);
@@ -175,9 +184,10 @@ int main(int argc, char **argv) {
       else
         tmp_msg.reset(AllocateMsgFromDescr(FindDescriptor()));
       Printer printer(tmp_msg->GetDescriptor());
+      std::unique_ptr<plang::CompiledExpr> where(CompileWhere(test_expr.get(), *tmp_msg));
       while (reader.ReadRecord(&record, &record_buf)) {
         CHECK(tmp_msg->ParseFromArray(record.data(), record.size()));
-        if (test_expr && !plang::EvaluateBoolExpr(*test_expr, *tmp_msg))
+        if (where && !where->Evaluate(*tmp_msg))
           continue;
         printer.Output(*tmp_msg);
       }